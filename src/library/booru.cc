@@ -16,9 +16,22 @@
 
 #include "db/sql.hh"
 #include "db/sqlite3/db.hh"
+#include "db/write_queue.hh"
+#include "search/compiler.hh"
+#include "search/index.hh"
+#include "search/page.hh"
+#include "search/query.hh"
+#include "search/result_cache.hh"
+#include "search/tag_dictionary.hh"
+#include "tags/tag_graph.hh"
 
 #include <log4cxx/basicconfigurator.h>
 
+#include <chrono>
+#include <map>
+#include <set>
+#include <unordered_set>
+
 namespace Booru
 {
 
@@ -27,6 +40,8 @@ Owning<Booru> Booru::InitializeLibrary() { return Owning<Booru>(new Booru); }
 int64_t Booru::GetSchemaVersion() { return SQLGetSchemaVersion(); }
 
 Booru::Booru()
+    : m_TagGraph(MakeOwning<Tags::TagGraph>()),
+      m_SearchCache(MakeOwning<Search::ResultCache>())
 {
     log4cxx::BasicConfigurator::resetConfiguration();
     log4cxx::BasicConfigurator::configure();
@@ -41,13 +56,14 @@ Booru::~Booru()
     CloseDatabase();
 }
 
-ResultCode Booru::OpenDatabase(StringView const& _Path, bool _Create)
+ResultCode Booru::OpenDatabase(StringView const& _Path, bool _Create,
+                               DB::OpenOptions const& _Options)
 {
     LOG_INFO("Opening database at '{}'...", _Path);
 
     CloseDatabase();
 
-    auto db = DB::Sqlite3::Backend::OpenDatabase(_Path);
+    auto db = DB::Sqlite3::Backend::OpenDatabase(_Path, _Options);
     if (!db) { return db.Code; }
 
     // TODO: other databases
@@ -78,17 +94,37 @@ ResultCode Booru::OpenDatabase(StringView const& _Path, bool _Create)
         CHECK_RETURN_RESULT_ON_ERROR(UpdateTables(i));
     }
 
+    // counts are maintained by triggers, this only catches outside changes
+    if (!m_DB->IsReadOnly()) CHECK(ReconcileTagPostCountsIfDue());
+
+    // searches fall back to SQL if this fails
+    if (m_SearchIndexEnabled) CHECK(BuildSearchIndex());
+    if (m_TagDictionaryEnabled) CHECK(BuildTagDictionary());
+
     return ResultCode::OK;
 }
 
 void Booru::CloseDatabase()
 {
+    {
+        // pending changes are still made
+        std::lock_guard lock(m_WriteQueueMutex);
+        m_WriteQueue = nullptr;
+    }
+
     if (m_DB)
     {
         while (m_DB->IsInTransaction())
             CHECK(m_DB->RollbackTransaction());
     }
     m_DB = nullptr;
+    {
+        auto lock       = LockCachesForChange();
+        m_SearchIndex   = nullptr;
+        m_TagDictionary = nullptr;
+        m_TagGraph->Invalidate();
+    }
+    m_SearchCache->Clear();
 }
 
 DB::ExpectedDB Booru::GetDatabase()
@@ -148,6 +184,61 @@ Expected<DB::Entities::PostType> Booru::GetPostType(DB::TEXT const& _Name)
     return Get<DB::Entities::PostType>("Name"sv, _Name);
 }
 
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Batched lookups
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Encode strings as a JSON array. The array is bound as a single
+/// parameter and expanded with json_each(), so the statement text doesn't
+/// depend on the number of strings.
+static String ToJsonArray(Span<DB::TEXT const> _Strings)
+{
+    String json = "[";
+    for (auto const& str : _Strings)
+    {
+        if (json.size() > 1) json += ',';
+        json += '"';
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\')
+            {
+                json += '\\';
+                json += c;
+            }
+            else if (uint8_t(c) < 0x20)
+            {
+                json += std::format("\\u{:04x}", int(c));
+            }
+            else
+            {
+                json += c;
+            }
+        }
+        json += '"';
+    }
+    return json + "]";
+}
+
+/// @brief Put entities into the order of the keys they were requested by.
+/// Keys that weren't found are skipped.
+template <class TEntity, class TKey, class TGetKey>
+static Vector<TEntity> OrderByKeys(Vector<TEntity> const& _Entities,
+                                   Span<TKey const> _Keys, TGetKey _GetKey)
+{
+    std::map<TKey, size_t> indices;
+    for (size_t i = 0; i < _Entities.size(); i++)
+        indices.emplace(_GetKey(_Entities[i]), i);
+
+    Vector<TEntity> ordered;
+    ordered.reserve(_Entities.size());
+    for (auto const& key : _Keys)
+    {
+        auto found = indices.find(key);
+        if (found != indices.end()) ordered.push_back(_Entities[found->second]);
+    }
+    return ordered;
+}
+
 // ////////////////////////////////////////////////////////////////////////////////////////////
 // Posts
 // ////////////////////////////////////////////////////////////////////////////////////////////
@@ -170,6 +261,58 @@ Expected<DB::Entities::Post> Booru::GetPost(DB::BLOB<16> _MD5)
     return Get<DB::Entities::Post>("MD5Sum", _MD5);
 }
 
+/// @brief Get several posts by Id.
+ExpectedVector<DB::Entities::Post>
+Booru::GetPosts(Span<DB::INTEGER const> _Ids)
+{
+    static auto postQuery =
+        DB::Query::Select(DB::Entities::Post::Table)
+            .Where(DB::Query::Where::In("Posts.Id",
+                                        DB::Query::SelectIds("Ids")));
+
+    if (_Ids.empty()) return Vector<DB::Entities::Post>{};
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        posts, GetDatabase()
+                   .Then(&DB::Query::Select::Prepare, postQuery)
+                   .Then(&DB::IStmt::BindIds, "Ids", _Ids)
+                   .Then(&DB::IStmt::ExecuteList<DB::Entities::Post>));
+
+    return OrderByKeys(posts.Value, _Ids,
+                       [](auto const& _Post) { return _Post.Id; });
+}
+
+/// @brief Get several posts by hash.
+ExpectedVector<DB::Entities::Post>
+Booru::GetPostsByMD5(Span<DB::MD5BLOB const> _MD5Sums)
+{
+    // sums are bound as one blob and split into 16 byte rows
+    static auto postQuery =
+        DB::Query::Select(DB::Entities::Post::Table)
+            .Where(DB::Query::Where::In(
+                "MD5Sum", "WITH RECURSIVE Sums(Pos) AS "
+                          "( SELECT 0 UNION ALL SELECT Pos + 16 FROM Sums "
+                          "WHERE Pos + 16 < length($MD5Sums) ) "
+                          "SELECT substr($MD5Sums, Pos + 1, 16) FROM Sums"));
+
+    if (_MD5Sums.empty()) return Vector<DB::Entities::Post>{};
+
+    Vector<Byte> sums;
+    sums.reserve(_MD5Sums.size() * 16);
+    for (auto const& md5 : _MD5Sums)
+        sums.insert(sums.end(), md5.begin(), md5.end());
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        posts, GetDatabase()
+                   .Then(&DB::Query::Select::Prepare, postQuery)
+                   .Then(DB::IStmt::BindValueFn<ByteSpan>(), "MD5Sums",
+                         ByteSpan{sums})
+                   .Then(&DB::IStmt::ExecuteList<DB::Entities::Post>));
+
+    return OrderByKeys(posts.Value, _MD5Sums,
+                       [](auto const& _Post) { return _Post.MD5Sum; });
+}
+
 /// @brief Add a tag by name to a post. Considers negation, redirections and
 /// implications.
 Expected<DB::Entities::Post>
@@ -178,50 +321,49 @@ Booru::AddTagToPost(DB::Entities::Post const& _Post,
 {
     if (_Post.Id == -1 || _Tag.Id == -1) { return ResultCode::InvalidArgument; }
 
-    CHECK_VAR_RETURN_RESULT_ON_ERROR(tag, FollowRedirections(_Tag));
+    static constexpr auto insertSql = R"SQL(
+        INSERT OR IGNORE INTO PostTags (PostId, TagId)
+        SELECT $PostId, value FROM IdSet( $TagIds )
+        RETURNING Id, PostId, TagId
+    )SQL";
+
+    static constexpr auto deleteSql = R"SQL(
+        DELETE FROM PostTags
+        WHERE PostId = $PostId
+          AND TagId IN ( SELECT value FROM IdSet( $TagIds ) )
+        RETURNING Id, PostId, TagId
+    )SQL";
+
     CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(closure, GetTagClosure(_Tag.Id));
 
-    {
-        DB::TransactionGuard transactionGuard(db);
+    DB::TransactionGuard transactionGuard(db.Value);
+    if (!transactionGuard.GetIsValid()) return ResultCode::InvalidState;
 
-        // actually add tag
-        DB::Entities::PostTag postTag;
-        postTag.PostId    = _Post.Id;
-        postTag.TagId     = tag.Value.Id;
+    // implications are only applied when the tag is new to the post
+    if (FindPostTag(_Post.Id, closure.Value.Add.front()))
+        return transactionGuard.Commit();
 
-        auto createResult = Create(postTag);
-        if (createResult.Code == ResultCode::AlreadyExists)
-        {
-            // already exists
-            transactionGuard.Commit();
-            return ResultCode::OK;
-        }
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        added, db.Value->PrepareStatement(insertSql)
+                   .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "PostId",
+                         _Post.Id)
+                   .Then(&DB::IStmt::BindIds, "TagIds",
+                         Span<DB::INTEGER const>(closure.Value.Add))
+                   .Then(&DB::IStmt::ExecuteList<DB::Entities::PostTag>));
 
-        // try to honor implications, ignore errors
-        CHECK_VAR_RETURN_RESULT_ON_ERROR(implications,
-                                         GetTagImplicationsForTag(tag));
-        for (auto const& implication : implications.Value)
-        {
-            DB::INTEGER impliedTagId = implication.ImpliedTagId;
-            auto impliedTag          = GetTag(impliedTagId);
-            CHECK_CONTINUE_ON_ERROR(impliedTag);
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        removed, db.Value->PrepareStatement(deleteSql)
+                     .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "PostId",
+                           _Post.Id)
+                     .Then(&DB::IStmt::BindIds, "TagIds",
+                           Span<DB::INTEGER const>(closure.Value.Remove))
+                     .Then(&DB::IStmt::ExecuteList<DB::Entities::PostTag>));
 
-            if (implication.Flags &
-                DB::Entities::TagImplication::FLAG_REMOVE_TAG)
-            {
-                // might fail if tag has not been added, that's fine, ignore
-                CHECK(RemoveTagFromPost(_Post, impliedTag));
-            }
-            else
-            {
-                // recurse, added tag may have redirection, implications, ...
-                // might fail if already added, ignore
-                CHECK(AddTagToPost(_Post, impliedTag));
-            }
-        }
+    CHECK_RETURN_RESULT_ON_ERROR(transactionGuard.Commit());
 
-        transactionGuard.Commit();
-    }
+    for (auto const& postTag : added.Value) OnCreated(postTag);
+    for (auto const& postTag : removed.Value) OnDeleted(postTag);
     return ResultCode::OK;
 }
 
@@ -239,16 +381,189 @@ Booru::RemoveTagFromPost(DB::Entities::Post const& _Post,
 ExpectedVector<DB::Entities::Post>
 Booru::FindPosts(StringView const& _QueryString)
 {
-    StringVector queryStringTokens = Strings::Split(_QueryString);
-    if (queryStringTokens.empty()) return ResultCode::InvalidRequest;
+    String key = Search::ResultCache::MakeKey(_QueryString);
+    if (auto postIds = FindCachedSearch(key))
+    {
+        return PreparePostsById(*postIds).Then(
+            &DB::IStmt::ExecuteList<DB::Entities::Post>);
+    }
+    auto generation = GetSearchGeneration();
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(terms, ResolveSearchTerms(_QueryString));
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        posts, PrepareFindPosts(terms.Value)
+                   .Then(&DB::IStmt::ExecuteList<DB::Entities::Post>));
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        postIds, DB::Entities::CollectIds<DB::Entities::Post>(posts.Value));
+
+    m_SearchCache->Insert(key, std::move(postIds.Value), terms.Value,
+                          generation);
+    return posts;
+}
+
+/// @brief Stream all posts that match a given query. Uses cached results but
+/// does not add to them, the posts are only known once the cursor is done.
+DB::ExpectedCursor<DB::Entities::Post>
+Booru::StreamFindPosts(StringView const& _QueryString)
+{
+    String key = Search::ResultCache::MakeKey(_QueryString);
+    if (auto postIds = FindCachedSearch(key))
+    {
+        return PreparePostsById(*postIds).Then(
+            &DB::IStmt::ExecuteCursor<DB::Entities::Post>);
+    }
+
+    return ResolveSearchTerms(_QueryString)
+        .Then([this](auto _Terms) { return PrepareFindPosts(_Terms); })
+        .Then(&DB::IStmt::ExecuteCursor<DB::Entities::Post>);
+}
+
+/// @brief Get one page of posts that match a query.
+Expected<Search::PostPage>
+Booru::FindPostsPage(Search::PostPageRequest const& _Request)
+{
+    if (_Request.PageSize == 0) return ResultCode::InvalidArgument;
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(after, Search::ParsePageCursor(_Request));
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+
+    // matches from the cache or the index are cut down to the page in memory
+    String key      = Search::ResultCache::MakeKey(_Request.Query);
+    auto postIds    = FindCachedSearch(key);
+    auto generation = GetSearchGeneration();
+
+    if (!postIds)
+    {
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(terms,
+                                         ResolveSearchTerms(_Request.Query));
+        auto remaining = terms.Value;
+        auto evaluated = EvaluateSearchIndex(remaining);
+        if (!evaluated)
+        {
+            // the database pages through its own indexes
+            auto query = Search::CompilePostQuery(std::move(terms.Value));
+            Search::ApplyPage(query, _Request, after.Value);
+            return ReadPostPage(query, _Request, after.Value);
+        }
+
+        // remaining terms filter the matches once, later pages are cached
+        if (!remaining.empty())
+        {
+            CHECK_VAR_RETURN_RESULT_ON_ERROR(
+                filtered, Search::LoadPageKeys(
+                              db.Value,
+                              Search::CompilePostIdQuery(*evaluated, remaining),
+                              Search::PostOrder::Id));
+            evaluated->clear();
+            for (auto const& filteredKey : filtered.Value)
+                evaluated->push_back(filteredKey.Id);
+        }
+
+        postIds = m_SearchCache->Insert(key, std::move(*evaluated),
+                                        terms.Value, generation);
+    }
+
+    Vector<DB::INTEGER> pageIds;
+    if (_Request.Order == Search::PostOrder::Id)
+    {
+        pageIds = Search::SlicePage(*postIds, _Request, after.Value);
+    }
+    else
+    {
+        // sort keys of all matches are read once per cached result
+        auto sortKeys = m_SearchCache->FindSortKeys(key, _Request.Order);
+        if (!sortKeys)
+        {
+            CHECK_VAR_RETURN_RESULT_ON_ERROR(
+                loaded,
+                Search::LoadPageKeys(db.Value,
+                                     Search::CompilePostIdQuery(*postIds),
+                                     _Request.Order));
+            sortKeys = m_SearchCache->InsertSortKeys(
+                key, _Request.Order, std::move(loaded.Value), generation);
+        }
+        pageIds = Search::SlicePage(*sortKeys, _Request, after.Value);
+    }
+
+    auto query = Search::CompilePostIdQuery(pageIds);
+    Search::ApplyPage(query, _Request, after.Value);
+    return ReadPostPage(query, _Request, after.Value);
+}
+
+Expected<Search::PostPage>
+Booru::ReadPostPage(DB::Query::Select const& _Query,
+                    Search::PostPageRequest const& _Request,
+                    Optional<Search::PageKey> const& _After)
+{
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        posts, GetDatabase()
+                   .Then(&DB::Query::Select::Prepare, _Query)
+                   .Then(&Search::BindPage, _Request, _After)
+                   .Then(&DB::IStmt::ExecuteCursor<DB::Entities::Post>));
+
+    Search::PostPage page;
+    for (auto const& post : posts.Value)
+    {
+        if (page.Posts.size() == _Request.PageSize)
+        {
+            // the extra post only tells that there is a next page
+            page.NextCursor =
+                Search::MakePageCursor(_Request, page.Posts.back());
+            break;
+        }
+        page.Posts.push_back(post);
+    }
+    CHECK_RETURN_RESULT_ON_ERROR(posts.Value.GetResult());
+
+    return page;
+}
+
+/// @brief Count posts that match a query.
+Expected<DB::INTEGER> Booru::CountPosts(StringView const& _QueryString)
+{
+    String key = Search::ResultCache::MakeKey(_QueryString);
+    if (auto postIds = FindCachedSearch(key))
+        return DB::INTEGER(postIds->size());
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(terms, ResolveSearchTerms(_QueryString));
+    auto postIds = EvaluateSearchIndex(terms.Value);
+    if (postIds && terms.Value.empty()) return DB::INTEGER(postIds->size());
+
+    auto query = postIds ? Search::CompilePostIdQuery(*postIds, terms.Value)
+                         : Search::CompilePostQuery(std::move(terms.Value));
+    query.Column("COUNT(*)");
+    return GetDatabase()
+        .Then(&DB::Query::Select::Prepare, query)
+        .Then(&DB::IStmt::ExecuteScalar<DB::INTEGER>, true);
+}
+
+Expected<DB::Entities::Post> Booru::DeletePost(DB::Entities::Post& _Post)
+{
+    CHECK_RETURN_RESULT_ON_ERROR(_Post.CheckValidForDelete());
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+
+    DB::TransactionGuard guard(db.Value);
+    if (!guard.GetIsValid()) return ResultCode::InvalidState;
 
-    auto query = DB::Query::Select(DB::Entities::Post::Table);
+    // post tags are deleted along with the post, keep them for the hooks
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        postTags, GetAll<DB::Entities::PostTag>("PostId", _Post.Id));
+    // the id is reset by the delete, the hooks still need it
+    DB::Entities::Post removed = _Post;
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        deleted, DB::Entities::Delete<DB::Entities::Post>(db.Value, _Post));
 
-    for (auto const& tag : queryStringTokens)
-        query.Where(GetSQLConditionForTag(tag));
+    auto committed = guard.Commit();
+    if (ResultIsError(committed))
+    {
+        // the post is still there
+        _Post.Id = removed.Id;
+        return committed;
+    }
 
-    return query.Prepare(m_DB).Then(
-        &DB::IStmt::ExecuteList<DB::Entities::Post>);
+    for (auto const& postTag : postTags.Value) OnDeleted(postTag);
+    OnDeleted(removed);
+    return deleted;
 }
 
 // ////////////////////////////////////////////////////////////////////////////////////////////
@@ -279,24 +594,58 @@ ExpectedVector<DB::Entities::Tag> Booru::GetTagsForPost(DB::INTEGER _PostId)
         .Then(&DB::IStmt::ExecuteList<DB::Entities::Tag>);
 }
 
-/// @brief Get all posts for a tag by Id.
-ExpectedVector<DB::Entities::Post> Booru::GetPostsForTag(DB::INTEGER _TagId)
+/// @brief Get all tags for several posts by Id.
+Expected<Booru::EntitiesByPost<DB::Entities::Tag>>
+Booru::GetTagsForPosts(Span<DB::INTEGER const> _PostIds)
 {
-    static auto postIdSubQuery =
-        DB::Query::Select(DB::Entities::PostTag::Table)
-            .Column("TagId")
-            .Where(DB::Query::Where::Equal("TagId", "$TagId "));
+    static auto tagQuery =
+        DB::Query::Select("PostTags JOIN Tags ON Tags.Id = PostTags.TagId")
+            .Column("PostTags.PostId")
+            .Column("Tags.*")
+            .Where(DB::Query::Where::In("PostTags.PostId",
+                                        DB::Query::SelectIds("PostIds")));
 
-    static auto postQuery =
-        DB::Query::Select(DB::Entities::Post::Table)
-            .Where(DB::Query::Where::In("Posts.Id", postIdSubQuery));
+    EntitiesByPost<DB::Entities::Tag> tagsByPost;
+    for (auto postId : _PostIds) tagsByPost[postId];
+    if (_PostIds.empty()) return tagsByPost;
 
-    return GetDatabase()
-        .Then(&DB::Query::Select::Prepare, postQuery)
-        .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "TagId", _TagId)
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        stmt, GetDatabase()
+                  .Then(&DB::Query::Select::Prepare, tagQuery)
+                  .Then(&DB::IStmt::BindIds, "PostIds", _PostIds));
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(stepResult, stmt.Value->StepQuery());
+    while (stepResult != ResultCode::DatabaseEnd)
+    {
+        DB::INTEGER postId = -1;
+        DB::Entities::Tag tag;
+        CHECK_RETURN_RESULT_ON_ERROR(
+            stmt.Value->GetColumnValue("PostId", postId));
+        CHECK_RETURN_RESULT_ON_ERROR(
+            DB::Entities::LoadEntity(tag, stmt.Value.get()));
+        tagsByPost[postId].push_back(std::move(tag));
+
+        stepResult = stmt.Value->StepQuery();
+        CHECK_RETURN_RESULT_ON_ERROR(stepResult);
+    }
+    return tagsByPost;
+}
+
+/// @brief Get all posts for a tag by Id.
+ExpectedVector<DB::Entities::Post> Booru::GetPostsForTag(DB::INTEGER _TagId)
+{
+    return PreparePostsForTag(_TagId)
         .Then(&DB::IStmt::ExecuteList<DB::Entities::Post>);
 }
 
+/// @brief Stream all posts for a tag by Id.
+DB::ExpectedCursor<DB::Entities::Post>
+Booru::StreamPostsForTag(DB::INTEGER _TagId)
+{
+    return PreparePostsForTag(_TagId)
+        .Then(&DB::IStmt::ExecuteCursor<DB::Entities::Post>);
+}
+
 /// @brief Find a post/tag associations.
 
 Expected<DB::Entities::PostTag> Booru::FindPostTag(DB::INTEGER _PostId,
@@ -314,6 +663,84 @@ Expected<DB::Entities::PostTag> Booru::FindPostTag(DB::INTEGER _PostId,
         .Then(&DB::IStmt::ExecuteRow<DB::Entities::PostTag>, true);
 }
 
+/// @brief Add and remove tags of many posts at once.
+Expected<Booru::TagEditCounts>
+Booru::ApplyTagEdits(Span<DB::INTEGER const> _PostIds,
+                     Span<DB::INTEGER const> _AddTagIds,
+                     Span<DB::INTEGER const> _RemoveTagIds)
+{
+    static constexpr auto insertSql = R"SQL(
+        INSERT OR IGNORE INTO PostTags (PostId, TagId)
+        SELECT post.value, tag.value
+        FROM IdSet( $PostIds ) AS post, IdSet( $TagIds ) AS tag
+        RETURNING Id, PostId, TagId
+    )SQL";
+
+    static constexpr auto deleteSql = R"SQL(
+        DELETE FROM PostTags
+        WHERE PostId IN ( SELECT value FROM IdSet( $PostIds ) )
+          AND TagId IN ( SELECT value FROM IdSet( $TagIds ) )
+        RETURNING Id, PostId, TagId
+    )SQL";
+
+    if (_PostIds.empty()) return TagEditCounts{};
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+
+    // expand the tags once instead of for every post
+    Vector<DB::INTEGER> addTagIds, removeTagIds;
+    std::unordered_set<DB::INTEGER> added;
+    for (auto tagId : _AddTagIds)
+    {
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(closure, GetTagClosure(tagId));
+        for (auto impliedTagId : closure.Value.Add)
+        {
+            if (added.insert(impliedTagId).second)
+                addTagIds.push_back(impliedTagId);
+        }
+        removeTagIds.insert(std::end(removeTagIds),
+                            std::begin(closure.Value.Remove),
+                            std::end(closure.Value.Remove));
+    }
+
+    // posts may still have the redirected tag itself
+    for (auto tagId : _RemoveTagIds)
+    {
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(resolved, ResolveTagRedirect(tagId));
+        removeTagIds.push_back(tagId);
+        if (resolved.Value != tagId) removeTagIds.push_back(resolved.Value);
+    }
+    std::erase_if(removeTagIds,
+                  [&](DB::INTEGER _Id) { return added.contains(_Id); });
+
+    DB::TransactionGuard transactionGuard(db.Value);
+    if (!transactionGuard.GetIsValid()) return ResultCode::InvalidState;
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        created, db.Value->PrepareStatement(insertSql)
+                     .Then(&DB::IStmt::BindIds, "PostIds", _PostIds)
+                     .Then(&DB::IStmt::BindIds, "TagIds",
+                           Span<DB::INTEGER const>(addTagIds))
+                     .Then(&DB::IStmt::ExecuteList<DB::Entities::PostTag>));
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        deleted, db.Value->PrepareStatement(deleteSql)
+                     .Then(&DB::IStmt::BindIds, "PostIds", _PostIds)
+                     .Then(&DB::IStmt::BindIds, "TagIds",
+                           Span<DB::INTEGER const>(removeTagIds))
+                     .Then(&DB::IStmt::ExecuteList<DB::Entities::PostTag>));
+
+    CHECK_RETURN_RESULT_ON_ERROR(transactionGuard.Commit());
+
+    for (auto const& postTag : created.Value) OnCreated(postTag);
+    for (auto const& postTag : deleted.Value) OnDeleted(postTag);
+
+    LOG_DEBUG("Tag edits of {} posts: {} added, {} removed", _PostIds.size(),
+              created.Value.size(), deleted.Value.size());
+    return TagEditCounts{DB::INTEGER(created.Value.size()),
+                         DB::INTEGER(deleted.Value.size())};
+}
+
 // ////////////////////////////////////////////////////////////////////////////////////////////
 // PostFiles
 // ////////////////////////////////////////////////////////////////////////////////////////////
@@ -331,6 +758,30 @@ Booru::GetFilesForPost(DB::INTEGER _PostId)
     return GetAll<DB::Entities::PostFile>("PostId", _PostId);
 }
 
+/// @brief Get all files for several posts by Id.
+Expected<Booru::EntitiesByPost<DB::Entities::PostFile>>
+Booru::GetFilesForPosts(Span<DB::INTEGER const> _PostIds)
+{
+    static auto fileQuery =
+        DB::Query::Select(DB::Entities::PostFile::Table)
+            .Where(DB::Query::Where::In("PostId",
+                                        DB::Query::SelectIds("PostIds")));
+
+    EntitiesByPost<DB::Entities::PostFile> filesByPost;
+    for (auto postId : _PostIds) filesByPost[postId];
+    if (_PostIds.empty()) return filesByPost;
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        files, GetDatabase()
+                   .Then(&DB::Query::Select::Prepare, fileQuery)
+                   .Then(&DB::IStmt::BindIds, "PostIds", _PostIds)
+                   .Then(&DB::IStmt::ExecuteList<DB::Entities::PostFile>));
+
+    for (auto& file : files.Value)
+        filesByPost[file.PostId].push_back(std::move(file));
+    return filesByPost;
+}
+
 // ////////////////////////////////////////////////////////////////////////////////////////////
 // Sites
 // ////////////////////////////////////////////////////////////////////////////////////////////
@@ -375,187 +826,1067 @@ Expected<DB::Entities::Tag> Booru::GetTag(DB::TEXT const& _Name)
     return Get<DB::Entities::Tag, DB::TEXT>("Name", _Name);
 }
 
-/// @brief Get all tags that match a given pattern.
-ExpectedVector<DB::Entities::Tag> Booru::MatchTags(StringView const& _Pattern)
+/// @brief Get several tags by name.
+ExpectedVector<DB::Entities::Tag>
+Booru::GetTagsByNames(Span<DB::TEXT const> _Names)
 {
-    // make a copy
-    String pattern{_Pattern};
+    static auto tagQuery =
+        DB::Query::Select(DB::Entities::Tag::Table)
+            .Where(DB::Query::Where::In("Name",
+                                        "SELECT value FROM json_each($Names)"));
+
+    if (_Names.empty()) return Vector<DB::Entities::Tag>{};
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        tags, GetDatabase()
+                  .Then(&DB::Query::Select::Prepare, tagQuery)
+                  .Then(DB::IStmt::BindValueFn<DB::TEXT>(), "Names",
+                        ToJsonArray(_Names))
+                  .Then(&DB::IStmt::ExecuteList<DB::Entities::Tag>));
+
+    return OrderByKeys(tags.Value, _Names,
+                       [](auto const& _Tag) { return _Tag.Name; });
+}
 
-    // handle escape sequences and special characters
-    String::size_type pos = 0;
-    while (pos < pattern.size())
+/// @brief Convert a tag pattern into a pattern for LIKE with '\' as escape
+/// character.
+static String ToLikePattern(StringView const& _Pattern)
+{
+    String pattern;
+    for (size_t pos = 0; pos < _Pattern.size(); pos++)
     {
+        switch (_Pattern[pos])
+        {
         // escape SQL special characters:
         // "%" -> "\%", "_" -> "\_"
-        if (pattern[pos] == '%' || pattern[pos] == '_')
-        {
-            pattern.insert(pos, 1, '\\');
-            pos += 2;
-            continue;
-        }
-
-        // handle escape
-        if (pattern[pos] == '\\')
-        {
-            // remove escape character and skip over the next
-            pattern.erase(pos);
-            pos++;
-            continue;
-        }
+        case '%':
+        case '_':
+            pattern += '\\';
+            pattern += _Pattern[pos];
+            break;
+
+        // handle escape, keep the next character as is
+        case '\\':
+            if (++pos == _Pattern.size()) break;
+            if (_Pattern[pos] == '%' || _Pattern[pos] == '_' ||
+                _Pattern[pos] == '\\')
+            {
+                pattern += '\\';
+            }
+            pattern += _Pattern[pos];
+            break;
 
         // convert wildcards to SQL
-        // "*" -> "%"
-        if (pattern[pos] == '*')
-        {
-            pattern[pos] = '%';
-            pos++;
-            continue;
-        }
-        // "?" -> "_"
-        if (pattern[pos] == '?')
-        {
-            pattern[pos] = '_';
-            pos++;
-            continue;
+        // "*" -> "%", "?" -> "_"
+        case '*':
+            pattern += '%';
+            break;
+
+        case '?':
+            pattern += '_';
+            break;
+
+        default:
+            pattern += _Pattern[pos];
+            break;
         }
+    }
+    return pattern;
+}
 
-        //
-        pos++;
+/// @brief Get all tags that match a given pattern.
+ExpectedVector<DB::Entities::Tag> Booru::MatchTags(StringView const& _Pattern)
+{
+    Optional<Vector<DB::INTEGER>> tagIds;
+    {
+        auto lock = LockCaches();
+        if (auto dictionary = GetTagDictionary())
+            tagIds = dictionary->Match(_Pattern);
     }
 
-    // handle wildcards, convert * to %, leave ?
-    String::size_type asterPos = pattern.find('*');
-    while (asterPos != String::npos)
+    if (tagIds)
     {
-        pattern[asterPos] = '%';
-        asterPos          = pattern.find('*');
+        if (tagIds->empty()) return Vector<DB::Entities::Tag>{};
+
+        // bound, so every match reuses the same statement
+        return GetDatabase()
+            .Then(
+                [&](auto db)
+                {
+                    return db->PrepareStatement(
+                        "SELECT * FROM Tags "
+                        "WHERE Id IN ( SELECT value FROM IdSet( $TagIds ) ) "
+                        "ORDER BY PostCount DESC, Name");
+                })
+            .Then(&DB::IStmt::BindIds, "TagIds",
+                  Span<DB::INTEGER const>(*tagIds))
+            .Then(&DB::IStmt::ExecuteList<DB::Entities::Tag>);
     }
 
     return GetDatabase()
         .Then(
             [&](auto db)
             {
+                // most used tags first
                 return db->PrepareStatement(
-                    "SELECT * FROM Tags WHERE Name LIKE $Pattern ESCAPE '\\'");
+                    "SELECT * FROM Tags WHERE Name LIKE $Pattern ESCAPE '\\' "
+                    "ORDER BY PostCount DESC, Name");
             })
-        .Then(DB::IStmt::BindValueFn<DB::TEXT>(), "Pattern", pattern)
+        .Then(DB::IStmt::BindValueFn<DB::TEXT>(), "Pattern",
+              ToLikePattern(_Pattern))
         .Then(&DB::IStmt::ExecuteList<DB::Entities::Tag>);
 }
 
-/// @brief Follow the redirection of a tag
-Expected<DB::Entities::Tag>
-Booru::FollowRedirections(DB::Entities::Tag const& _Tag)
+/// @brief Get the most used tags starting with a pattern.
+ExpectedVector<Search::TagCompletion>
+Booru::CompleteTags(StringView const& _Pattern, size_t _Limit)
 {
-    Expected tag  = _Tag;
-
-    // follow redirections
-    int iteration = 0;
-    while (tag.Value.RedirectId.has_value())
     {
-        // TODO: make this a setting
-        if (iteration++ > 32) { return ResultCode::RecursionExceeded; }
-        CHECK_RETURN_RESULT_ON_ERROR(
-            GetTag(tag.Value.RedirectId.value()).Update(tag));
+        auto lock = LockCaches();
+        if (auto dictionary = GetTagDictionary())
+            return dictionary->Complete(_Pattern, _Limit);
     }
-    return tag;
-}
 
-// ////////////////////////////////////////////////////////////////////////////////////////////
-// TagImplications
-// ////////////////////////////////////////////////////////////////////////////////////////////
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        tags, db.Value->PrepareStatement(
+                      "SELECT * FROM Tags WHERE Name LIKE $Pattern ESCAPE '\\' "
+                      "ORDER BY PostCount DESC, Name LIMIT $Limit")
+                  .Then(DB::IStmt::BindValueFn<DB::TEXT>(), "Pattern",
+                        ToLikePattern(_Pattern) + "%")
+                  .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "Limit",
+                        DB::INTEGER(_Limit))
+                  .Then(&DB::IStmt::ExecuteList<DB::Entities::Tag>));
+
+    Vector<Search::TagCompletion> completions;
+    for (auto const& tag : tags.Value)
+        completions.push_back({tag.Id, tag.Name, tag.PostCount});
+    return completions;
+}
 
-ExpectedVector<DB::Entities::TagImplication> Booru::GetTagImplications()
+/// @brief Get tags with a name similar to a possibly mistyped one.
+ExpectedVector<Search::TagSuggestion>
+Booru::SuggestTags(StringView const& _Name, size_t _MaxDistance, size_t _Limit)
 {
-    return GetAll<DB::Entities::TagImplication>();
+    {
+        auto lock = LockCaches();
+        if (auto dictionary = GetTagDictionary())
+            return dictionary->Suggest(_Name, _MaxDistance, _Limit);
+    }
+
+    // LIKE can't express this, a temporary dictionary still beats comparing
+    // each name on its own
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+    Search::TagDictionary dictionary;
+    CHECK_RETURN_RESULT_ON_ERROR(dictionary.Build(db.Value));
+    return dictionary.Suggest(_Name, _MaxDistance, _Limit);
 }
 
-ExpectedVector<DB::Entities::TagImplication>
-Booru::GetTagImplicationsForTag(DB::Entities::Tag const& _Tag)
+/// @brief Follow the redirection of a tag
+Expected<DB::Entities::Tag>
+Booru::FollowRedirections(DB::Entities::Tag const& _Tag)
 {
-    return GetAll<DB::Entities::TagImplication>("TagId", _Tag.Id);
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(tagId, ResolveTagRedirect(_Tag.Id));
+    if (tagId.Value == _Tag.Id) return _Tag;
+    return GetTag(tagId.Value);
 }
 
-// ////////////////////////////////////////////////////////////////////////////////////////////
-// TagTypes
-// ////////////////////////////////////////////////////////////////////////////////////////////
-
-/// @brief Get all tag types.
-ExpectedVector<DB::Entities::TagType> Booru::GetTagTypes()
+Expected<DB::INTEGER> Booru::ResolveTagRedirect(DB::INTEGER _TagId)
 {
-    return GetAll<DB::Entities::TagType>();
+    auto lock = LockCaches();
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(graph, GetTagGraph());
+    return graph.Value->ResolveRedirect(_TagId);
 }
 
-/// @brief Get tag type by Id.
-Expected<DB::Entities::TagType> Booru::GetTagType(DB::INTEGER _Id)
+Expected<Tags::TagClosure> Booru::GetTagClosure(DB::INTEGER _TagId)
 {
-    return Get<DB::Entities::TagType>("Id", _Id);
+    auto lock = LockCaches();
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(graph, GetTagGraph());
+    return graph.Value->GetClosure(_TagId);
 }
 
-/// @brief Get tag type by name.
-Expected<DB::Entities::TagType> Booru::GetTagType(DB::TEXT const& _Name)
+Expected<DB::INTEGER> Booru::FlattenTagRedirects()
 {
-    return Get<DB::Entities::TagType>("Name", _Name);
-}
+    static auto updateQuery =
+        DB::Query::Update(DB::Entities::Tag::Table).Column("RedirectId").Key(
+            "Id");
 
-// ////////////////////////////////////////////////////////////////////////////////////////////
-// Utilities
-// ////////////////////////////////////////////////////////////////////////////////////////////
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
 
-Expected<String> Booru::GetSQLConditionForTag(StringView const& _Tag)
-{
-    if (_Tag[0] == '-')
+    Vector<std::pair<DB::INTEGER, DB::INTEGER>> redirects;
     {
-        return GetSQLConditionForTag(_Tag.substr(1))
-            .Then([](auto c) { return Expected("NOT "s + c); });
+        auto lock = LockCaches();
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(graph, GetTagGraph());
+        redirects = graph.Value->GetIndirectRedirects();
     }
+    if (redirects.empty()) return 0;
 
-    String lowerTag = Strings::ToLower(_Tag);
-
-    // ratings
+    DB::TransactionGuard guard(db.Value);
+    if (!guard.GetIsValid()) return ResultCode::InvalidState;
 
-    if (lowerTag.starts_with("rating:g"))
+    for (auto const& [tagId, targetId] : redirects)
     {
-        // general
-        return "( Posts.Rating == 1 ) "s;
+        CHECK_RETURN_RESULT_ON_ERROR(
+            updateQuery.Prepare(db.Value)
+                .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "RedirectId",
+                      targetId)
+                .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "Id", tagId)
+                .Then(&DB::IStmt::StepUpdate, true));
     }
-    if (lowerTag.starts_with("rating:s"))
-    {
-        // sensitive
-        return "( Posts.Rating == 2 ) "s;
+    CHECK_RETURN_RESULT_ON_ERROR(guard.Commit());
+
+    auto lock = LockCachesForChange();
+    for (auto const& [tagId, targetId] : redirects)
+        m_TagGraph->SetRedirect(tagId, targetId);
+
+    LOG_INFO("Flattened {} tag redirections", redirects.size());
+    return DB::INTEGER(redirects.size());
+}
+
+Expected<DB::INTEGER> Booru::MergeTags(DB::Entities::Tag const& _From,
+                                       DB::Entities::Tag const& _To,
+                                       size_t _ChunkSize)
+{
+    static constexpr auto unlinkSql = R"SQL(
+        DELETE FROM TagImplications WHERE TagId = $From OR ImpliedTagId = $From
+    )SQL";
+
+    static constexpr auto redirectSql = R"SQL(
+        UPDATE Tags SET RedirectId = $To WHERE RedirectId = $From
+    )SQL";
+
+    static constexpr auto deleteSql = R"SQL(
+        DELETE FROM PostTags
+        WHERE Id IN (
+            SELECT merged.Id FROM PostTags AS merged
+            JOIN PostTags AS target
+              ON target.PostId = merged.PostId AND target.TagId = $To
+            WHERE merged.TagId = $From
+            LIMIT $Limit )
+        RETURNING Id, PostId, TagId
+    )SQL";
+
+    // conflicting rows are skipped and dropped by the next chunk's delete
+    static constexpr auto moveSql = R"SQL(
+        UPDATE OR IGNORE PostTags SET TagId = $To
+        WHERE Id IN (
+            SELECT Id FROM PostTags WHERE TagId = $From LIMIT $Limit )
+        RETURNING Id, PostId, TagId
+    )SQL";
+
+    if (_From.Id == -1 || _To.Id == -1 || _ChunkSize == 0)
+        return ResultCode::InvalidArgument;
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+
+    // merge into the final tag so posts never end up on a redirected one
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(toId, ResolveTagRedirect(_To.Id));
+    if (toId.Value == _From.Id) return ResultCode::RecursionExceeded;
+
+    // redirect first, so tags added during the merge already go to the target
+    {
+        DB::TransactionGuard transactionGuard(db.Value);
+        if (!transactionGuard.GetIsValid()) return ResultCode::InvalidState;
+
+        auto prepare = [&](StringView const& _SQL)
+        {
+            return db.Value->PrepareStatement(_SQL)
+                .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "From", _From.Id)
+                .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "To", toId.Value);
+        };
+
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(
+            outgoing, GetAll<DB::Entities::TagImplication>("TagId", _From.Id));
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(
+            incoming,
+            GetAll<DB::Entities::TagImplication>("ImpliedTagId", _From.Id));
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(
+            targetOutgoing,
+            GetAll<DB::Entities::TagImplication>("TagId", toId.Value));
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(
+            targetIncoming,
+            GetAll<DB::Entities::TagImplication>("ImpliedTagId", toId.Value));
+
+        std::set<std::pair<DB::INTEGER, DB::INTEGER>> existing;
+        for (auto const* implications : {&targetOutgoing, &targetIncoming})
+            for (auto const& implication : implications->Value)
+                existing.emplace(implication.TagId, implication.ImpliedTagId);
+
+        CHECK_RETURN_RESULT_ON_ERROR(
+            prepare(unlinkSql).Then(&DB::IStmt::StepUpdate, false));
+        CHECK_RETURN_RESULT_ON_ERROR(
+            prepare(redirectSql).Then(&DB::IStmt::StepUpdate, false));
+
+        DB::Entities::Tag from = _From;
+        from.RedirectId        = toId.Value;
+        CHECK_RETURN_RESULT_ON_ERROR(Update(from));
+
+        // the graph is rebuilt without the merged tag's implications, so each
+        // moved one is checked against the ones moved before it
+        {
+            auto lock = LockCachesForChange();
+            m_TagGraph->Invalidate();
+        }
+        for (auto const* implications : {&outgoing, &incoming})
+        {
+            for (auto implication : implications->Value)
+            {
+                if (implication.TagId == _From.Id)
+                    implication.TagId = toId.Value;
+                if (implication.ImpliedTagId == _From.Id)
+                    implication.ImpliedTagId = toId.Value;
+
+                // implications between the two tags are dropped, and so are
+                // the ones the target already has
+                if (implication.TagId == implication.ImpliedTagId) continue;
+                if (!existing.emplace(implication.TagId,
+                                      implication.ImpliedTagId)
+                         .second)
+                    continue;
+
+                implication.Id = -1;
+                auto created   = Create(implication);
+                if (created.Code == ResultCode::RecursionExceeded)
+                {
+                    LOG_WARNING("Dropped implication of tag {} by tag {} "
+                                "while merging tag {}",
+                                implication.ImpliedTagId, implication.TagId,
+                                _From.Id);
+                    continue;
+                }
+                CHECK_RETURN_RESULT_ON_ERROR(created);
+            }
+        }
+
+        // posts are only moved once the redirect is in place
+        CHECK_RETURN_RESULT_ON_ERROR(transactionGuard.Commit());
     }
-    if (lowerTag.starts_with("rating:q"))
+
+    // tags redirected to the merged one were changed directly
     {
-        // questionable + unrated
-        return "( Posts.Rating IN ( 0, 3 ) "s;
+        auto lock = LockCachesForChange();
+        m_TagGraph->Invalidate();
     }
-    if (lowerTag.starts_with("rating:e"))
+
+    DB::INTEGER moved = 0;
+    while (true)
     {
-        // explicit
-        return "( Posts.Rating == 4 ) "s;
+        DB::TransactionGuard transactionGuard(db.Value);
+        if (!transactionGuard.GetIsValid()) return ResultCode::InvalidState;
+
+        auto prepare = [&](StringView const& _SQL)
+        {
+            return db.Value->PrepareStatement(_SQL)
+                .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "From", _From.Id)
+                .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "To", toId.Value)
+                .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "Limit",
+                      DB::INTEGER(_ChunkSize));
+        };
+
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(
+            deleted, prepare(deleteSql).Then(
+                         &DB::IStmt::ExecuteList<DB::Entities::PostTag>));
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(
+            updated, prepare(moveSql).Then(
+                         &DB::IStmt::ExecuteList<DB::Entities::PostTag>));
+
+        CHECK_RETURN_RESULT_ON_ERROR(transactionGuard.Commit());
+
+        for (auto const& postTag : deleted.Value) OnDeleted(postTag);
+        for (auto const& postTag : updated.Value)
+        {
+            DB::Entities::PostTag previous = postTag;
+            previous.TagId                 = _From.Id;
+            OnDeleted(previous);
+            OnCreated(postTag);
+        }
+
+        moved += DB::INTEGER(updated.Value.size());
+        if (deleted.Value.empty() && updated.Value.empty()) break;
     }
-    if (lowerTag.starts_with("rating:u"))
+
+    LOG_INFO("Merged tag {} into tag {}, moved {} posts", _From.Id,
+             toId.Value, moved);
+    return moved;
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// TagImplications
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+ExpectedVector<DB::Entities::TagImplication> Booru::GetTagImplications()
+{
+    return GetAll<DB::Entities::TagImplication>();
+}
+
+ExpectedVector<DB::Entities::TagImplication>
+Booru::GetTagImplicationsForTag(DB::Entities::Tag const& _Tag)
+{
+    return GetAll<DB::Entities::TagImplication>("TagId", _Tag.Id);
+}
+
+ExpectedVector<ResultCode> Booru::CreateTagImplications(
+    Span<DB::Entities::TagImplication> _Implications)
+{
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+    DB::TransactionGuard guard(db.Value);
+    if (!guard.GetIsValid()) return ResultCode::InvalidState;
+
+    Vector<ResultCode> results;
+    for (auto& implication : _Implications)
+        results.push_back(Create(implication).Code);
+
+    CHECK_RETURN_RESULT_ON_ERROR(guard.Commit());
+    return results;
+}
+
+/// @brief Reject redirections that would lead back to the tag.
+ResultCode Booru::CheckChange(DB::Entities::Tag const& _Tag)
+{
+    if (!_Tag.RedirectId) return ResultCode::OK;
+    if (*_Tag.RedirectId == _Tag.Id) return ResultCode::RecursionExceeded;
+
+    auto lock = LockCaches();
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(graph, GetTagGraph());
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        targetId, graph.Value->ResolveRedirect(*_Tag.RedirectId));
+    if (targetId.Value == _Tag.Id)
     {
-        // unrated
-        return "( Posts.Rating == 0 ) "s;
+        LOG_WARNING("Redirection of tag {} to tag {} would form a cycle",
+                    _Tag.Id, *_Tag.RedirectId);
+        return ResultCode::RecursionExceeded;
     }
+    return ResultCode::OK;
+}
 
-    // match actual tags
+/// @brief Reject implications that would make a tag imply itself.
+ResultCode
+Booru::CheckChange(DB::Entities::TagImplication const& _Implication)
+{
+    if (_Implication.Flags & DB::Entities::TagImplication::FLAG_REMOVE_TAG)
+        return ResultCode::OK;
 
+    auto lock = LockCaches();
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(graph, GetTagGraph());
     CHECK_VAR_RETURN_RESULT_ON_ERROR(
-        ids, MatchTags(_Tag).Then(DB::Entities::CollectIds<DB::Entities::Tag>));
+        cycle, graph.Value->WouldCreateCycle(_Implication.TagId,
+                                             _Implication.ImpliedTagId));
+    if (cycle.Value)
+    {
+        LOG_WARNING("Implication of tag {} by tag {} would form a cycle",
+                    _Implication.ImpliedTagId, _Implication.TagId);
+        return ResultCode::RecursionExceeded;
+    }
+    return ResultCode::OK;
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// TagTypes
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Get all tag types.
+ExpectedVector<DB::Entities::TagType> Booru::GetTagTypes()
+{
+    return GetAll<DB::Entities::TagType>();
+}
+
+/// @brief Get tag type by Id.
+Expected<DB::Entities::TagType> Booru::GetTagType(DB::INTEGER _Id)
+{
+    return Get<DB::Entities::TagType>("Id", _Id);
+}
+
+/// @brief Get tag type by name.
+Expected<DB::Entities::TagType> Booru::GetTagType(DB::TEXT const& _Name)
+{
+    return Get<DB::Entities::TagType>("Name", _Name);
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Utilities
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+Expected<String> Booru::GetSQLConditionForTag(StringView const& _Tag)
+{
+    return ResolveSearchTerm(_Tag).Then(
+        [](auto _Term) { return Expected(Search::CompileCondition(_Term)); });
+}
+
+Expected<DB::INTEGER>
+Booru::EstimatePostCount(Vector<DB::INTEGER> const& _TagIds)
+{
+    if (_TagIds.empty()) return 0;
+
+    {
+        auto lock = LockCaches();
+        if (auto index = GetSearchIndex())
+            return index->CountPostTags(_TagIds);
+    }
+
+    static auto countQuery =
+        DB::Query::Select(DB::Entities::Tag::Table)
+            .Column("COALESCE(SUM(PostCount), 0)")
+            .Where(DB::Query::Where::In("Id", DB::Query::SelectIds("TagIds")));
+
+    return GetDatabase()
+        .Then(&DB::Query::Select::Prepare, countQuery)
+        .Then(&DB::IStmt::BindIds, "TagIds", Span<DB::INTEGER const>(_TagIds))
+        .Then(&DB::IStmt::ExecuteScalar<DB::INTEGER>, true);
+}
+
+Expected<DB::INTEGER> Booru::ReconcileTagPostCounts()
+{
+    static constexpr auto sql = R"SQL(
+        UPDATE Tags SET PostCount = (
+            SELECT COUNT(*) FROM PostTags WHERE PostTags.TagId = Tags.Id
+        )
+        WHERE PostCount != (
+            SELECT COUNT(*) FROM PostTags WHERE PostTags.TagId = Tags.Id
+        )
+        RETURNING Id
+    )SQL";
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+    DB::TransactionGuard guard(db.Value);
+    if (!guard.GetIsValid()) return ResultCode::InvalidState;
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(stmt, db.Value->PrepareStatement(sql));
+
+    DB::INTEGER corrected = 0;
+    ResultCode result     = stmt.Value->StepQuery();
+    for (; result == ResultCode::DatabaseRow; result = stmt.Value->StepQuery())
+        corrected++;
+    CHECK_RETURN_RESULT_ON_ERROR(result);
+
+    auto now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    CHECK_RETURN_RESULT_ON_ERROR(
+        SetConfig("tags.postcount.reconciled", ToString(now.count())));
+    CHECK_RETURN_RESULT_ON_ERROR(guard.Commit());
+
+    if (corrected > 0)
+    {
+        LOG_WARNING("Corrected post count of {} tags", corrected);
+        auto lock = LockCachesForChange();
+        if (m_TagDictionary) m_TagDictionary->InvalidateCounts();
+    }
+    return corrected;
+}
+
+Expected<Search::Term> Booru::ResolveSearchTerm(StringView const& _Token)
+{
+    Search::Term term;
+
+    StringView token = _Token;
+    if (token.starts_with('-'))
+    {
+        term.Negated = true;
+        token.remove_prefix(1);
+    }
+
+    // metatags on post columns
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(metatag, Search::ParseMetatag(token));
+    if (metatag.Value)
+    {
+        metatag.Value->Negated = term.Negated;
+        return *metatag.Value;
+    }
+
+    // post types are looked up by name, ignoring case like the search cache
+    if (Strings::ToLower(token).starts_with("type:"))
+    {
+        static auto postTypeQuery =
+            DB::Query::Select(DB::Entities::PostType::Table)
+                .Column("Id")
+                .Where("Name = $Name COLLATE NOCASE")
+                .OrderBy("Id");
+
+        auto postType =
+            GetDatabase()
+                .Then(&DB::Query::Select::Prepare, postTypeQuery)
+                .Then(DB::IStmt::BindValueFn<DB::TEXT>(), "Name",
+                      DB::TEXT(token.substr(5)))
+                .Then(&DB::IStmt::ExecuteScalar<DB::INTEGER>, true);
+
+        term.Kind   = Search::Term::Type::Range;
+        term.Column = "PostTypeId";
+
+        // an unknown type matches nothing, like an unknown tag
+        if (postType.Code == ResultCode::NotFound)
+        {
+            term.Min = 0;
+            term.Max = -1;
+            return term;
+        }
+        CHECK_RETURN_RESULT_ON_ERROR(postType);
+
+        term.Min = postType.Value;
+        term.Max = postType.Value;
+        return term;
+    }
+
+    // match actual tags, their post counts are the estimate
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(tags, MatchTags(token));
+    for (auto const& tag : tags.Value)
+    {
+        term.Ids.push_back(tag.Id);
+        term.Estimate += tag.PostCount;
+    }
+    return term;
+}
+
+ExpectedVector<Search::Term>
+Booru::ResolveSearchTerms(StringView const& _QueryString)
+{
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(query, Search::ParseQuery(_QueryString));
+
+    Vector<Search::Term> terms;
+    CHECK_RETURN_RESULT_ON_ERROR(ResolveQueryNode(query.Value, terms));
+    return terms;
+}
+
+ResultCode Booru::ResolveQueryNode(Search::QueryNode const& _Node,
+                                   Vector<Search::Term>& _Terms)
+{
+    using Type = Search::QueryNode::Type;
+
+    if (_Node.Kind == Type::Token)
+    {
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(
+            term, ResolveSearchTerm(_Node.Negated ? "-" + _Node.Value
+                                                  : _Node.Value));
+        _Terms.push_back(std::move(term.Value));
+        return ResultCode::OK;
+    }
+
+    // a plain group just adds its terms
+    if (_Node.Kind == Type::And && !_Node.Negated)
+    {
+        for (auto const& child : _Node.Children)
+            CHECK_RETURN_RESULT_ON_ERROR(ResolveQueryNode(child, _Terms));
+        return ResultCode::OK;
+    }
+
+    Search::Term term;
+    term.Kind    = Search::Term::Type::Any;
+    term.Negated = _Node.Negated;
+    if (_Node.Kind == Type::And)
+    {
+        auto& alternative = term.Alternatives.emplace_back();
+        for (auto const& child : _Node.Children)
+            CHECK_RETURN_RESULT_ON_ERROR(ResolveQueryNode(child, alternative));
+    }
+    else
+    {
+        for (auto const& child : _Node.Children)
+        {
+            auto& alternative = term.Alternatives.emplace_back();
+            CHECK_RETURN_RESULT_ON_ERROR(ResolveQueryNode(child, alternative));
+        }
+    }
+
+    _Terms.push_back(std::move(term));
+    return ResultCode::OK;
+}
+
+Optional<Vector<DB::INTEGER>>
+Booru::EvaluateSearchIndex(Vector<Search::Term>& _Terms)
+{
+    auto lock  = LockCaches();
+    auto index = GetSearchIndex();
+    if (!index) return std::nullopt;
+
+    // tags and ratings are evaluated in memory, the rest stays for the database
+    auto remaining = std::ranges::stable_partition(_Terms,
+                                                   &Search::Index::CanEvaluate);
+    if (std::begin(remaining) == std::begin(_Terms)) return std::nullopt;
+
+    Vector<Search::Term> evaluated(
+        std::make_move_iterator(std::begin(_Terms)),
+        std::make_move_iterator(std::begin(remaining)));
+    _Terms.erase(std::begin(_Terms), std::begin(remaining));
+
+    return index->Evaluate(evaluated);
+}
+
+DB::ExpectedStmt Booru::PrepareFindPosts(Vector<Search::Term> _Terms)
+{
+    // evaluated in memory, the database only reads the matching rows
+    if (auto postIds = EvaluateSearchIndex(_Terms))
+    {
+        auto query = Search::CompilePostIdQuery(*postIds, _Terms);
+        return GetDatabase().Then(&DB::Query::Select::Prepare, query);
+    }
+
+    auto query = Search::CompilePostQuery(std::move(_Terms));
+    return GetDatabase().Then(&DB::Query::Select::Prepare, query);
+}
+
+DB::ExpectedStmt Booru::PreparePostsById(Vector<DB::INTEGER> const& _PostIds)
+{
+    auto query = Search::CompilePostIdQuery(_PostIds);
+    return GetDatabase().Then(&DB::Query::Select::Prepare, query);
+}
+
+DB::ExpectedStmt Booru::PreparePostsForTag(DB::INTEGER _TagId)
+{
+    static auto postIdSubQuery =
+        DB::Query::Select(DB::Entities::PostTag::Table)
+            .Column("PostId")
+            .Where(DB::Query::Where::Equal("TagId", "$TagId "));
+
+    static auto postQuery =
+        DB::Query::Select(DB::Entities::Post::Table)
+            .Where(DB::Query::Where::In("Posts.Id", postIdSubQuery));
+
+    return GetDatabase()
+        .Then(&DB::Query::Select::Prepare, postQuery)
+        .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "TagId", _TagId);
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Search index
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+ResultCode Booru::SetSearchIndexEnabled(bool _Enabled)
+{
+    m_SearchIndexEnabled = _Enabled;
+    {
+        auto lock     = LockCachesForChange();
+        m_SearchIndex = nullptr;
+    }
+
+    if (!_Enabled || !m_DB) return ResultCode::OK;
+    return BuildSearchIndex();
+}
+
+ResultCode Booru::BuildSearchIndex()
+{
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+
+    auto index = MakeOwning<Search::Index>();
+    CHECK_RETURN_RESULT_ON_ERROR(index->Build(db.Value),
+                                 "Could not build search index.");
+
+    auto lock     = LockCachesForChange();
+    m_SearchIndex = std::move(index);
+    return ResultCode::OK;
+}
+
+Search::Index* Booru::GetSearchIndex() { return m_SearchIndex.get(); }
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Tag dictionary
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+ResultCode Booru::SetTagDictionaryEnabled(bool _Enabled)
+{
+    m_TagDictionaryEnabled = _Enabled;
+    {
+        auto lock       = LockCachesForChange();
+        m_TagDictionary = nullptr;
+    }
+
+    if (!_Enabled || !m_DB) return ResultCode::OK;
+    return BuildTagDictionary();
+}
+
+ResultCode Booru::BuildTagDictionary()
+{
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
+
+    auto dictionary = MakeOwning<Search::TagDictionary>();
+    CHECK_RETURN_RESULT_ON_ERROR(dictionary->Build(db.Value),
+                                 "Could not build tag dictionary.");
+
+    auto lock       = LockCachesForChange();
+    m_TagDictionary = std::move(dictionary);
+    return ResultCode::OK;
+}
+
+Search::TagDictionary* Booru::GetTagDictionary()
+{
+    return m_TagDictionary.get();
+}
+
+Expected<Tags::TagGraph*> Booru::GetTagGraph()
+{
+    if (!m_DB) return ResultCode::InvalidState;
+    return m_TagGraph.get();
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Cache locking
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+std::shared_lock<std::shared_mutex> Booru::LockCaches()
+{
+    std::shared_lock lock(m_CacheMutex);
+    if (!m_DB) return lock;
+
+    auto staleIndex = m_SearchIndex && !m_SearchIndex->IsValid(m_DB)
+                          ? m_SearchIndex.get()
+                          : nullptr;
+    auto staleDictionary =
+        m_TagDictionary && (!m_TagDictionary->IsValid(m_DB) ||
+                            !m_TagDictionary->HasValidCounts())
+            ? m_TagDictionary.get()
+            : nullptr;
+    auto staleGraph = m_TagGraph->IsValid(m_DB) ? nullptr : m_TagGraph.get();
+    if (!staleIndex && !staleDictionary && !staleGraph) return lock;
+
+    uint64_t version = m_CacheVersion;
+    bool uncommitted = HasUncommittedChanges();
+    lock.unlock();
+
+    // rebuilt without the lock, reading may have to wait for a writer that is
+    // about to change the caches
+    auto rebuild = [this]<class TCache>(TCache* _Stale,
+                                        StringView _Name) -> Owning<TCache>
+    {
+        if (!_Stale) return nullptr;
+
+        LOG_INFO("{} is stale, rebuilding...", _Name);
+        auto rebuilt = MakeOwning<TCache>();
+        if (!ResultIsError(rebuilt->Build(m_DB))) return rebuilt;
+
+        LOG_WARNING("{} could not be rebuilt.", _Name);
+        return nullptr;
+    };
+    auto index      = rebuild(staleIndex, "Search index");
+    auto dictionary = rebuild(staleDictionary, "Tag dictionary");
+    auto graph      = rebuild(staleGraph, "Tag graph");
+
+    {
+        std::unique_lock exclusive(m_CacheMutex);
+
+        // changes made meanwhile or not committed yet may be missing from
+        // what was read, so the rebuilt caches are used but rebuilt again next
+        // time
+        bool missed = uncommitted || m_CacheVersion != version;
+        m_CacheVersion++;
+
+        // may have read changes of a transaction that is rolled back later
+        m_DB->NotifyCacheChange();
+
+        auto replace = [missed](auto& _Cache, auto* _Stale, auto _Rebuilt)
+        {
+            // unless it was disabled or replaced meanwhile, a cache that
+            // failed to rebuild is disabled
+            if (!_Stale || _Cache.get() != _Stale) return;
+            if (_Rebuilt && missed) _Rebuilt->Invalidate();
+            _Cache = std::move(_Rebuilt);
+        };
+        replace(m_SearchIndex, staleIndex, std::move(index));
+        replace(m_TagDictionary, staleDictionary, std::move(dictionary));
+
+        // the graph can't be disabled, it stays stale instead
+        if (graph) replace(m_TagGraph, staleGraph, std::move(graph));
+    }
+
+    lock.lock();
+    return lock;
+}
+
+std::unique_lock<std::shared_mutex> Booru::LockCachesForChange()
+{
+    std::unique_lock lock(m_CacheMutex);
+    m_CacheVersion++;
+    if (m_DB) m_DB->NotifyCacheChange();
+    if (m_DB && m_DB->IsInTransaction())
+        m_UncommittedTransaction = m_DB->GetTransactionCount();
+    return lock;
+}
 
-    return "( "
-           "   ( "
-           "       SELECT  COUNT(*) "
-           "       FROM    PostTags "
-           "       WHERE   PostTags.PostId =   Posts.Id "
-           "       AND     PostTags.TagId  IN  (" +
-           Strings::JoinXForm(ids.Value, ", ") +
-           ") "
-           "   ) > 0 "
-           ") ";
+bool Booru::HasUncommittedChanges() const
+{
+    // the thread in the transaction reads its own changes
+    return m_UncommittedTransaction && m_DB && !m_DB->IsInTransaction() &&
+           m_DB->GetTransactionCount() == *m_UncommittedTransaction;
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Write queue
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+std::future<ResultCode>
+Booru::SubmitWrite(std::function<ResultCode(Booru&)> _Write)
+{
+    std::lock_guard lock(m_WriteQueueMutex);
+    if (!m_DB)
+    {
+        std::promise<ResultCode> result;
+        result.set_value(ResultCode::InvalidState);
+        return result.get_future();
+    }
+
+    if (!m_WriteQueue)
+    {
+        m_WriteQueue = MakeOwning<DB::WriteQueue>(m_DB, m_WriteBatchSize,
+                                                  m_WriteDelay);
+    }
+    return m_WriteQueue->Submit([this, write = std::move(_Write)]
+                                { return write(*this); });
+}
+
+void Booru::SetWriteBatchLimits(size_t _MaxSize,
+                                std::chrono::microseconds _MaxDelay)
+{
+    std::lock_guard lock(m_WriteQueueMutex);
+    m_WriteBatchSize = _MaxSize;
+    m_WriteDelay     = _MaxDelay;
+    if (m_WriteQueue) m_WriteQueue->SetLimits(_MaxSize, _MaxDelay);
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Search cache
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+void Booru::SetSearchCacheCapacity(size_t _Capacity)
+{
+    m_SearchCache->SetCapacity(_Capacity);
+}
+
+Search::ResultCacheStats Booru::GetSearchCacheStats() const
+{
+    return m_SearchCache->GetStats();
+}
+
+Shared<Vector<DB::INTEGER> const> Booru::FindCachedSearch(String const& _Key)
+{
+    if (!m_DB) return nullptr;
+
+    m_SearchCache->Validate(m_DB->GetRollbackCount());
+    return m_SearchCache->Find(_Key);
+}
+
+Optional<uint64_t> Booru::GetSearchGeneration()
+{
+    // results read from the database would miss those changes and keep
+    // missing them once they are committed
+    std::shared_lock lock(m_CacheMutex);
+    if (HasUncommittedChanges()) return std::nullopt;
+    return m_SearchCache->GetGeneration();
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Change notifications
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+void Booru::OnCreated(DB::Entities::Post const& _Post)
+{
+    auto lock = LockCachesForChange();
+    if (m_SearchIndex) m_SearchIndex->AddPost(_Post.Id, _Post.Rating);
+    m_SearchCache->OnPostCreated();
+}
+
+void Booru::OnCreated(DB::Entities::PostTag const& _PostTag)
+{
+    auto lock = LockCachesForChange();
+    if (m_SearchIndex)
+        m_SearchIndex->AddPostTag(_PostTag.PostId, _PostTag.TagId);
+    if (m_TagDictionary) m_TagDictionary->AddPostCount(_PostTag.TagId, 1);
+    m_SearchCache->OnPostTagsChanged(_PostTag.TagId);
+}
+
+void Booru::OnCreated(DB::Entities::Tag const& _Tag)
+{
+    auto lock = LockCachesForChange();
+    if (_Tag.RedirectId) m_TagGraph->SetRedirect(_Tag.Id, _Tag.RedirectId);
+    if (m_TagDictionary)
+        m_TagDictionary->AddTag(_Tag.Id, _Tag.Name, _Tag.PostCount);
+
+    // may match wildcards of cached searches
+    m_SearchCache->OnTagsChanged();
+}
+
+void Booru::OnUpdated(DB::Entities::Post const& _Post)
+{
+    auto lock = LockCachesForChange();
+    if (m_SearchIndex) m_SearchIndex->UpdatePost(_Post.Id, _Post.Rating);
+    m_SearchCache->OnPostUpdated();
 }
 
+void Booru::OnUpdated(DB::Entities::PostTag const&)
+{
+    auto lock = LockCachesForChange();
+    // previous post and tag are unknown
+    if (m_SearchIndex) m_SearchIndex->Invalidate();
+    if (m_TagDictionary) m_TagDictionary->InvalidateCounts();
+    m_SearchCache->Clear();
+}
+
+void Booru::OnUpdated(DB::Entities::Tag const& _Tag)
+{
+    auto lock = LockCachesForChange();
+    m_TagGraph->SetRedirect(_Tag.Id, _Tag.RedirectId);
+    if (m_TagDictionary) m_TagDictionary->RenameTag(_Tag.Id, _Tag.Name);
+
+    // renamed tags may match other searches
+    m_SearchCache->OnTagsChanged();
+}
+
+void Booru::OnDeleted(DB::Entities::Post const& _Post)
+{
+    auto lock = LockCachesForChange();
+    // its post tags were already reported by DeletePost()
+    if (m_SearchIndex) m_SearchIndex->RemovePost(_Post.Id);
+    m_SearchCache->OnPostDeleted(_Post.Id);
+}
+
+void Booru::OnDeleted(DB::Entities::PostTag const& _PostTag)
+{
+    auto lock = LockCachesForChange();
+    // deleting only needs the id, the rest may not have been loaded
+    if (_PostTag.PostId == -1 || _PostTag.TagId == -1)
+    {
+        if (m_SearchIndex) m_SearchIndex->Invalidate();
+        if (m_TagDictionary) m_TagDictionary->InvalidateCounts();
+        m_SearchCache->Clear();
+        return;
+    }
+
+    if (m_SearchIndex)
+        m_SearchIndex->RemovePostTag(_PostTag.PostId, _PostTag.TagId);
+    if (m_TagDictionary) m_TagDictionary->AddPostCount(_PostTag.TagId, -1);
+    m_SearchCache->OnPostTagsChanged(_PostTag.TagId);
+}
+
+void Booru::OnDeleted(DB::Entities::Tag const& _Tag)
+{
+    auto lock = LockCachesForChange();
+    // implications of and by the tag are deleted along with it
+    m_TagGraph->Invalidate();
+    if (m_SearchIndex) m_SearchIndex->RemoveTag(_Tag.Id);
+    if (m_TagDictionary) m_TagDictionary->RemoveTag(_Tag.Id);
+    m_SearchCache->OnPostTagsChanged(_Tag.Id);
+}
+
+void Booru::OnCreated(DB::Entities::TagImplication const& _Implication)
+{
+    auto lock = LockCachesForChange();
+    m_TagGraph->AddImplication(
+        _Implication.TagId, _Implication.ImpliedTagId,
+        _Implication.Flags & DB::Entities::TagImplication::FLAG_REMOVE_TAG);
+}
+
+void Booru::OnUpdated(DB::Entities::TagImplication const&)
+{
+    auto lock = LockCachesForChange();
+    // previous tags are unknown
+    m_TagGraph->Invalidate();
+}
+
+void Booru::OnDeleted(DB::Entities::TagImplication const&)
+{
+    auto lock = LockCachesForChange();
+    m_TagGraph->Invalidate();
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Schema
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
 ResultCode Booru::CreateTables()
 {
     CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
@@ -567,11 +1898,23 @@ ResultCode Booru::CreateTables()
     DB::TransactionGuard guard(db.Value);
     for (auto& sql : sqlCommands)
         CHECK_RETURN_RESULT_ON_ERROR(db.Value->ExecuteSQL(sql));
-    guard.Commit();
+    CHECK_RETURN_RESULT_ON_ERROR(guard.Commit());
 
     return ResultCode::CreatedOK;
 }
 
+Expected<DB::INTEGER>
+Booru::ReconcileTagPostCountsIfDue(std::chrono::seconds _Interval)
+{
+    auto now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    auto last = GetConfigInt64("tags.postcount.reconciled");
+    if (last && now.count() - last.Value < _Interval.count()) return 0;
+
+    LOG_INFO("Reconciling tag post counts...");
+    return ReconcileTagPostCounts();
+}
+
 ResultCode Booru::UpdateTables(int64_t _Version)
 {
     CHECK_VAR_RETURN_RESULT_ON_ERROR(db, GetDatabase());
@@ -580,7 +1923,7 @@ ResultCode Booru::UpdateTables(int64_t _Version)
     DB::TransactionGuard guard(db.Value);
     CHECK_RETURN_RESULT_ON_ERROR(
         db.Value->ExecuteSQL(SQLGetUpdateSchema(_Version)));
-    guard.Commit();
+    CHECK_RETURN_RESULT_ON_ERROR(guard.Commit());
 
     return ResultCode::OK;
 }
@@ -2,7 +2,7 @@
 
 namespace Booru
 {
-int64_t SQLGetSchemaVersion() { return 1ll; }
+int64_t SQLGetSchemaVersion() { return 5ll; }
 
 StringView SQLGetBaseSchema()
 {
@@ -203,6 +203,65 @@ StringView SQLGetUpdateSchema(int64_t _Version)
         return R"SQL(
                 UPDATE CONFIG SET Value = 1 WHERE Name == "db.version";
             )SQL"sv;
+
+    case 1:
+        return R"SQL(
+                -- tag searches look up posts by tag
+                CREATE INDEX IF NOT EXISTS I_PostTags_TagId ON PostTags(TagId, PostId);
+
+                UPDATE CONFIG SET Value = 2 WHERE Name == "db.version";
+            )SQL"sv;
+
+    case 2:
+        return R"SQL(
+                -- pages of search results are ordered by these, ties by Id
+                CREATE INDEX IF NOT EXISTS I_Posts_AddedTime ON Posts(AddedTime);
+                CREATE INDEX IF NOT EXISTS I_Posts_Score ON Posts(Score);
+
+                UPDATE CONFIG SET Value = 3 WHERE Name == "db.version";
+            )SQL"sv;
+
+    case 3:
+        return R"SQL(
+                -- number of posts per tag, kept up to date by triggers so
+                -- cascading deletes are counted too
+                ALTER TABLE Tags ADD COLUMN PostCount INTEGER NOT NULL DEFAULT 0;
+
+                UPDATE Tags SET PostCount = (
+                    SELECT COUNT(*) FROM PostTags WHERE PostTags.TagId = Tags.Id
+                );
+
+                CREATE INDEX IF NOT EXISTS I_Tags_PostCount ON Tags(PostCount);
+
+                CREATE TRIGGER IF NOT EXISTS T_PostTags_Insert AFTER INSERT ON PostTags
+                BEGIN
+                    UPDATE Tags SET PostCount = PostCount + 1 WHERE Id = NEW.TagId;
+                END;
+
+                CREATE TRIGGER IF NOT EXISTS T_PostTags_Delete AFTER DELETE ON PostTags
+                BEGIN
+                    UPDATE Tags SET PostCount = PostCount - 1 WHERE Id = OLD.TagId;
+                END;
+
+                CREATE TRIGGER IF NOT EXISTS T_PostTags_Update AFTER UPDATE OF TagId ON PostTags
+                WHEN OLD.TagId != NEW.TagId
+                BEGIN
+                    UPDATE Tags SET PostCount = PostCount - 1 WHERE Id = OLD.TagId;
+                    UPDATE Tags SET PostCount = PostCount + 1 WHERE Id = NEW.TagId;
+                END;
+
+                UPDATE CONFIG SET Value = 4 WHERE Name == "db.version";
+            )SQL"sv;
+
+    case 4:
+        return R"SQL(
+                -- range metatags in searches, eg. "width:>=1920", "type:video"
+                CREATE INDEX IF NOT EXISTS I_Posts_Width ON Posts(Width);
+                CREATE INDEX IF NOT EXISTS I_Posts_Height ON Posts(Height);
+                CREATE INDEX IF NOT EXISTS I_Posts_PostTypeId ON Posts(PostTypeId);
+
+                UPDATE CONFIG SET Value = 5 WHERE Name == "db.version";
+            )SQL"sv;
     }
     return ""sv;
 }
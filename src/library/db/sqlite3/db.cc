@@ -2,20 +2,68 @@
 #include <booru/result.hh>
 
 #include "db.hh"
+#include "id_set.hh"
+#include "pool.hh"
 #include "result.hh"
 #include "stmt.hh"
 
 #include <sqlite3.h>
 
+#include <format>
+
 namespace Booru::DB::Sqlite3
 {
 
 constexpr auto LOGGER = "booru.db.sqlite3";
 
-ExpectedDB Backend::OpenDatabase(StringView const& _Path)
+ExpectedDB Backend::OpenDatabase(StringView const& _Path,
+                                 OpenOptions const& _Options)
+{
+    if (_Options.ReadConnections > 0) return Pool::Open(_Path, _Options);
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(backend,
+                                     OpenConnection(_Path, _Options, false));
+    return {backend.Value};
+}
+
+/// @brief Build a URI for a path, so query parameters can be added.
+static String MakeFileURI(StringView const& _Path)
 {
+    String uri = "file:";
+    for (char c : _Path)
+    {
+        if (c == '?' || c == '#' || c == '%')
+            uri += std::format("%{:02x}", int(c));
+        else uri += c;
+    }
+    return uri;
+}
+
+Expected<Shared<Backend>> Backend::OpenConnection(StringView const& _Path,
+                                                  OpenOptions const& _Options,
+                                                  bool _ReadOnly)
+{
+    bool readOnly = _ReadOnly || _Options.ReadOnly || _Options.Immutable;
+    int flags     = readOnly ? SQLITE_OPEN_READONLY
+                             : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+
+    // immutable can only be requested through a URI
+    String path   = String(_Path);
+    if (_Options.Immutable)
+    {
+        path   = MakeFileURI(_Path) + "?immutable=1";
+        flags |= SQLITE_OPEN_URI;
+    }
+
     sqlite3* db_handle = nullptr;
-    int sqlite_result  = sqlite3_open(String(_Path).c_str(), &db_handle);
+    int sqlite_result =
+        sqlite3_open_v2(path.c_str(), &db_handle, flags, nullptr);
+
+    if (sqlite_result == SQLITE_OK && _Options.BusyTimeout)
+    {
+        sqlite_result =
+            sqlite3_busy_timeout(db_handle, int(*_Options.BusyTimeout));
+    }
 
     if (sqlite_result == SQLITE_OK)
     {
@@ -24,17 +72,94 @@ ExpectedDB Backend::OpenDatabase(StringView const& _Path)
                                      nullptr, nullptr, nullptr);
     }
 
-    if (sqlite_result == SQLITE_OK) { return {MakeShared<Backend>(db_handle)}; }
-    return Sqlite3ToResult(sqlite_result);
+    if (sqlite_result == SQLITE_OK)
+    {
+        // bound id sets for IN conditions
+        sqlite_result = RegisterIdSetModule(db_handle);
+    }
+
+    if (sqlite_result != SQLITE_OK)
+    {
+        // a handle is returned even if opening failed
+        sqlite3_close(db_handle);
+        return Sqlite3ToResult(sqlite_result);
+    }
+
+    auto backend = MakeShared<Backend>(db_handle);
+    CHECK_RETURN_RESULT_ON_ERROR(backend->Configure(_Options, !readOnly));
+    return {backend};
+}
+
+ResultCode Backend::Configure(OpenOptions const& _Options, bool _Writable)
+{
+    static constexpr StringView journalModes[] = {
+        "delete", "truncate", "persist", "memory", "wal", "off"};
+    static constexpr StringView syncModes[]  = {"OFF", "NORMAL", "FULL",
+                                                "EXTRA"};
+    static constexpr StringView tempStores[] = {"DEFAULT", "FILE", "MEMORY"};
+
+    if (_Writable)
+    {
+        // has to come first, WAL mode fixes the page size
+        if (_Options.PageSize)
+        {
+            CHECK_RETURN_RESULT_ON_ERROR(ExecuteSQL(
+                std::format("PRAGMA page_size = {};", *_Options.PageSize)));
+        }
+
+        if (_Options.Journal)
+        {
+            auto requested = journalModes[size_t(*_Options.Journal)];
+            CHECK_VAR_RETURN_RESULT_ON_ERROR(
+                mode, QueryPragma("journal_mode = " + String(requested)));
+            if (mode.Value != requested)
+            {
+                LOG_WARNING("Requested journal mode {}, database uses {}",
+                            requested, mode.Value);
+            }
+        }
+    }
+
+    if (_Options.Synchronous)
+    {
+        CHECK_RETURN_RESULT_ON_ERROR(
+            ExecuteSQL(std::format("PRAGMA synchronous = {};",
+                                   syncModes[size_t(*_Options.Synchronous)])));
+    }
+
+    if (_Options.CacheSize)
+    {
+        CHECK_RETURN_RESULT_ON_ERROR(ExecuteSQL(
+            std::format("PRAGMA cache_size = {};", *_Options.CacheSize)));
+    }
+
+    if (_Options.MmapSize)
+    {
+        CHECK_RETURN_RESULT_ON_ERROR(ExecuteSQL(
+            std::format("PRAGMA mmap_size = {};", *_Options.MmapSize)));
+    }
+
+    if (_Options.Temp)
+    {
+        CHECK_RETURN_RESULT_ON_ERROR(
+            ExecuteSQL(std::format("PRAGMA temp_store = {};",
+                                   tempStores[size_t(*_Options.Temp)])));
+    }
+    return ResultCode::OK;
 }
 
 Backend::Backend(sqlite3* _Handle) : m_Handle{_Handle}
 {
     CHECK_ASSERT(m_Handle != nullptr);
+    m_StatementCacheStats.Capacity = DEFAULT_STATEMENT_CACHE_CAPACITY;
 }
 
 Backend::~Backend()
 {
+    // cached statements must be finalized before the handle can be closed
+    m_StatementCacheIndex.clear();
+    m_StatementCache.clear();
+
     if (m_Handle)
     {
         LOG_INFO("Closing database handle");
@@ -47,22 +172,96 @@ ExpectedStmt Backend::PrepareStatement(StringView const& _SQL)
 {
     CHECK_ASSERT(m_Handle != nullptr);
 
+    auto cached = m_StatementCacheIndex.find(_SQL);
+    if (cached != m_StatementCacheIndex.end())
+    {
+        auto& entry = *cached->second;
+
+        // only hand out statements that nobody else is currently using
+        if (entry.Stmt.use_count() == 1)
+        {
+            m_StatementCacheStats.Hits++;
+            m_StatementCache.splice(m_StatementCache.begin(), m_StatementCache,
+                                    cached->second);
+            return entry.Stmt->Reset();
+        }
+    }
+
+    m_StatementCacheStats.Misses++;
+
+    // statement is either cached but busy or not cached at all
+    bool cacheable = cached == m_StatementCacheIndex.end() &&
+                     m_StatementCacheStats.Capacity > 0;
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(stmt, CompileStatement(_SQL, cacheable));
+    if (cacheable)
+    {
+        m_StatementCache.push_front({String(_SQL), stmt.Value});
+        m_StatementCacheIndex.emplace(m_StatementCache.front().SQL,
+                                      m_StatementCache.begin());
+        TrimStatementCache();
+    }
+    return {stmt.Value};
+}
+
+Expected<Shared<DatabasePreparedStatementSqlite3>>
+Backend::CompileStatement(StringView const& _SQL, bool _Persistent)
+{
     sqlite3_stmt* stmt_handle = nullptr;
-    int sqlite_result = sqlite3_prepare_v3(m_Handle, String(_SQL).c_str(), -1,
-                                           0, &stmt_handle, nullptr);
-    if (sqlite_result == SQLITE_OK)
+    int sqlite_result         = sqlite3_prepare_v3(
+        m_Handle, _SQL.data(), static_cast<int>(_SQL.size()),
+        _Persistent ? SQLITE_PREPARE_PERSISTENT : 0, &stmt_handle, nullptr);
+    if (sqlite_result == SQLITE_OK && stmt_handle != nullptr)
     {
         LOG_DEBUG("Prepared statement: SQL was:\n{}", _SQL);
 
         return {MakeShared<DatabasePreparedStatementSqlite3>(stmt_handle)};
     }
 
+    // empty SQL compiles to a null statement
+    if (sqlite_result == SQLITE_OK) sqlite_result = SQLITE_MISUSE;
+
     LOG_ERROR(
         "Prepare statement failed with sqlite3 error code {}, SQL was:\n{}",
         sqlite_result, _SQL);
     return Sqlite3ToResult(sqlite_result);
 }
 
+void Backend::TrimStatementCache()
+{
+    while (m_StatementCache.size() > m_StatementCacheStats.Capacity)
+    {
+        // statements still in use are finalized once they are released
+        m_StatementCacheIndex.erase(m_StatementCache.back().SQL);
+        m_StatementCache.pop_back();
+        m_StatementCacheStats.Evictions++;
+    }
+    m_StatementCacheStats.Size = m_StatementCache.size();
+}
+
+void Backend::EvictStatement(StringView const& _SQL)
+{
+    auto cached = m_StatementCacheIndex.find(_SQL);
+    if (cached == m_StatementCacheIndex.end()) return;
+
+    // statements still in use are finalized once they are released
+    auto entry = cached->second;
+    m_StatementCacheIndex.erase(cached);
+    m_StatementCache.erase(entry);
+    m_StatementCacheStats.Size = m_StatementCache.size();
+}
+
+StatementCacheStats Backend::GetStatementCacheStats() const
+{
+    return m_StatementCacheStats;
+}
+
+void Backend::SetStatementCacheCapacity(size_t _Capacity)
+{
+    m_StatementCacheStats.Capacity = _Capacity;
+    TrimStatementCache();
+}
+
 ResultCode Backend::ExecuteSQL(StringView const& _SQL)
 {
     CHECK_ASSERT(m_Handle != nullptr);
@@ -85,53 +284,101 @@ ResultCode Backend::BeginTransaction()
     if (m_TransactionDepth == 0)
     {
         LOG_DEBUG("Start of transaction");
+        CHECK_RETURN_RESULT_ON_ERROR(ExecuteSQL("BEGIN TRANSACTION;"));
         m_TransactionDepth++;
-        m_TransactionFailed = false;
-        return ExecuteSQL("BEGIN TRANSACTION;");
+        m_TransactionCacheChanges.push_back(m_CacheChangeCount);
+        return ResultCode::OK;
     }
 
+    // nested transactions can be rolled back on their own
     LOG_DEBUG("Nesting transaction");
+    CHECK_RETURN_RESULT_ON_ERROR(
+        ExecuteSQL(std::format("SAVEPOINT Nested{};", m_TransactionDepth)));
     m_TransactionDepth++;
+    m_TransactionCacheChanges.push_back(m_CacheChangeCount);
     return ResultCode::OK;
 }
 
 ResultCode Backend::CommitTransaction()
 {
-    LOG_DEBUG("Decreasing transaction depth");
-    m_TransactionDepth--;
-    if (m_TransactionDepth == 0)
+    CHECK_ASSERT(m_TransactionDepth > 0);
+
+    if (m_TransactionDepth > 1)
     {
-        if (m_TransactionFailed)
-        {
-            LOG_DEBUG("End of transaction, rolling back...");
-            return ExecuteSQL("ROLLBACK;");
-        }
-        else
-        {
-            LOG_DEBUG("End of transaction, committing...");
-            return ExecuteSQL("COMMIT;");
-        }
+        // the changes now belong to the enclosing transaction
+        m_TransactionDepth--;
+        m_TransactionCacheChanges.pop_back();
+        LOG_DEBUG("Releasing nested transaction");
+        return ExecuteSQL(std::format("RELEASE Nested{};", m_TransactionDepth));
     }
-    return ResultCode::OK;
+
+    LOG_DEBUG("End of transaction, committing...");
+    auto result = ExecuteSQL("COMMIT;");
+    if (ResultIsError(result))
+    {
+        // don't leave the connection in the transaction
+        EndRolledBackTransaction();
+        CHECK(ExecuteSQL("ROLLBACK;"));
+    }
+    else
+    {
+        m_TransactionDepth--;
+        m_TransactionCacheChanges.pop_back();
+    }
+    m_TransactionCount++;
+    return result;
 }
 
 ResultCode Backend::RollbackTransaction()
 {
-    m_TransactionDepth--;
-    if (m_TransactionDepth == 0)
+    CHECK_ASSERT(m_TransactionDepth > 0);
+
+    EndRolledBackTransaction();
+    if (m_TransactionDepth > 0)
     {
-        LOG_INFO("Rolling back transaction");
-        return ExecuteSQL("ROLLBACK;");
+        LOG_INFO("Rolling back nested transaction");
+        return ExecuteSQL(
+            std::format("ROLLBACK TO Nested{0}; RELEASE Nested{0};",
+                        m_TransactionDepth));
     }
-    LOG_INFO("Decreased transaction depth. Transaction will be rolled back.");
-    m_TransactionFailed = true;
-    return ResultCode::OK;
+
+    LOG_INFO("Rolling back transaction");
+    auto result = ExecuteSQL("ROLLBACK;");
+    m_TransactionCount++;
+    return result;
+}
+
+void Backend::EndRolledBackTransaction()
+{
+    // also counts partial rollbacks, changes seen by caches may be undone
+    if (m_CacheChangeCount != m_TransactionCacheChanges.back())
+        m_RollbackCount++;
+    m_TransactionCacheChanges.pop_back();
+    m_TransactionDepth--;
+}
+
+uint64_t Backend::GetRollbackCount() const { return m_RollbackCount; }
+
+void Backend::NotifyCacheChange() { m_CacheChangeCount++; }
+
+uint64_t Backend::GetTransactionCount() const { return m_TransactionCount; }
+
+Expected<TEXT> Backend::QueryPragma(StringView const& _Statement)
+{
+    return PrepareStatement("PRAGMA " + String(_Statement) + ";")
+        .Then(&IStmt::ExecuteScalar<TEXT>, true);
 }
 
 Expected<INTEGER> Backend::GetLastRowId()
 {
-    return PrepareStatement("SELECT last_insert_rowid();")
-        .Then(&IStmt::ExecuteScalar<INTEGER>, true);
+    CHECK_ASSERT(m_Handle != nullptr);
+    return sqlite3_last_insert_rowid(m_Handle);
+}
+
+bool Backend::IsReadOnly() const
+{
+    CHECK_ASSERT(m_Handle != nullptr);
+    return sqlite3_db_readonly(m_Handle, "main") == 1;
 }
 
 } // namespace Booru::DB::Sqlite3
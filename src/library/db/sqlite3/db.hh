@@ -2,15 +2,29 @@
 
 #include <booru/db.hh>
 
+#include <atomic>
+#include <list>
+#include <unordered_map>
+
 struct sqlite3;
 
 namespace Booru::DB::Sqlite3
 {
 
+class DatabasePreparedStatementSqlite3;
+
 class Backend : public DB::IBackend
 {
   public:
-    static ExpectedDB OpenDatabase(StringView const& _Path);
+    static ExpectedDB OpenDatabase(StringView const& _Path,
+                                   OpenOptions const& _Options = {});
+
+    /// @brief Open a single connection and apply the options to it. Settings
+    /// of the database file itself are only applied by writable connections.
+    /// Read-only connections don't create the database.
+    static Expected<Shared<Backend>> OpenConnection(StringView const& _Path,
+                                                    OpenOptions const& _Options,
+                                                    bool _ReadOnly);
 
     explicit Backend(sqlite3* _Handle);
     virtual ~Backend() override;
@@ -22,14 +36,70 @@ class Backend : public DB::IBackend
     virtual ResultCode BeginTransaction() override;
     virtual ResultCode CommitTransaction() override;
     virtual ResultCode RollbackTransaction() override;
+    virtual uint64_t GetRollbackCount() const override;
+    virtual void NotifyCacheChange() override;
+    virtual uint64_t GetTransactionCount() const override;
 
     virtual Expected<DB::INTEGER> GetLastRowId() override;
+    virtual bool IsReadOnly() const override;
+
+    virtual StatementCacheStats GetStatementCacheStats() const override;
+    virtual void SetStatementCacheCapacity(size_t _Capacity) override;
+
+    /// @brief Run a pragma and get the value it returns, eg. the journal mode
+    /// that is actually in effect.
+    Expected<TEXT> QueryPragma(StringView const& _Statement);
+
+    /// @brief Drop a statement from the statement cache, eg. because it is
+    /// going to be prepared by another connection from now on.
+    void EvictStatement(StringView const& _SQL);
 
   private:
+    static constexpr size_t DEFAULT_STATEMENT_CACHE_CAPACITY = 64;
+
+    /// @brief A cached statement and the SQL it was compiled from.
+    struct CachedStatement
+    {
+        String SQL;
+        Shared<DatabasePreparedStatementSqlite3> Stmt;
+    };
+    using StatementCacheList = std::list<CachedStatement>;
+
     sqlite3* m_Handle        = nullptr;
 
-    int m_TransactionDepth   = 0;
-    bool m_TransactionFailed = false;
+    /// Number of open transactions, all but the outermost are savepoints.
+    int m_TransactionDepth                   = 0;
+    std::atomic<uint64_t> m_RollbackCount    = 0;
+    std::atomic<uint64_t> m_TransactionCount = 0;
+
+    /// Counts cache changes, with the count at the start of each open
+    /// transaction to tell if a rollback undoes any of them.
+    std::atomic<uint64_t> m_CacheChangeCount = 0;
+    Vector<uint64_t> m_TransactionCacheChanges;
+
+    /// @brief Leave the current transaction, counting it as rolled back if
+    /// caches were changed inside it.
+    void EndRolledBackTransaction();
+
+    /// Cached statements, most recently used first.
+    StatementCacheList m_StatementCache;
+
+    /// Lookup of cached statements by SQL. Keys point into m_StatementCache.
+    std::unordered_map<StringView, StatementCacheList::iterator>
+        m_StatementCacheIndex;
+
+    StatementCacheStats m_StatementCacheStats;
+
+    /// @brief Run the pragmas for the options.
+    ResultCode Configure(OpenOptions const& _Options, bool _Writable);
+
+    /// @brief Compile SQL into a new statement, bypassing the cache.
+    Expected<Shared<DatabasePreparedStatementSqlite3>>
+    CompileStatement(StringView const& _SQL, bool _Persistent);
+
+    /// @brief Drop least recently used statements until the cache fits its
+    /// capacity.
+    void TrimStatementCache();
 };
 
 } // namespace Booru::DB::Sqlite3
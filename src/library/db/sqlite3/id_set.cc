@@ -0,0 +1,144 @@
+#include "id_set.hh"
+
+#include <booru/db/types.hh>
+
+#include <sqlite3.h>
+
+namespace Booru::DB::Sqlite3
+{
+
+/// Columns of the virtual table. The hidden one is the function argument.
+enum IdSetColumns
+{
+    ID_SET_COLUMN_VALUE = 0,
+    ID_SET_COLUMN_IDS   = 1
+};
+
+/// @brief Position within the ids bound to an argument.
+struct IdSetCursor : sqlite3_vtab_cursor
+{
+    Vector<INTEGER> const* Ids = nullptr;
+    size_t Pos                 = 0;
+};
+
+static int IdSetConnect(sqlite3* _Handle, void*, int, char const* const*,
+                        sqlite3_vtab** _VTab, char**)
+{
+    int sqlite_result = sqlite3_declare_vtab(
+        _Handle, "CREATE TABLE x( value INTEGER, ids HIDDEN )");
+    if (sqlite_result != SQLITE_OK) return sqlite_result;
+
+    *_VTab = new sqlite3_vtab{};
+    return SQLITE_OK;
+}
+
+static int IdSetDisconnect(sqlite3_vtab* _VTab)
+{
+    delete _VTab;
+    return SQLITE_OK;
+}
+
+static int IdSetBestIndex(sqlite3_vtab*, sqlite3_index_info* _Info)
+{
+    for (int i = 0; i < _Info->nConstraint; i++)
+    {
+        auto const& constraint = _Info->aConstraint[i];
+        if (constraint.iColumn != ID_SET_COLUMN_IDS ||
+            constraint.op != SQLITE_INDEX_CONSTRAINT_EQ)
+            continue;
+
+        // make the planner look for a plan that provides the argument
+        if (!constraint.usable) return SQLITE_CONSTRAINT;
+
+        _Info->aConstraintUsage[i].argvIndex = 1;
+        _Info->aConstraintUsage[i].omit      = 1;
+        _Info->idxNum                        = 1;
+        _Info->estimatedCost                 = 100;
+        _Info->estimatedRows                 = 100;
+        return SQLITE_OK;
+    }
+
+    // no argument, no rows
+    _Info->idxNum        = 0;
+    _Info->estimatedCost = 1;
+    _Info->estimatedRows = 1;
+    return SQLITE_OK;
+}
+
+static int IdSetOpen(sqlite3_vtab*, sqlite3_vtab_cursor** _Cursor)
+{
+    *_Cursor = new IdSetCursor{};
+    return SQLITE_OK;
+}
+
+static int IdSetClose(sqlite3_vtab_cursor* _Cursor)
+{
+    delete static_cast<IdSetCursor*>(_Cursor);
+    return SQLITE_OK;
+}
+
+static int IdSetFilter(sqlite3_vtab_cursor* _Cursor, int _IdxNum, char const*,
+                       int _Argc, sqlite3_value** _Argv)
+{
+    auto cursor = static_cast<IdSetCursor*>(_Cursor);
+    cursor->Pos = 0;
+    cursor->Ids = nullptr;
+
+    // anything but a bound id set, eg. NULL, yields no rows
+    if (_IdxNum == 1 && _Argc == 1)
+    {
+        cursor->Ids = static_cast<Vector<INTEGER> const*>(
+            sqlite3_value_pointer(_Argv[0], ID_SET_POINTER_TYPE));
+    }
+    return SQLITE_OK;
+}
+
+static int IdSetNext(sqlite3_vtab_cursor* _Cursor)
+{
+    static_cast<IdSetCursor*>(_Cursor)->Pos++;
+    return SQLITE_OK;
+}
+
+static int IdSetEof(sqlite3_vtab_cursor* _Cursor)
+{
+    auto cursor = static_cast<IdSetCursor*>(_Cursor);
+    return !cursor->Ids || cursor->Pos >= cursor->Ids->size();
+}
+
+static int IdSetColumn(sqlite3_vtab_cursor* _Cursor,
+                       sqlite3_context* _Context, int _Column)
+{
+    auto cursor = static_cast<IdSetCursor*>(_Cursor);
+    if (_Column == ID_SET_COLUMN_VALUE)
+        sqlite3_result_int64(_Context, (*cursor->Ids)[cursor->Pos]);
+    return SQLITE_OK;
+}
+
+static int IdSetRowId(sqlite3_vtab_cursor* _Cursor, sqlite3_int64* _RowId)
+{
+    *_RowId = sqlite3_int64(static_cast<IdSetCursor*>(_Cursor)->Pos);
+    return SQLITE_OK;
+}
+
+int RegisterIdSetModule(sqlite3* _Handle)
+{
+    // no xCreate: only usable as a table-valued function
+    static sqlite3_module const module = {
+        .iVersion    = 0,
+        .xCreate     = nullptr,
+        .xConnect    = IdSetConnect,
+        .xBestIndex  = IdSetBestIndex,
+        .xDisconnect = IdSetDisconnect,
+        .xDestroy    = nullptr,
+        .xOpen       = IdSetOpen,
+        .xClose      = IdSetClose,
+        .xFilter     = IdSetFilter,
+        .xNext       = IdSetNext,
+        .xEof        = IdSetEof,
+        .xColumn     = IdSetColumn,
+        .xRowid      = IdSetRowId,
+    };
+    return sqlite3_create_module(_Handle, "IdSet", &module, nullptr);
+}
+
+} // namespace Booru::DB::Sqlite3
@@ -0,0 +1,19 @@
+#pragma once
+
+struct sqlite3;
+
+namespace Booru::DB::Sqlite3
+{
+
+/// @brief Pointer type of id sets bound with sqlite3_bind_pointer().
+static constexpr auto ID_SET_POINTER_TYPE = "booru-id-set";
+
+/// @brief Register the IdSet table-valued function with a connection.
+///
+/// "SELECT value FROM IdSet( $Ids )" yields the ids bound to $Ids with
+/// IStmt::BindIds(), so a set of any size is a single parameter and the
+/// statement text stays the same. Unbound parameters yield no rows.
+/// @return sqlite result code.
+int RegisterIdSetModule(sqlite3* _Handle);
+
+} // namespace Booru::DB::Sqlite3
@@ -0,0 +1,428 @@
+#include <booru/log.hh>
+#include <booru/result.hh>
+
+#include "pool.hh"
+#include "stmt.hh"
+
+namespace Booru::DB::Sqlite3
+{
+
+constexpr auto LOGGER = "booru.db.sqlite3.pool";
+
+/// @brief Statement of the writer that keeps it locked until released.
+///
+/// Calls are forwarded to the actual statement, but return this one, so the
+/// lock is held as long as a caller holds on to the result of any of them.
+class WriterStatement : public IStmt
+{
+    static constexpr auto LOGGER = "booru.db.sqlite3.pool";
+
+  public:
+    WriterStatement(std::unique_lock<std::recursive_mutex> _Lock,
+                    StmtPtr _Stmt)
+        : m_Lock{std::move(_Lock)}, m_Stmt{std::move(_Stmt)}
+    {
+    }
+
+    virtual ~WriterStatement() override
+    {
+        // a statement that wasn't stepped to the end keeps its implicit
+        // transaction open, finish it before another thread gets the writer
+        CHECK(m_Stmt->Reset());
+    }
+
+    ExpectedStmt BindValue(StringView const& _Name,
+                           ByteSpan const& _Blob) override
+    {
+        return Forward(m_Stmt->BindValue(_Name, _Blob));
+    }
+
+    ExpectedStmt BindValue(StringView const& _Name,
+                           FLOAT const& _Value) override
+    {
+        return Forward(m_Stmt->BindValue(_Name, _Value));
+    }
+
+    ExpectedStmt BindValue(StringView const& _Name,
+                           INTEGER const& _Value) override
+    {
+        return Forward(m_Stmt->BindValue(_Name, _Value));
+    }
+
+    ExpectedStmt BindValue(StringView const& _Name,
+                           TEXT const& _Value) override
+    {
+        return Forward(m_Stmt->BindValue(_Name, _Value));
+    }
+
+    ExpectedStmt BindNull(StringView const& _Name) override
+    {
+        return Forward(m_Stmt->BindNull(_Name));
+    }
+
+    ExpectedStmt BindValueRef(StringView const& _Name,
+                              ByteSpan const& _Blob) override
+    {
+        return Forward(m_Stmt->BindValueRef(_Name, _Blob));
+    }
+
+    ExpectedStmt BindValueRef(StringView const& _Name,
+                              StringView const& _Text) override
+    {
+        return Forward(m_Stmt->BindValueRef(_Name, _Text));
+    }
+
+    ExpectedStmt BindIds(StringView const& _Name,
+                         Span<INTEGER const> _Ids) override
+    {
+        return Forward(m_Stmt->BindIds(_Name, _Ids));
+    }
+
+    Expected<int> GetColumnIndex(StringView const& _Name) override
+    {
+        return m_Stmt->GetColumnIndex(_Name);
+    }
+
+    ExpectedStmt GetColumnValue(int _Index, ByteVector& _Value) override
+    {
+        return Forward(m_Stmt->GetColumnValue(_Index, _Value));
+    }
+
+    ExpectedStmt GetColumnValue(int _Index, FLOAT& _Value) override
+    {
+        return Forward(m_Stmt->GetColumnValue(_Index, _Value));
+    }
+
+    ExpectedStmt GetColumnValue(int _Index, INTEGER& _Value) override
+    {
+        return Forward(m_Stmt->GetColumnValue(_Index, _Value));
+    }
+
+    ExpectedStmt GetColumnValue(int _Index, TEXT& _Value) override
+    {
+        return Forward(m_Stmt->GetColumnValue(_Index, _Value));
+    }
+
+    ExpectedStmt GetColumnValue(int _Index, ByteSpan& _Value) override
+    {
+        return Forward(m_Stmt->GetColumnValue(_Index, _Value));
+    }
+
+    ExpectedStmt GetColumnValue(int _Index, StringView& _Value) override
+    {
+        return Forward(m_Stmt->GetColumnValue(_Index, _Value));
+    }
+
+    bool ColumnIsNull(int _Index) override
+    {
+        return m_Stmt->ColumnIsNull(_Index);
+    }
+
+    ExpectedStmt StepQuery(bool _NeedRow = false) override
+    {
+        return Forward(m_Stmt->StepQuery(_NeedRow));
+    }
+
+    ExpectedStmt StepUpdate(bool _NeedRow = false) override
+    {
+        return Forward(m_Stmt->StepUpdate(_NeedRow));
+    }
+
+    ExpectedStmt Reset() override { return Forward(m_Stmt->Reset()); }
+
+  private:
+    // released in reverse order, the statement first
+    std::unique_lock<std::recursive_mutex> m_Lock;
+    StmtPtr m_Stmt;
+
+    ExpectedStmt Forward(ExpectedStmt const& _Result)
+    {
+        return {shared_from_this(), _Result.Code};
+    }
+};
+
+/// @brief Read connections of a pool. The ones no thread holds are free.
+struct PoolReaders
+{
+    std::mutex Mutex;
+    Vector<Shared<Backend>> Open;
+    Vector<Backend*> Free;
+};
+
+/// @brief Read connections the current thread holds, one per pool. They are
+/// returned to their pools when the thread exits.
+class HeldReaders
+{
+  public:
+    ~HeldReaders()
+    {
+        for (auto const& [key, held] : m_Held)
+        {
+            auto readers = held.Readers.lock();
+            if (!readers) continue;
+
+            std::lock_guard lock(readers->Mutex);
+            readers->Free.push_back(held.Reader);
+        }
+    }
+
+    Backend* Find(PoolReaders const* _Readers)
+    {
+        auto found = m_Held.find(_Readers);
+        if (found == std::end(m_Held)) return nullptr;
+
+        // a pool that was closed since, a new one may have the same address
+        if (found->second.Readers.expired())
+        {
+            m_Held.erase(found);
+            return nullptr;
+        }
+        return found->second.Reader;
+    }
+
+    void Hold(Shared<PoolReaders> const& _Readers, Backend* _Reader)
+    {
+        std::erase_if(m_Held, [](auto const& _Held)
+                      { return _Held.second.Readers.expired(); });
+        m_Held[_Readers.get()] = {_Readers, _Reader};
+    }
+
+  private:
+    struct Held
+    {
+        std::weak_ptr<PoolReaders> Readers;
+        Backend* Reader;
+    };
+    std::unordered_map<PoolReaders const*, Held> m_Held;
+};
+
+static HeldReaders& GetHeldReaders()
+{
+    static thread_local HeldReaders heldReaders;
+    return heldReaders;
+}
+
+ExpectedDB Pool::Open(StringView const& _Path, OpenOptions const& _Options)
+{
+    if (_Options.Journal && *_Options.Journal != JournalMode::WAL)
+    {
+        LOG_ERROR("Read connections need WAL mode");
+        return ResultCode::InvalidArgument;
+    }
+
+    auto writerOptions    = _Options;
+    writerOptions.Journal = JournalMode::WAL;
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        writer, Backend::OpenConnection(_Path, writerOptions, false));
+
+    // other connections would see a database of their own
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(mode,
+                                     writer.Value->QueryPragma("journal_mode"));
+    if (mode.Value != "wal")
+    {
+        LOG_WARNING("Database at '{}' can't use WAL mode ({}), opening a "
+                    "single connection",
+                    _Path, mode.Value);
+        return {writer.Value};
+    }
+
+    LOG_INFO("Opened database in WAL mode with up to {} read connections",
+             _Options.ReadConnections);
+    return {MakeShared<Pool>(writer.Value, String(_Path), _Options)};
+}
+
+Pool::Pool(Shared<Backend> _Writer, String _Path, OpenOptions _Options)
+    : m_Writer{std::move(_Writer)}, m_Path{std::move(_Path)},
+      m_Options{std::move(_Options)}, m_Readers{MakeShared<PoolReaders>()},
+      m_StatementCacheCapacity{
+          m_Writer->GetStatementCacheStats().Capacity}
+{
+    CHECK_ASSERT(m_Writer != nullptr);
+}
+
+// read connections are closed once no exiting thread is returning one
+Pool::~Pool() = default;
+
+ExpectedStmt Pool::PrepareStatement(StringView const& _SQL)
+{
+    // inside its transaction a thread reads its own changes
+    if (IsInTransaction()) return m_Writer->PrepareStatement(_SQL);
+
+    // only the first prepare of a writing statement tries the reader
+    if (IsWriteStatement(_SQL)) return PrepareOnWriter(_SQL);
+
+    if (auto reader = GetReader())
+    {
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(stmt, reader->PrepareStatement(_SQL));
+
+        // only statements prepared by Backend end up here
+        auto sqliteStmt =
+            static_cast<DatabasePreparedStatementSqlite3*>(stmt.Value.get());
+        if (sqliteStmt->IsReadOnly()) return stmt;
+
+        reader->EvictStatement(_SQL);
+        std::unique_lock lock(m_WriteStatementsMutex);
+        m_WriteStatements.emplace(_SQL);
+    }
+
+    return PrepareOnWriter(_SQL);
+}
+
+bool Pool::IsWriteStatement(StringView const& _SQL) const
+{
+    std::shared_lock lock(m_WriteStatementsMutex);
+    return m_WriteStatements.contains(_SQL);
+}
+
+ExpectedStmt Pool::PrepareOnWriter(StringView const& _SQL)
+{
+    std::unique_lock lock(m_WriterMutex);
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(stmt, m_Writer->PrepareStatement(_SQL));
+    // the lock can only be moved, which MakeShared() doesn't do
+    return {std::make_shared<WriterStatement>(std::move(lock), stmt.Value)};
+}
+
+ResultCode Pool::ExecuteSQL(StringView const& _SQL)
+{
+    std::lock_guard lock(m_WriterMutex);
+    return m_Writer->ExecuteSQL(_SQL);
+}
+
+bool Pool::IsInTransaction() const
+{
+    // only the owner can see a transaction, so it doesn't need the lock
+    return m_WriterOwner == std::this_thread::get_id() &&
+           m_Writer->IsInTransaction();
+}
+
+ResultCode Pool::BeginTransaction()
+{
+    // kept locked until the matching commit or rollback
+    m_WriterMutex.lock();
+    m_WriterOwner = std::this_thread::get_id();
+
+    auto result   = m_Writer->BeginTransaction();
+    if (ResultIsError(result))
+    {
+        if (!m_Writer->IsInTransaction()) m_WriterOwner = std::thread::id();
+        m_WriterMutex.unlock();
+    }
+    return result;
+}
+
+ResultCode Pool::CommitTransaction()
+{
+    if (!IsInTransaction()) return ResultCode::InvalidState;
+
+    auto result = m_Writer->CommitTransaction();
+    if (!m_Writer->IsInTransaction()) m_WriterOwner = std::thread::id();
+    m_WriterMutex.unlock();
+    return result;
+}
+
+ResultCode Pool::RollbackTransaction()
+{
+    if (!IsInTransaction()) return ResultCode::InvalidState;
+
+    auto result = m_Writer->RollbackTransaction();
+    if (!m_Writer->IsInTransaction()) m_WriterOwner = std::thread::id();
+    m_WriterMutex.unlock();
+    return result;
+}
+
+uint64_t Pool::GetRollbackCount() const
+{
+    return m_Writer->GetRollbackCount();
+}
+
+void Pool::NotifyCacheChange() { m_Writer->NotifyCacheChange(); }
+
+uint64_t Pool::GetTransactionCount() const
+{
+    return m_Writer->GetTransactionCount();
+}
+
+Expected<INTEGER> Pool::GetLastRowId()
+{
+    std::lock_guard lock(m_WriterMutex);
+    return m_Writer->GetLastRowId();
+}
+
+bool Pool::IsReadOnly() const
+{
+    std::lock_guard lock(m_WriterMutex);
+    return m_Writer->IsReadOnly();
+}
+
+StatementCacheStats Pool::GetStatementCacheStats() const
+{
+    StatementCacheStats stats;
+    {
+        std::lock_guard lock(m_WriterMutex);
+        stats = m_Writer->GetStatementCacheStats();
+    }
+
+    if (auto reader = GetHeldReaders().Find(m_Readers.get()))
+    {
+        auto readerStats  = reader->GetStatementCacheStats();
+        stats.Hits       += readerStats.Hits;
+        stats.Misses     += readerStats.Misses;
+        stats.Evictions  += readerStats.Evictions;
+        stats.Size       += readerStats.Size;
+    }
+    return stats;
+}
+
+void Pool::SetStatementCacheCapacity(size_t _Capacity)
+{
+    m_StatementCacheCapacity = _Capacity;
+
+    std::lock_guard lock(m_WriterMutex);
+    m_Writer->SetStatementCacheCapacity(_Capacity);
+}
+
+bool Pool::HasReader() const
+{
+    return GetHeldReaders().Find(m_Readers.get()) != nullptr;
+}
+
+Backend* Pool::GetReader()
+{
+    auto reader = GetHeldReaders().Find(m_Readers.get());
+    if (!reader)
+    {
+        std::lock_guard lock(m_Readers->Mutex);
+
+        if (!m_Readers->Free.empty())
+        {
+            reader = m_Readers->Free.back();
+            m_Readers->Free.pop_back();
+        }
+        else if (m_Readers->Open.size() < m_Options.ReadConnections)
+        {
+            auto opened = Backend::OpenConnection(m_Path, m_Options, true);
+            if (!opened)
+            {
+                LOG_WARNING("Could not open read connection: {}",
+                            ResultToString(opened.Code));
+                return nullptr;
+            }
+
+            m_Readers->Open.push_back(opened.Value);
+            reader = opened.Value.get();
+            LOG_DEBUG("Opened read connection {} of {}",
+                      m_Readers->Open.size(), m_Options.ReadConnections);
+        }
+        else return nullptr;
+
+        GetHeldReaders().Hold(m_Readers, reader);
+    }
+
+    // only the reader's thread touches its statement cache
+    size_t capacity = m_StatementCacheCapacity;
+    if (reader->GetStatementCacheStats().Capacity != capacity)
+        reader->SetStatementCacheCapacity(capacity);
+    return reader;
+}
+
+} // namespace Booru::DB::Sqlite3
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "db.hh"
+
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_set>
+
+namespace Booru::DB::Sqlite3
+{
+
+struct PoolReaders;
+
+/// @brief A database opened in WAL mode with one connection that writes and
+/// a pool of read-only connections.
+///
+/// Statements that only read are prepared on the calling thread's read
+/// connection, which it checks out on first use and returns when it exits.
+/// Everything else goes to the
+/// writer, which a thread holds from BeginTransaction() to the final commit or
+/// rollback, or while a statement prepared outside of a transaction is alive.
+/// Inside its transaction, a thread reads through the writer as well, so it
+/// sees its own changes.
+class Pool : public DB::IBackend
+{
+  public:
+    static ExpectedDB Open(StringView const& _Path,
+                           OpenOptions const& _Options);
+
+    Pool(Shared<Backend> _Writer, String _Path, OpenOptions _Options);
+    virtual ~Pool() override;
+
+    virtual ExpectedStmt PrepareStatement(StringView const& _SQL) override;
+    virtual ResultCode ExecuteSQL(StringView const& _SQL) override;
+
+    /// @brief Check if the calling thread is in a transaction.
+    virtual bool IsInTransaction() const override;
+    virtual ResultCode BeginTransaction() override;
+    virtual ResultCode CommitTransaction() override;
+    virtual ResultCode RollbackTransaction() override;
+    virtual uint64_t GetRollbackCount() const override;
+    virtual void NotifyCacheChange() override;
+    virtual uint64_t GetTransactionCount() const override;
+
+    virtual Expected<DB::INTEGER> GetLastRowId() override;
+    virtual bool IsReadOnly() const override;
+
+    /// @brief Get the cache counters of the writer and the calling thread's
+    /// read connection.
+    virtual StatementCacheStats GetStatementCacheStats() const override;
+    virtual void SetStatementCacheCapacity(size_t _Capacity) override;
+
+    /// @brief Check if the calling thread holds a read connection.
+    bool HasReader() const;
+
+  private:
+    Shared<Backend> m_Writer;
+
+    /// Held by the thread using the writer, once per nested transaction.
+    mutable std::recursive_mutex m_WriterMutex;
+    std::atomic<std::thread::id> m_WriterOwner;
+
+    /// Read connections are opened with the same path and options.
+    String m_Path;
+    OpenOptions m_Options;
+
+    /// Read connections, shared with the threads holding one so they can
+    /// return it when they exit.
+    Shared<PoolReaders> m_Readers;
+
+    /// Applied to read connections by their thread on next use.
+    std::atomic<size_t> m_StatementCacheCapacity;
+
+    /// SQL of statements found to write, prepared on the writer right away.
+    std::unordered_set<String, Strings::Hash, std::equal_to<>>
+        m_WriteStatements;
+    mutable std::shared_mutex m_WriteStatementsMutex;
+
+    /// @brief Get the read connection of the calling thread, check out a free
+    /// one or open a new one if there is none yet.
+    /// @return Connection, nullptr if all are taken or opening failed.
+    Backend* GetReader();
+
+    /// @brief Prepare a statement on the writer outside of a transaction. The
+    /// writer stays locked while the statement is alive.
+    ExpectedStmt PrepareOnWriter(StringView const& _SQL);
+
+    /// @brief Check if a statement was found to write before.
+    bool IsWriteStatement(StringView const& _SQL) const;
+};
+
+} // namespace Booru::DB::Sqlite3
@@ -1,6 +1,7 @@
 #include "stmt.hh"
 
 #include "db.hh"
+#include "id_set.hh"
 #include "result.hh"
 
 #include <sqlite3.h>
@@ -31,16 +32,41 @@ DatabasePreparedStatementSqlite3::GetParamIndex(StringView const& _Name,
     CHECK_ASSERT(m_Handle != nullptr);
     CHECK_ASSERT(!_Name.empty());
 
-    String NameString("$");
-    NameString += _Name;
+    if (!m_ParamIndicesResolved)
+    {
+        // parameters are numbered from 1
+        int paramCount = sqlite3_bind_parameter_count(m_Handle);
+        for (int i = 1; i <= paramCount; i++)
+        {
+            char const* name = sqlite3_bind_parameter_name(m_Handle, i);
+            if (name == nullptr || name[0] != '$') continue;
+            m_ParamIndices.emplace(name + 1, i);
+        }
+        m_ParamIndicesResolved = true;
+    }
 
-    _Index      = sqlite3_bind_parameter_index(m_Handle, NameString.c_str());
+    auto found = m_ParamIndices.find(_Name);
+    _Index     = found == m_ParamIndices.end() ? 0 : found->second;
     return ResultCode::OK;
 }
 
 ExpectedStmt
 DatabasePreparedStatementSqlite3::BindValue(StringView const& _Name,
                                             ByteSpan const& _Blob)
+{
+    return BindBlob(_Name, _Blob, true);
+}
+
+ExpectedStmt
+DatabasePreparedStatementSqlite3::BindValueRef(StringView const& _Name,
+                                               ByteSpan const& _Blob)
+{
+    return BindBlob(_Name, _Blob, false);
+}
+
+ExpectedStmt
+DatabasePreparedStatementSqlite3::BindBlob(StringView const& _Name,
+                                           ByteSpan const& _Blob, bool _Copy)
 {
     INTEGER paramIndex;
     CHECK_RETURN_RESULT_ON_ERROR(GetParamIndex(_Name, paramIndex));
@@ -49,15 +75,11 @@ DatabasePreparedStatementSqlite3::BindValue(StringView const& _Name,
         return shared_from_this(); // OK, not all queries use all entity members
     }
 
-    // make a copy
-    void* blobCopy = ::malloc(_Blob.size_bytes());
-    assert(blobCopy);
-    ::memcpy(blobCopy, _Blob.data(), _Blob.size_bytes());
-
-    // give it to sqlite, let it call free after use
+    // either let sqlite make its own copy or borrow the caller's data
     return {shared_from_this(),
-            Sqlite3ToResult(sqlite3_bind_blob(m_Handle, paramIndex, blobCopy,
-                                              _Blob.size_bytes(), ::free))};
+            Sqlite3ToResult(sqlite3_bind_blob64(
+                m_Handle, paramIndex, _Blob.data(), _Blob.size_bytes(),
+                _Copy ? SQLITE_TRANSIENT : SQLITE_STATIC))};
 }
 
 ExpectedStmt
@@ -85,6 +107,20 @@ DatabasePreparedStatementSqlite3::BindValue(StringView const& _Name,
 ExpectedStmt
 DatabasePreparedStatementSqlite3::BindValue(StringView const& _Name,
                                             TEXT const& _Value)
+{
+    return BindText(_Name, _Value, true);
+}
+
+ExpectedStmt
+DatabasePreparedStatementSqlite3::BindValueRef(StringView const& _Name,
+                                               StringView const& _Text)
+{
+    return BindText(_Name, _Text, false);
+}
+
+ExpectedStmt
+DatabasePreparedStatementSqlite3::BindText(StringView const& _Name,
+                                           StringView const& _Text, bool _Copy)
 {
     INTEGER paramIndex;
     CHECK_RETURN_RESULT_ON_ERROR(GetParamIndex(_Name, paramIndex));
@@ -93,14 +129,29 @@ DatabasePreparedStatementSqlite3::BindValue(StringView const& _Name,
         return shared_from_this(); // OK, not all queries use all entity members
     }
 
-    // create a copy
-    char* stringCopy = ::strdup(_Value.c_str());
-    CHECK_ASSERT(stringCopy != nullptr);
+    // either let sqlite make its own copy or borrow the caller's data
+    return {shared_from_this(),
+            Sqlite3ToResult(sqlite3_bind_text64(
+                m_Handle, paramIndex, _Text.data(), _Text.size(),
+                _Copy ? SQLITE_TRANSIENT : SQLITE_STATIC, SQLITE_UTF8))};
+}
+
+ExpectedStmt
+DatabasePreparedStatementSqlite3::BindIds(StringView const& _Name,
+                                          Span<INTEGER const> _Ids)
+{
+    INTEGER paramIndex;
+    CHECK_RETURN_RESULT_ON_ERROR(GetParamIndex(_Name, paramIndex));
+    if (paramIndex == 0) { return shared_from_this(); }
 
-    // give it to sqlite, let it free() it when it's done
+    // sqlite owns the copy and deletes it once the binding is cleared, even
+    // if binding fails
+    auto ids = new Vector<INTEGER>(_Ids.begin(), _Ids.end());
+    auto deleteIds = [](void* _Ids)
+    { delete static_cast<Vector<INTEGER>*>(_Ids); };
     return {shared_from_this(),
-            Sqlite3ToResult(sqlite3_bind_text(m_Handle, paramIndex, stringCopy,
-                                              -1, ::free))};
+            Sqlite3ToResult(sqlite3_bind_pointer(
+                m_Handle, paramIndex, ids, ID_SET_POINTER_TYPE, deleteIds))};
 }
 
 ExpectedStmt DatabasePreparedStatementSqlite3::BindNull(StringView const& _Name)
@@ -117,11 +168,23 @@ ExpectedStmt DatabasePreparedStatementSqlite3::BindNull(StringView const& _Name)
 
 ExpectedStmt DatabasePreparedStatementSqlite3::GetColumnValue(int _Index,
                                                               ByteVector& _Blob)
+{
+    ByteSpan blob;
+    CHECK_RETURN_RESULT_ON_ERROR(GetColumnValue(_Index, blob));
+
+    _Blob.assign(std::begin(blob), std::end(blob));
+    return shared_from_this();
+}
+
+ExpectedStmt DatabasePreparedStatementSqlite3::GetColumnValue(int _Index,
+                                                              ByteSpan& _Blob)
 {
     if (ColumnIsNull(_Index)) { return ResultCode::ValueIsNull; }
 
-    _Blob.resize(sqlite3_column_bytes(m_Handle, _Index));
-    ::memcpy(_Blob.data(), sqlite3_column_blob(m_Handle, _Index), _Blob.size());
+    // blob pointer first, then size. zero length blobs have no pointer.
+    auto data = static_cast<Byte const*>(sqlite3_column_blob(m_Handle, _Index));
+    auto size = static_cast<size_t>(sqlite3_column_bytes(m_Handle, _Index));
+    _Blob     = data ? ByteSpan(data, size) : ByteSpan();
     return shared_from_this();
 }
 
@@ -145,13 +208,25 @@ ExpectedStmt DatabasePreparedStatementSqlite3::GetColumnValue(int _Index,
 
 ExpectedStmt DatabasePreparedStatementSqlite3::GetColumnValue(int _Index,
                                                               TEXT& _Value)
+{
+    StringView text;
+    CHECK_RETURN_RESULT_ON_ERROR(GetColumnValue(_Index, text));
+
+    // assign reuses the string's buffer if it is large enough
+    _Value.assign(text);
+    return shared_from_this();
+}
+
+ExpectedStmt
+DatabasePreparedStatementSqlite3::GetColumnValue(int _Index, StringView& _Value)
 {
     if (ColumnIsNull(_Index)) { return ResultCode::ValueIsNull; }
 
+    // text pointer first, then size, so the size matches the utf-8 text
     char const* str =
         reinterpret_cast<char const*>(sqlite3_column_text(m_Handle, _Index));
     CHECK_ASSERT(str != nullptr);
-    _Value = str;
+    _Value = StringView(str, sqlite3_column_bytes(m_Handle, _Index));
     return shared_from_this();
 }
 
@@ -166,13 +241,20 @@ bool DatabasePreparedStatementSqlite3::ColumnIsNull(int _Index)
 Expected<int>
 DatabasePreparedStatementSqlite3::GetColumnIndex(StringView const& _Name)
 {
-    int columnCount = sqlite3_column_count(m_Handle);
-    for (int i = 0; i < columnCount; i++)
+    if (!m_ColumnIndicesResolved)
     {
-        StringView name = sqlite3_column_name(m_Handle, i);
-        if (name == _Name) return i;
+        int columnCount = sqlite3_column_count(m_Handle);
+        for (int i = 0; i < columnCount; i++)
+        {
+            // keep the first column of a given name, like a linear search
+            m_ColumnIndices.emplace(sqlite3_column_name(m_Handle, i), i);
+        }
+        m_ColumnIndicesResolved = true;
     }
-    return ResultCode::NotFound;
+
+    auto found = m_ColumnIndices.find(_Name);
+    if (found == m_ColumnIndices.end()) return ResultCode::NotFound;
+    return found->second;
 }
 
 ExpectedStmt DatabasePreparedStatementSqlite3::StepQuery(bool _NeedRow)
@@ -205,4 +287,21 @@ ExpectedStmt DatabasePreparedStatementSqlite3::StepUpdate(bool _NeedRow)
     return {shared_from_this(), resultCode};
 }
 
+ExpectedStmt DatabasePreparedStatementSqlite3::Reset()
+{
+    CHECK_ASSERT(m_Handle);
+
+    // sqlite3_reset repeats the error of the last step, if any. That has
+    // already been reported there.
+    sqlite3_reset(m_Handle);
+    return {shared_from_this(),
+            Sqlite3ToResult(sqlite3_clear_bindings(m_Handle))};
+}
+
+bool DatabasePreparedStatementSqlite3::IsReadOnly() const
+{
+    CHECK_ASSERT(m_Handle);
+    return sqlite3_stmt_readonly(m_Handle) != 0;
+}
+
 } // namespace Booru::DB::Sqlite3
@@ -25,20 +25,50 @@ class DatabasePreparedStatementSqlite3 : public IStmt
                            TEXT const& _Value) override;
     ExpectedStmt BindNull(StringView const& _Name) override;
 
+    ExpectedStmt BindValueRef(StringView const& _Name,
+                              ByteSpan const& _Blob) override;
+    ExpectedStmt BindValueRef(StringView const& _Name,
+                              StringView const& _Text) override;
+
+    ExpectedStmt BindIds(StringView const& _Name,
+                         Span<INTEGER const> _Ids) override;
+
     ExpectedStmt GetColumnValue(int _Index, ByteVector&) override;
     ExpectedStmt GetColumnValue(int _Index, FLOAT& _Value) override;
     ExpectedStmt GetColumnValue(int _Index, INTEGER& _Value) override;
     ExpectedStmt GetColumnValue(int _Index, TEXT& _Value) override;
+    ExpectedStmt GetColumnValue(int _Index, ByteSpan& _Value) override;
+    ExpectedStmt GetColumnValue(int _Index, StringView& _Value) override;
     bool ColumnIsNull(int _Index) override;
 
     Expected<int> GetColumnIndex(StringView const& _Name) override;
     ExpectedStmt StepQuery(bool _NeedRow = false) override;
     ExpectedStmt StepUpdate(bool _NeedRow = false) override;
+    ExpectedStmt Reset() override;
+
+    /// @brief Check if the statement leaves the database unchanged.
+    bool IsReadOnly() const;
 
   private:
     sqlite3_stmt* m_Handle;
 
+    /// Parameter indices by name without the leading "$", resolved once.
+    StringMap<int> m_ParamIndices;
+    bool m_ParamIndicesResolved = false;
+
+    /// Column indices by name, resolved once.
+    StringMap<int> m_ColumnIndices;
+    bool m_ColumnIndicesResolved = false;
+
     ResultCode GetParamIndex(StringView const& _Name, INTEGER& _Index);
+
+    /// @brief Bind a blob, either copied by sqlite or borrowed from caller.
+    ExpectedStmt BindBlob(StringView const& _Name, ByteSpan const& _Blob,
+                          bool _Copy);
+
+    /// @brief Bind a text, either copied by sqlite or borrowed from caller.
+    ExpectedStmt BindText(StringView const& _Name, StringView const& _Text,
+                          bool _Copy);
 };
 
 } // namespace Booru::DB::Sqlite3
@@ -0,0 +1,140 @@
+#include "write_queue.hh"
+
+#include <booru/log.hh>
+
+#include <exception>
+
+namespace Booru::DB
+{
+
+WriteQueue::WriteQueue(DBPtr _DB, size_t _MaxBatchSize,
+                       std::chrono::microseconds _MaxDelay)
+    : m_DB{std::move(_DB)}, m_MaxBatchSize{std::max<size_t>(_MaxBatchSize, 1)},
+      m_MaxDelay{_MaxDelay}
+{
+    CHECK_ASSERT(m_DB != nullptr);
+    m_Thread = std::thread(&WriteQueue::Run, this);
+}
+
+WriteQueue::~WriteQueue()
+{
+    {
+        std::lock_guard lock(m_Mutex);
+        m_Stopping = true;
+    }
+    m_Wakeup.notify_all();
+    m_Thread.join();
+}
+
+std::future<ResultCode> WriteQueue::Submit(Write _Write)
+{
+    std::future<ResultCode> result;
+    {
+        std::lock_guard lock(m_Mutex);
+        m_Queue.push_back({std::move(_Write), {}});
+        result = m_Queue.back().Result.get_future();
+    }
+    m_Wakeup.notify_all();
+    return result;
+}
+
+void WriteQueue::SetLimits(size_t _MaxBatchSize,
+                           std::chrono::microseconds _MaxDelay)
+{
+    std::lock_guard lock(m_Mutex);
+    m_MaxBatchSize = std::max<size_t>(_MaxBatchSize, 1);
+    m_MaxDelay     = _MaxDelay;
+}
+
+void WriteQueue::Run()
+{
+    Vector<Entry> batch;
+
+    std::unique_lock lock(m_Mutex);
+    while (true)
+    {
+        m_Wakeup.wait(lock, [this] { return m_Stopping || !m_Queue.empty(); });
+        if (m_Queue.empty()) break;
+
+        // give other threads a chance to add to the batch, but not when
+        // stopping, the remaining changes are made right away
+        auto deadline = std::chrono::steady_clock::now() + m_MaxDelay;
+        m_Wakeup.wait_until(lock, deadline,
+                            [this]
+                            {
+                                return m_Stopping ||
+                                       m_Queue.size() >= m_MaxBatchSize;
+                            });
+
+        size_t count = std::min(m_Queue.size(), m_MaxBatchSize);
+        for (size_t i = 0; i < count; i++)
+        {
+            batch.push_back(std::move(m_Queue.front()));
+            m_Queue.pop_front();
+        }
+
+        lock.unlock();
+        RunBatch(batch);
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void WriteQueue::RunBatch(Vector<Entry>& _Batch)
+{
+    Vector<ResultCode> results(_Batch.size(), ResultCode::Undefined);
+
+    auto result = m_DB->BeginTransaction();
+    if (!ResultIsError(result))
+    {
+        for (size_t i = 0; i < _Batch.size(); i++)
+            results[i] = RunNested(_Batch[i]);
+
+        result = m_DB->CommitTransaction();
+    }
+
+    // changes that were kept are lost with the batch
+    if (ResultIsError(result))
+    {
+        LOG_WARNING("Batch of {} changes failed: {}", _Batch.size(),
+                    ResultToString(result));
+        for (auto& changeResult : results)
+        {
+            if (!ResultIsError(changeResult)) changeResult = result;
+        }
+    }
+
+    LOG_DEBUG("Made batch of {} changes", _Batch.size());
+    for (size_t i = 0; i < _Batch.size(); i++)
+        _Batch[i].Result.set_value(results[i]);
+}
+
+ResultCode WriteQueue::RunNested(Entry& _Entry)
+{
+    CHECK_RETURN_RESULT_ON_ERROR(m_DB->BeginTransaction());
+
+    // the library reports errors as results, exceptions only come from the
+    // change itself and must not end the write thread
+    ResultCode result = ResultCode::UnknownError;
+    try
+    {
+        result = _Entry.Change();
+    }
+    catch (std::exception const& _Exception)
+    {
+        LOG_ERROR("Change failed with an exception: {}", _Exception.what());
+    }
+    catch (...)
+    {
+        LOG_ERROR("Change failed with an unknown exception");
+    }
+
+    if (ResultIsError(result))
+    {
+        CHECK(m_DB->RollbackTransaction());
+        return result;
+    }
+    return m_DB->CommitTransaction();
+}
+
+} // namespace Booru::DB
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <booru/db.hh>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace Booru::DB
+{
+
+/// @brief Changes submitted by any thread, made by a single write thread that
+/// groups them into one transaction per batch.
+///
+/// A batch ends when it holds the maximum number of changes or when the first
+/// of them has waited for the maximum delay. Each change is made in a nested
+/// transaction of its own, so a failing change is rolled back without undoing
+/// the others of its batch.
+class WriteQueue
+{
+    static constexpr auto LOGGER = "booru.db.write_queue";
+
+  public:
+    using Write = std::function<ResultCode()>;
+
+    WriteQueue(DBPtr _DB, size_t _MaxBatchSize,
+               std::chrono::microseconds _MaxDelay);
+
+    /// @brief Make the remaining changes and stop the write thread.
+    ~WriteQueue();
+
+    /// @brief Queue a change.
+    /// @return Result of the change once its batch was committed.
+    std::future<ResultCode> Submit(Write _Write);
+
+    /// @brief Set the limits of batches that haven't started yet.
+    void SetLimits(size_t _MaxBatchSize, std::chrono::microseconds _MaxDelay);
+
+  private:
+    struct Entry
+    {
+        Write Change;
+        std::promise<ResultCode> Result;
+    };
+
+    DBPtr m_DB;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_Wakeup;
+    std::deque<Entry> m_Queue;
+    bool m_Stopping = false;
+
+    size_t m_MaxBatchSize;
+    std::chrono::microseconds m_MaxDelay;
+
+    std::thread m_Thread;
+
+    /// @brief Body of the write thread.
+    void Run();
+
+    /// @brief Make a batch of changes and fulfill their results.
+    void RunBatch(Vector<Entry>& _Batch);
+
+    /// @brief Make a change in a nested transaction. A change that throws is
+    /// rolled back and fails with UnknownError.
+    ResultCode RunNested(Entry& _Entry);
+};
+
+} // namespace Booru::DB
@@ -1,15 +1,55 @@
 #pragma once
 
 #include <booru/db/entities.hh>
+#include <booru/search.hh>
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 
 namespace Booru
 {
 
+namespace Search
+{
+class Index;
+struct PageKey;
+class ResultCache;
+class TagDictionary;
+struct QueryNode;
+struct Term;
+} // namespace Search
+
+namespace Tags
+{
+class TagGraph;
+struct TagClosure;
+} // namespace Tags
+
+namespace DB
+{
+class WriteQueue;
+} // namespace DB
+
 class Booru
 {
     static inline constexpr String LOGGER = "booru";
 
   public:
+    /// @brief Entities grouped by the id of the post they belong to.
+    template <class TEntity>
+    using EntitiesByPost = std::unordered_map<DB::INTEGER, Vector<TEntity>>;
+
+    /// @brief Number of post/tag associations changed by ApplyTagEdits().
+    struct TagEditCounts
+    {
+        DB::INTEGER Added   = 0;
+        DB::INTEGER Removed = 0;
+    };
+
     /// @brief Create and initialize a instance of the library.
     static Owning<Booru> InitializeLibrary();
 
@@ -22,7 +62,11 @@ class Booru
     /// @brief Open database connection.
     /// @param _Path Connection string, eg. file path for sqlite.
     /// @param _Create If true, create and database tables if they are not found
-    ResultCode OpenDatabase(StringView const& _Path, bool _Create = false);
+    /// @param _Options Connection options. With read connections, several
+    /// threads may read through this instance at once. Changes still have to
+    /// be made by one thread at a time, or be submitted with SubmitWrite().
+    ResultCode OpenDatabase(StringView const& _Path, bool _Create = false,
+                            DB::OpenOptions const& _Options = {});
 
     /// @brief Close database connection. Actively running transactions are
     /// rolled back.
@@ -57,6 +101,12 @@ class Booru
     /// @brief Create a new entity in database.
     template <class TEntity> Expected<TEntity> Create(TEntity& _Entity);
 
+    /// @brief Create many new entities in database in one transaction. Ids are
+    /// assigned back into _Entities. Rows that fail don't abort the batch.
+    /// @return One result code per entity.
+    template <class TEntity>
+    ExpectedVector<ResultCode> CreateMany(Span<TEntity> _Entities);
+
     /// @brief Get all entities
     template <class TEntity> ExpectedVector<TEntity> GetAll();
 
@@ -64,6 +114,14 @@ class Booru
     template <class TEntity, class TKey>
     ExpectedVector<TEntity> GetAll(StringView const& _Key, TKey const& _Value);
 
+    /// @brief Stream all entities, decoding rows on demand.
+    template <class TEntity> DB::ExpectedCursor<TEntity> StreamAll();
+
+    /// @brief Stream all matching entities, decoding rows on demand.
+    template <class TEntity, class TKey>
+    DB::ExpectedCursor<TEntity> StreamAll(StringView const& _Key,
+                                          TKey const& _Value);
+
     /// @brief Get one matching entities
     template <class TEntity> Expected<TEntity> Get(DB::INTEGER _Id);
 
@@ -92,6 +150,17 @@ class Booru
     ExpectedVector<DB::Entities::Post> GetPosts();
     Expected<DB::Entities::Post> GetPost(DB::INTEGER _Id);
     Expected<DB::Entities::Post> GetPost(DB::BLOB<16> _Id);
+
+    /// @brief Get several posts by id with a single statement.
+    /// @return Posts in the order of _Ids, unknown ids are skipped.
+    ExpectedVector<DB::Entities::Post>
+    GetPosts(Span<DB::INTEGER const> _Ids);
+
+    /// @brief Get several posts by MD5 sum with a single statement.
+    /// @return Posts in the order of _MD5Sums, unknown sums are skipped.
+    ExpectedVector<DB::Entities::Post>
+    GetPostsByMD5(Span<DB::MD5BLOB const> _MD5Sums);
+
     Expected<DB::Entities::Post> AddTagToPost(DB::Entities::Post const& _Post,
                                               DB::Entities::Tag const& _TagId);
     Expected<DB::Entities::Post>
@@ -99,6 +168,16 @@ class Booru
                       DB::Entities::Tag const& _Tag);
     ExpectedVector<DB::Entities::Post>
     FindPosts(StringView const& _QueryString);
+    DB::ExpectedCursor<DB::Entities::Post>
+    StreamFindPosts(StringView const& _QueryString);
+
+    /// @brief Get one page of posts matching a query. Pages continue after the
+    /// cursor of the previous one, so later pages cost the same as the first.
+    Expected<Search::PostPage>
+    FindPostsPage(Search::PostPageRequest const& _Request);
+
+    /// @brief Count posts matching a query without loading them.
+    Expected<DB::INTEGER> CountPosts(StringView const& _QueryString);
 
     // ////////////////////////////////////////////////////////////////////////////////////////////
     // PostTags
@@ -106,10 +185,28 @@ class Booru
 
     ExpectedVector<DB::Entities::PostTag> GetPostTags();
     ExpectedVector<DB::Entities::Tag> GetTagsForPost(DB::INTEGER _PostId);
+
+    /// @brief Get the tags of several posts with a single statement.
+    /// @return Tags by post id, with an entry for each of _PostIds.
+    Expected<EntitiesByPost<DB::Entities::Tag>>
+    GetTagsForPosts(Span<DB::INTEGER const> _PostIds);
+
     ExpectedVector<DB::Entities::Post> GetPostsForTag(DB::INTEGER _TagId);
+    DB::ExpectedCursor<DB::Entities::Post>
+    StreamPostsForTag(DB::INTEGER _TagId);
     Expected<DB::Entities::PostTag> FindPostTag(DB::INTEGER _PostId,
                                                 DB::INTEGER _Tag);
 
+    /// @brief Add and remove tags of many posts in a single transaction.
+    /// Added tags are expanded with their redirections and implications once
+    /// for all posts. Tags that end up both added and removed are added.
+    /// @return Number of associations actually created and deleted, posts that
+    /// already had or lacked a tag are not counted.
+    Expected<TagEditCounts>
+    ApplyTagEdits(Span<DB::INTEGER const> _PostIds,
+                  Span<DB::INTEGER const> _AddTagIds,
+                  Span<DB::INTEGER const> _RemoveTagIds);
+
     // ////////////////////////////////////////////////////////////////////////////////////////////
     // PostFiles
     // ////////////////////////////////////////////////////////////////////////////////////////////
@@ -117,6 +214,11 @@ class Booru
     ExpectedVector<DB::Entities::PostFile> GetPostFiles();
     ExpectedVector<DB::Entities::PostFile> GetFilesForPost(DB::INTEGER _PostId);
 
+    /// @brief Get the files of several posts with a single statement.
+    /// @return Files by post id, with an entry for each of _PostIds.
+    Expected<EntitiesByPost<DB::Entities::PostFile>>
+    GetFilesForPosts(Span<DB::INTEGER const> _PostIds);
+
     // TODO: AddFileToPost
     // TODO: GetPostForFile
 
@@ -135,10 +237,49 @@ class Booru
     ExpectedVector<DB::Entities::Tag> GetTags();
     Expected<DB::Entities::Tag> GetTag(DB::INTEGER _Id);
     Expected<DB::Entities::Tag> GetTag(DB::TEXT const& _Name);
+
+    /// @brief Get several tags by name with a single statement.
+    /// @return Tags in the order of _Names, unknown names are skipped.
+    ExpectedVector<DB::Entities::Tag>
+    GetTagsByNames(Span<DB::TEXT const> _Names);
     ExpectedVector<DB::Entities::Tag> MatchTags(StringView const& _Pattern);
+
+    /// @brief Get the most used tags whose name starts with a pattern, for
+    /// autocompletion. Same wildcards as MatchTags().
+    ExpectedVector<Search::TagCompletion>
+    CompleteTags(StringView const& _Pattern, size_t _Limit = 10);
+
+    /// @brief Get tags with a name similar to a possibly mistyped one, eg. to
+    /// suggest alternatives for a search without results.
+    /// @return Up to _Limit tags within _MaxDistance edits, closest first, then
+    /// the most used.
+    ExpectedVector<Search::TagSuggestion>
+    SuggestTags(StringView const& _Name, size_t _MaxDistance = 2,
+                size_t _Limit = 10);
     Expected<DB::Entities::Tag>
     FollowRedirections(DB::Entities::Tag const& _Tag);
 
+    /// @brief Get the id of the tag a tag finally redirects to, without
+    /// querying the database.
+    /// @return Tag id, _TagId itself if it isn't redirected.
+    Expected<DB::INTEGER> ResolveTagRedirect(DB::INTEGER _TagId);
+
+    /// @brief Rewrite redirections so every redirected tag points directly at
+    /// its final tag.
+    /// @return Number of rewritten tags.
+    Expected<DB::INTEGER> FlattenTagRedirects();
+
+    /// @brief Merge a tag into another one: _From becomes a redirection to
+    /// _To, its implications are moved over and so are its posts, a chunk at a
+    /// time so the database isn't locked for long. Posts that already have _To
+    /// just lose _From.
+    /// @param _ChunkSize Maximum number of post/tag associations changed per
+    /// transaction.
+    /// @return Number of posts moved from _From to _To.
+    Expected<DB::INTEGER> MergeTags(DB::Entities::Tag const& _From,
+                                    DB::Entities::Tag const& _To,
+                                    size_t _ChunkSize = 1000);
+
     // ////////////////////////////////////////////////////////////////////////////////////////////
     // TagImplications
     // ////////////////////////////////////////////////////////////////////////////////////////////
@@ -170,6 +311,63 @@ class Booru
     /// clauses. Matches wildcards and negations.
     Expected<String> GetSQLConditionForTag(StringView const& _Tag);
 
+    /// @brief Estimate the number of posts tagged with any of the given tags.
+    Expected<DB::INTEGER> EstimatePostCount(Vector<DB::INTEGER> const& _TagIds);
+
+    /// @brief Recount the posts of all tags and correct Tags.PostCount where it
+    /// drifted, eg. because PostTags was changed while the triggers were
+    /// missing. Every run recounts the whole table.
+    /// @return Number of corrected tags.
+    Expected<DB::INTEGER> ReconcileTagPostCounts();
+
+    /// @brief Reconcile tag post counts if the last run, by any process, is at
+    /// least _Interval ago. Opening a writable database calls this once, long
+    /// running processes call it periodically to keep reconciling.
+    /// @return Number of corrected tags, 0 if the run was not due.
+    Expected<DB::INTEGER> ReconcileTagPostCountsIfDue(
+        std::chrono::seconds _Interval = std::chrono::hours(24));
+
+    /// @brief Enable or disable the in-memory search index. While enabled, the
+    /// index is built when the database is opened, kept up to date by changes
+    /// made through this instance and used to evaluate post searches.
+    /// Changes made to the database by other means are not seen.
+    ResultCode SetSearchIndexEnabled(bool _Enabled);
+
+    /// @brief Check if the in-memory search index is enabled.
+    bool IsSearchIndexEnabled() const { return m_SearchIndexEnabled; }
+
+    /// @brief Enable or disable the in-memory tag dictionary. While enabled,
+    /// tag names are matched and completed in memory without querying the
+    /// database. Same restrictions as the search index apply.
+    ResultCode SetTagDictionaryEnabled(bool _Enabled);
+
+    /// @brief Check if the in-memory tag dictionary is enabled.
+    bool IsTagDictionaryEnabled() const { return m_TagDictionaryEnabled; }
+
+    /// @brief Queue a change to be made by a write thread, in one transaction
+    /// with changes submitted by other threads at about the same time. Waiting
+    /// for the result while in a transaction of this thread deadlocks.
+    ///
+    /// Changes are made with this instance, other threads may only read
+    /// through it meanwhile, and only if the database was opened with read
+    /// connections, see OpenDatabase().
+    /// @return Result of the change once it was committed or failed.
+    std::future<ResultCode>
+    SubmitWrite(std::function<ResultCode(Booru&)> _Write);
+
+    /// @brief Set the maximum number of changes per transaction and how long
+    /// the write thread waits for more changes before it starts one.
+    void SetWriteBatchLimits(size_t _MaxSize,
+                             std::chrono::microseconds _MaxDelay);
+
+    /// @brief Set the number of search results to keep in memory. Cached
+    /// results are dropped when changes made through this instance may affect
+    /// them. A capacity of 0 disables the cache.
+    void SetSearchCacheCapacity(size_t _Capacity);
+
+    /// @brief Get hit and invalidation counters of the search result cache.
+    Search::ResultCacheStats GetSearchCacheStats() const;
+
   private:
     Booru();
 
@@ -179,8 +377,154 @@ class Booru
     /// @brief Update database table to ne schema version.
     ResultCode UpdateTables(int64_t _Version);
 
+    /// @brief Resolve a single search token into a term. Handles negation,
+    /// metatags and tag wildcards.
+    Expected<Search::Term> ResolveSearchTerm(StringView const& _Token);
+
+    /// @brief Parse a search query and resolve it into terms that all have to
+    /// match.
+    ExpectedVector<Search::Term>
+    ResolveSearchTerms(StringView const& _QueryString);
+
+    /// @brief Resolve a node of a parsed query and append its terms.
+    ResultCode ResolveQueryNode(Search::QueryNode const& _Node,
+                                Vector<Search::Term>& _Terms);
+
+    /// @brief Evaluate the terms the search index can handle and remove them.
+    /// @return Ids of the posts matching those terms in ascending order,
+    /// nullopt if the index is not available or can't handle any term.
+    Optional<Vector<DB::INTEGER>>
+    EvaluateSearchIndex(Vector<Search::Term>& _Terms);
+
+    /// @brief Prepare statement selecting all posts matching resolved terms.
+    DB::ExpectedStmt PrepareFindPosts(Vector<Search::Term> _Terms);
+
+    /// @brief Prepare statement selecting posts by Id.
+    DB::ExpectedStmt PreparePostsById(Vector<DB::INTEGER> const& _PostIds);
+
+    /// @brief Read a page of posts selected by a query from ApplyPage().
+    Expected<Search::PostPage>
+    ReadPostPage(DB::Query::Select const& _Query,
+                 Search::PostPageRequest const& _Request,
+                 Optional<Search::PageKey> const& _After);
+
+    /// @brief Look up cached post ids for a normalized query.
+    /// @return Post ids or nullptr if the query has to be evaluated.
+    Shared<Vector<DB::INTEGER> const> FindCachedSearch(String const& _Key);
+
+    /// @brief Get the search cache generation to cache a result evaluated from
+    /// now on with. None while the caches hold changes this thread can't read
+    /// from the database yet.
+    Optional<uint64_t> GetSearchGeneration();
+
+    /// @brief Prepare statement selecting all posts with a tag.
+    DB::ExpectedStmt PreparePostsForTag(DB::INTEGER _TagId);
+
+    /// @brief Build the search index from the open database.
+    ResultCode BuildSearchIndex();
+
+    /// @brief Lock the search index, tag dictionary and tag graph to look
+    /// something up. Stale ones are rebuilt first. Not reentrant, so only held
+    /// around the lookups themselves.
+    std::shared_lock<std::shared_mutex> LockCaches();
+
+    /// @brief Lock the search index, tag dictionary and tag graph to change
+    /// them.
+    std::unique_lock<std::shared_mutex> LockCachesForChange();
+
+    /// @brief Check if the caches hold changes of a transaction of another
+    /// thread that is still open. The caches have to be locked.
+    bool HasUncommittedChanges() const;
+
+    /// @brief Get the search index, the caches have to be locked.
+    /// @return The index or nullptr if it is disabled or unusable.
+    Search::Index* GetSearchIndex();
+
+    /// @brief Build the tag dictionary from the open database.
+    ResultCode BuildTagDictionary();
+
+    /// @brief Get the tag dictionary, the caches have to be locked.
+    /// @return The dictionary or nullptr if it is disabled or unusable.
+    Search::TagDictionary* GetTagDictionary();
+
+    /// @brief Get the tag graph, the caches have to be locked.
+    Expected<Tags::TagGraph*> GetTagGraph();
+
+    /// @brief Get the closure of a tag from the tag graph.
+    Expected<Tags::TagClosure> GetTagClosure(DB::INTEGER _TagId);
+
+    /// @brief Create tag implications one at a time, so each one is checked
+    /// for cycles against the ones before it.
+    ExpectedVector<ResultCode>
+    CreateTagImplications(Span<DB::Entities::TagImplication> _Implications);
+
+    /// @brief Delete a post and report the post tags deleted along with it.
+    Expected<DB::Entities::Post> DeletePost(DB::Entities::Post& _Post);
+
+    // Checks of entity changes against other entities, before the changes are
+    // written.
+
+    template <class TEntity> ResultCode CheckChange(TEntity const&)
+    {
+        return ResultCode::OK;
+    }
+    ResultCode CheckChange(DB::Entities::Tag const& _Tag);
+    ResultCode CheckChange(DB::Entities::TagImplication const& _Implication);
+
+    // Notifications about successful entity changes. Keep in-memory structures
+    // in sync with the database.
+
+    template <class TEntity> void OnCreated(TEntity const&) {}
+    void OnCreated(DB::Entities::Post const& _Post);
+    void OnCreated(DB::Entities::PostTag const& _PostTag);
+    void OnCreated(DB::Entities::Tag const& _Tag);
+    void OnCreated(DB::Entities::TagImplication const& _Implication);
+
+    template <class TEntity> void OnUpdated(TEntity const&) {}
+    void OnUpdated(DB::Entities::Post const& _Post);
+    void OnUpdated(DB::Entities::PostTag const& _PostTag);
+    void OnUpdated(DB::Entities::Tag const& _Tag);
+    void OnUpdated(DB::Entities::TagImplication const& _Implication);
+
+    template <class TEntity> void OnDeleted(TEntity const&) {}
+    void OnDeleted(DB::Entities::Post const& _Post);
+    void OnDeleted(DB::Entities::PostTag const& _PostTag);
+    void OnDeleted(DB::Entities::Tag const& _Tag);
+    void OnDeleted(DB::Entities::TagImplication const& _Implication);
+
     /// Database handle
     DB::DBPtr m_DB;
+
+    /// In-memory search index, only present if enabled.
+    Owning<Search::Index> m_SearchIndex;
+    bool m_SearchIndexEnabled = false;
+
+    /// In-memory tag dictionary, only present if enabled.
+    Owning<Search::TagDictionary> m_TagDictionary;
+    bool m_TagDictionaryEnabled = false;
+
+    /// Tag redirections and implications.
+    Owning<Tags::TagGraph> m_TagGraph;
+
+    /// Guards the index, dictionary and graph. Changes lock it exclusively,
+    /// lookups of several threads share it.
+    std::shared_mutex m_CacheMutex;
+
+    /// Counts changes to the caches, so a rebuild knows if it missed any.
+    uint64_t m_CacheVersion = 0;
+
+    /// Transaction count of the database when the caches were last changed
+    /// inside a transaction, other threads read those changes once it ends.
+    Optional<uint64_t> m_UncommittedTransaction;
+
+    /// Recent search results.
+    Owning<Search::ResultCache> m_SearchCache;
+
+    /// Changes submitted by other threads, started on first use.
+    Owning<DB::WriteQueue> m_WriteQueue;
+    std::mutex m_WriteQueueMutex;
+    size_t m_WriteBatchSize                = 100;
+    std::chrono::microseconds m_WriteDelay = std::chrono::milliseconds(2);
 };
 
 template <class TEntity>
@@ -188,7 +532,32 @@ inline Expected<TEntity> Booru::Create(TEntity& _Entity)
 {
     CHECK_RETURN_RESULT_ON_ERROR(_Entity.CheckValidForCreate());
     CHECK_RETURN_RESULT_ON_ERROR(_Entity.CheckValues());
-    return GetDatabase().Then(DB::Entities::Create<TEntity>, _Entity);
+    CHECK_RETURN_RESULT_ON_ERROR(CheckChange(_Entity));
+
+    auto created = GetDatabase().Then(DB::Entities::Create<TEntity>, _Entity);
+    if (created) OnCreated(created.Value);
+    return created;
+}
+
+template <class TEntity>
+inline ExpectedVector<ResultCode> Booru::CreateMany(Span<TEntity> _Entities)
+{
+    if constexpr (std::is_same_v<TEntity, DB::Entities::TagImplication>)
+    {
+        return CreateTagImplications(_Entities);
+    }
+    else
+    {
+        auto results =
+            GetDatabase().Then(DB::Entities::CreateMany<TEntity>, _Entities);
+        if (!results) return results;
+
+        for (size_t i = 0; i < _Entities.size(); i++)
+        {
+            if (!ResultIsError(results.Value[i])) OnCreated(_Entities[i]);
+        }
+        return results;
+    }
 }
 
 template <class TEntity> inline ExpectedVector<TEntity> Booru::GetAll()
@@ -204,6 +573,20 @@ inline ExpectedVector<TEntity> Booru::GetAll(StringView const& _Key,
                               _Value);
 }
 
+template <class TEntity>
+inline DB::ExpectedCursor<TEntity> Booru::StreamAll()
+{
+    return GetDatabase().Then(DB::Entities::StreamAll<TEntity>);
+}
+
+template <class TEntity, class TKey>
+inline DB::ExpectedCursor<TEntity> Booru::StreamAll(StringView const& _Key,
+                                                    TKey const& _Value)
+{
+    return GetDatabase().Then(DB::Entities::StreamAllWithKey<TEntity, TKey>,
+                              _Key, _Value);
+}
+
 template <class TEntity> inline Expected<TEntity> Booru::Get(DB::INTEGER _Id)
 {
     return GetDatabase().Then(DB::Entities::GetWithKey<TEntity, DB::INTEGER>,
@@ -223,16 +606,31 @@ inline Expected<TEntity> Booru::Update(TEntity& _Entity)
 {
     CHECK_RETURN_RESULT_ON_ERROR(_Entity.CheckValidForUpdate());
     CHECK_RETURN_RESULT_ON_ERROR(_Entity.CheckValues());
-    return GetDatabase()
-        .Then(&DB::Entities::Update<TEntity>, _Entity)
-        .ThenValue(_Entity);
+    CHECK_RETURN_RESULT_ON_ERROR(CheckChange(_Entity));
+
+    auto updated = GetDatabase()
+                       .Then(&DB::Entities::Update<TEntity>, _Entity)
+                       .ThenValue(_Entity);
+    if (updated) OnUpdated(_Entity);
+    return updated;
 }
 
 /// @brief Delete entity from database.
 template <class TEntity> Expected<TEntity> Booru::Delete(TEntity& _Entity)
 {
-    CHECK_RETURN_RESULT_ON_ERROR(_Entity.CheckValidForDelete());
-    return GetDatabase().Then(&DB::Entities::Delete<TEntity>, _Entity);
+    if constexpr (std::is_same_v<TEntity, DB::Entities::Post>)
+    {
+        return DeletePost(_Entity);
+    }
+    else
+    {
+        CHECK_RETURN_RESULT_ON_ERROR(_Entity.CheckValidForDelete());
+
+        auto deleted =
+            GetDatabase().Then(&DB::Entities::Delete<TEntity>, _Entity);
+        if (deleted) OnDeleted(_Entity);
+        return deleted;
+    }
 }
 
 } // namespace Booru
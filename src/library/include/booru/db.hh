@@ -10,6 +10,112 @@ namespace Booru::DB
 
 static constexpr String LOGGER = "booru.db";
 
+/// @brief Counters describing the prepared statement cache of a backend.
+struct StatementCacheStats
+{
+    uint64_t Hits      = 0; // statements handed out from the cache
+    uint64_t Misses    = 0; // statements that had to be compiled
+    uint64_t Evictions = 0; // statements dropped to stay within capacity
+    size_t Size        = 0; // statements currently cached
+    size_t Capacity    = 0; // maximum number of cached statements
+};
+
+/// @brief Values of PRAGMA journal_mode.
+enum class JournalMode
+{
+    Delete,
+    Truncate,
+    Persist,
+    Memory,
+    WAL,
+    Off,
+};
+
+/// @brief Values of PRAGMA synchronous.
+enum class SyncMode
+{
+    Off,
+    Normal,
+    Full,
+    Extra,
+};
+
+/// @brief Values of PRAGMA temp_store.
+enum class TempStore
+{
+    Default,
+    File,
+    Memory,
+};
+
+/// @brief Options for opening a database. Settings left empty keep the
+/// defaults of sqlite or those stored in the database file.
+struct OpenOptions
+{
+    /// Number of read-only connections besides the one that writes. If not
+    /// zero, the database is switched to WAL mode and each thread reads
+    /// through a connection of its own, so reads of different threads don't
+    /// wait for each other or for the writer. A thread holds its connection
+    /// until it exits, while all are held other threads read through the
+    /// writer.
+    size_t ReadConnections = 0;
+
+    /// Stored in the database file in WAL mode, otherwise per connection.
+    Optional<JournalMode> Journal;
+    Optional<SyncMode> Synchronous;
+
+    /// Page cache of each connection, in pages if positive, in KiB if
+    /// negative.
+    Optional<int64_t> CacheSize;
+
+    /// Bytes of the database file each connection maps into memory, 0 to
+    /// read it with system calls.
+    Optional<int64_t> MmapSize;
+    Optional<TempStore> Temp;
+
+    /// Page size in bytes. Only takes effect when the database is created.
+    Optional<int64_t> PageSize;
+
+    /// Milliseconds to retry a statement while another process holds a lock.
+    Optional<int64_t> BusyTimeout;
+
+    /// Open without write access, nothing can be created or changed.
+    bool ReadOnly  = false;
+
+    /// Assume the file isn't changed by anyone while it is open, which skips
+    /// all locking. Implies ReadOnly.
+    bool Immutable = false;
+
+    /// @brief Preset for loading lots of data that can be loaded again: no
+    /// syncing, rollback journal in memory and a large cache. A crash or
+    /// power loss during the import can corrupt the database.
+    static OpenOptions BulkImport()
+    {
+        OpenOptions options;
+        options.Journal     = JournalMode::Memory;
+        options.Synchronous = SyncMode::Off;
+        options.CacheSize   = -256 * 1024;
+        options.Temp        = TempStore::Memory;
+        return options;
+    }
+
+    /// @brief Preset for serving many concurrent readers: WAL mode with read
+    /// connections, memory mapped reads and syncing only at checkpoints, so a
+    /// power loss may undo the latest commits but never corrupts.
+    static OpenOptions ReadHeavyServing(size_t _ReadConnections = 4)
+    {
+        OpenOptions options;
+        options.ReadConnections = _ReadConnections;
+        options.Journal         = JournalMode::WAL;
+        options.Synchronous     = SyncMode::Normal;
+        options.CacheSize       = -64 * 1024;
+        options.MmapSize        = 256 * 1024 * 1024;
+        options.Temp            = TempStore::Memory;
+        options.BusyTimeout     = 5000;
+        return options;
+    }
+};
+
 /// @brief Common interface for database connections.
 class IBackend
 {
@@ -30,16 +136,44 @@ class IBackend
     virtual ResultCode BeginTransaction()                         = 0;
 
     /// @brief If in toplevel transaction, commit to database and leave
-    /// transaction. Otherwise just leave transaction.
+    /// transaction. Otherwise keep the changes of the nested transaction as
+    /// part of the enclosing one and leave it.
     virtual ResultCode CommitTransaction()                        = 0;
 
-    /// @brief If in toplevel transaction, roll back transaction. Otherwise mark
-    /// current transaction as failed and roll it back on final rollback or
-    /// commit.
+    /// @brief Undo the changes of the current transaction and leave it. A
+    /// nested transaction is rolled back on its own, the enclosing one stays
+    /// intact and can still be committed.
     virtual ResultCode RollbackTransaction()                      = 0;
 
+    /// @brief Number of transactions, nested ones included, rolled back since
+    /// the connection was opened. Lets in-memory caches detect that changes
+    /// they have seen were undone. Only transactions in which caches were
+    /// changed, see NotifyCacheChange(), are counted.
+    virtual uint64_t GetRollbackCount() const                     = 0;
+
+    /// @brief Tell that in-memory caches of the database were changed, so
+    /// rolling back the current transaction has to invalidate them.
+    virtual void NotifyCacheChange()                              = 0;
+
+    /// @brief Number of outermost transactions that ended, committed or rolled
+    /// back. Until it changes, other connections don't read the changes made
+    /// inside the current one.
+    virtual uint64_t GetTransactionCount() const                  = 0;
+
     /// @brief Get unique id for last inserted database row.
     virtual Expected<INTEGER> GetLastRowId()                      = 0;
+
+    /// @brief Check if changes to the database will fail, eg. because it was
+    /// opened read-only or immutable, or the file can't be written.
+    virtual bool IsReadOnly() const                               = 0;
+
+    /// @brief Get hit/miss counters of the prepared statement cache.
+    virtual StatementCacheStats GetStatementCacheStats() const    = 0;
+
+    /// @brief Set the maximum number of cached prepared statements. Least
+    /// recently used statements are evicted if necessary. Zero disables the
+    /// cache.
+    virtual void SetStatementCacheCapacity(size_t _Capacity)      = 0;
 };
 
 /// @brief RAII transaction guard that handles transaction scope.
@@ -64,14 +198,17 @@ class TransactionGuard
         }
     }
 
-    void Commit()
+    /// @brief Commit the transaction. If that fails, its changes are rolled
+    /// back.
+    ResultCode Commit()
     {
-        if (!m_IsCommited && m_IsValid)
-        {
-            LOG_DEBUG("Transaction Guard {}: COMMIT", static_cast<void*>(this));
-            CHECK(DB->CommitTransaction());
-            m_IsCommited = true;
-        }
+        if (m_IsCommited || !m_IsValid) return ResultCode::InvalidState;
+
+        LOG_DEBUG("Transaction Guard {}: COMMIT", static_cast<void*>(this));
+        auto result = DB->CommitTransaction();
+        CHECK(result);
+        m_IsCommited = true;
+        return result;
     }
 
     void Rollback()
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <booru/db/stmt.hh>
+
+#include <iterator>
+
+namespace Booru::DB
+{
+
+/// @brief Lazily steps through the result rows of a statement. Each row is
+/// decoded on demand into a single entity buffer owned by the cursor, so only
+/// one row is held in memory at a time. Satisfies std::ranges::input_range:
+///
+///     for (auto const& post : cursor) { ... }
+///     CHECK(cursor.GetResult());
+///
+/// References to the current entity are invalidated when the cursor advances.
+template <class TEntity> class Cursor
+{
+    static constexpr auto LOGGER = "booru.db.cursor";
+
+  public:
+    /// @brief Input iterator over the rows of a cursor.
+    class Iterator
+    {
+      public:
+        using iterator_concept = std::input_iterator_tag;
+        using value_type       = TEntity;
+        using difference_type  = std::ptrdiff_t;
+
+        Iterator() = default;
+        explicit Iterator(Cursor* _Cursor) : m_Cursor{_Cursor} {}
+
+        TEntity const& operator*() const { return m_Cursor->Get(); }
+        TEntity const* operator->() const { return &m_Cursor->Get(); }
+
+        Iterator& operator++()
+        {
+            CHECK(m_Cursor->Next());
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const
+        {
+            return m_Cursor == nullptr || !m_Cursor->HasRow();
+        }
+
+      private:
+        Cursor* m_Cursor = nullptr;
+    };
+
+    Cursor() = default;
+    explicit Cursor(StmtPtr _Stmt) : m_Stmt{std::move(_Stmt)} {}
+
+    Cursor(Cursor const&)            = delete;
+    Cursor& operator=(Cursor const&) = delete;
+    Cursor(Cursor&&)                 = default;
+    Cursor& operator=(Cursor&&)      = default;
+
+    /// @brief D'tor. Resets the statement if iteration was stopped early, so a
+    /// cached statement does not stay active.
+    ~Cursor()
+    {
+        if (m_Stmt && HasRow()) CHECK(m_Stmt->Reset());
+    }
+
+    /// @brief Step to the first row, if not done yet, and return an iterator.
+    Iterator begin()
+    {
+        if (m_Result == ResultCode::Undefined) CHECK(Next());
+        return Iterator{this};
+    }
+
+    std::default_sentinel_t end() const { return {}; }
+
+    /// @brief Advance to the next row and decode it into the entity buffer.
+    /// @return DatabaseRow if a row was loaded, DatabaseEnd if there are no
+    /// more rows, or an error.
+    ResultCode Next()
+    {
+        if (!m_Stmt) return m_Result = ResultCode::InvalidState;
+        // finished or failed before
+        if (m_Result != ResultCode::Undefined && !HasRow()) return m_Result;
+
+        m_Result = m_Stmt->StepQuery();
+        if (m_Result == ResultCode::DatabaseRow)
+        {
+            ResultCode loadResult = LoadEntity(m_Entity, m_Stmt.get());
+            if (ResultIsError(loadResult)) m_Result = loadResult;
+        }
+        return m_Result;
+    }
+
+    /// @brief True if the cursor currently points at a decoded row.
+    bool HasRow() const { return m_Result == ResultCode::DatabaseRow; }
+
+    /// @brief Get the entity decoded from the current row.
+    TEntity const& Get() const { return m_Entity; }
+
+    /// @brief Result of the last step. DatabaseEnd after a complete iteration,
+    /// an error code if stepping or decoding failed.
+    ResultCode GetResult() const { return m_Result; }
+
+  private:
+    StmtPtr m_Stmt;
+    TEntity m_Entity{};
+    ResultCode m_Result = ResultCode::Undefined;
+};
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Template implementations
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+template <class TEntity> ExpectedCursor<TEntity> IStmt::ExecuteCursor()
+{
+    return Cursor<TEntity>{shared_from_this()};
+}
+
+} // namespace Booru::DB
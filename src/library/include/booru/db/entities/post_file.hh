@@ -19,7 +19,7 @@ struct PostFile : public Entity
         ENTITY_PROPERTY_KEY(Id);
         ENTITY_PROPERTY(PostId);
         ENTITY_PROPERTY(SiteId);
-        ENTITY_PROPERTY(PostId);
+        ENTITY_PROPERTY(Path);
         return ResultCode::OK;
     }
 };
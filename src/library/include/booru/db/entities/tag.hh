@@ -23,6 +23,9 @@ struct Tag : public Entity
     NULLABLE<INTEGER> RedirectId;
     INTEGER Flags = FLAG_NEW;
 
+    /// Number of posts with this tag, maintained by the database.
+    INTEGER PostCount = 0;
+
     template <class Visitor> ResultCode IterateProperties(Visitor& _Visitor)
     {
         ENTITY_PROPERTY_KEY(Id);
@@ -32,6 +35,7 @@ struct Tag : public Entity
         ENTITY_PROPERTY(Rating);
         ENTITY_PROPERTY(RedirectId);
         ENTITY_PROPERTY(Flags);
+        ENTITY_PROPERTY_READONLY(PostCount);
         return ResultCode::OK;
     }
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <booru/db.hh>
+#include <booru/db/cursor.hh>
 #include <booru/db/query.hh>
 
 namespace Booru::DB::Entities
@@ -12,6 +13,9 @@ static constexpr String LOGGER = "booru.db.entity";
     CHECK_RETURN_RESULT_ON_ERROR(_Visitor.Property(#Name, Name))
 #define ENTITY_PROPERTY_KEY(Name)                                              \
     CHECK_RETURN_RESULT_ON_ERROR(_Visitor.Property(#Name, Name, true))
+// Property maintained by the database. Loaded, but never inserted or updated.
+#define ENTITY_PROPERTY_READONLY(Name)                                         \
+    CHECK_RETURN_RESULT_ON_ERROR(_Visitor.Property(#Name, Name, false, true))
 
 /// @brief Base class for all entities.
 /// Derived classes must implement an IterateProperties function that takes a
@@ -54,7 +58,8 @@ template <class TValue> ResultCode LoadEntity(TValue& _Entity, IStmt* _Stmt)
     return _Entity.IterateProperties(visitor);
 }
 
-/// @brief Store entity properties into a statement.
+/// @brief Store entity properties into a statement. Properties are bound by
+/// reference, _Entity must outlive the execution of the statement.
 template <class TEntity>
 static ExpectedStmt Store(StmtPtr const& _Stmt, TEntity& _Entity)
 {
@@ -79,18 +84,74 @@ template <class TEntity> Expected<TEntity> Create(DBPtr _DB, TEntity& _Entity)
     CHECK_RETURN_RESULT_ON_ERROR(_Entity.CheckValidForCreate());
 
     return DB::Query::InsertEntity<TEntity>(TEntity::Table, _Entity)
+        .Returning("Id")
         .Prepare(_DB)
-        .Then(&Store<TEntity>, _Entity)
-        .Then(&IStmt::StepUpdate, true)
+        .Then(&Store<TEntity>, std::ref(_Entity))
+        .Then(&IStmt::ExecuteScalar<INTEGER>, true)
         .Then(
-            [&](auto s)
+            [&](INTEGER _Id)
             {
                 auto entity = _Entity;
-                entity.Id   = _DB->GetLastRowId();
+                entity.Id   = _Id;
                 return Expected(entity, ResultCode::CreatedOK);
             });
 }
 
+/// @brief Create many entities in the database within a single transaction,
+/// reusing one prepared insert statement. Ids of created entities are stored
+/// back into _Entities. A failing row, eg. one that already exists, does not
+/// abort the batch. It keeps its invalid Id and its error is reported.
+/// @return One result code per entity, CreatedOK or the reason it failed.
+template <class TEntity>
+ExpectedVector<ResultCode> CreateMany(DBPtr _DB, Span<TEntity> _Entities)
+{
+    Vector<ResultCode> results(_Entities.size(), ResultCode::Undefined);
+    if (_Entities.empty()) return results;
+
+    TransactionGuard guard(_DB);
+    if (!guard.GetIsValid()) return ResultCode::InvalidState;
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        stmt, DB::Query::InsertEntity<TEntity>(TEntity::Table, _Entities[0])
+                  .Returning("Id")
+                  .Prepare(_DB));
+
+    for (size_t i = 0; i < _Entities.size(); i++)
+    {
+        auto& entity = _Entities[i];
+
+        results[i]   = entity.CheckValidForCreate();
+        if (ResultIsError(results[i])) continue;
+        results[i] = entity.CheckValues();
+        if (ResultIsError(results[i])) continue;
+
+        // the statement is reset after each row, bindings are cleared
+        auto id = Store(stmt.Value, entity)
+                      .Then(&IStmt::ExecuteScalar<INTEGER>, true);
+        if (!id)
+        {
+            LOG_DEBUG("Could not create row {}: {}", i, ResultToString(id));
+            results[i] = id.Code;
+            continue;
+        }
+
+        entity.Id  = id.Value;
+        results[i] = ResultCode::CreatedOK;
+    }
+
+    auto committed = guard.Commit();
+    if (ResultIsError(committed))
+    {
+        // the rows are gone, so are their ids
+        for (size_t i = 0; i < _Entities.size(); i++)
+        {
+            if (results[i] == ResultCode::CreatedOK) _Entities[i].Id = -1;
+        }
+        return committed;
+    }
+    return results;
+}
+
 /// @brief Try to retrieve a single entity from the database matching the given
 /// key in the given column. Only one entity will be returned. If no entity is
 /// found, an error will be returned.
@@ -129,6 +190,29 @@ ExpectedVector<TEntity> GetAllWithKey(DBPtr _DB, StringView const& _KeyColumn,
         .Then(&IStmt::ExecuteList<TEntity>);
 }
 
+/// @brief Stream all entities of a given type from the database. Rows are
+/// decoded one at a time while the returned cursor is iterated.
+template <class TEntity> ExpectedCursor<TEntity> StreamAll(DBPtr _DB)
+{
+    return DB::Query::Select(TEntity::Table)
+        .Prepare(_DB)
+        .Then(&IStmt::ExecuteCursor<TEntity>);
+}
+
+/// @brief Stream all entities of a given type from the database that match the
+/// given key in the given column. Rows are decoded one at a time while the
+/// returned cursor is iterated.
+template <class TEntity, class TValue>
+ExpectedCursor<TEntity> StreamAllWithKey(DBPtr _DB, StringView const& _KeyColumn,
+                                         TValue const& _KeyValue)
+{
+    return DB::Query::Select(TEntity::Table)
+        .Key(_KeyColumn)
+        .Prepare(_DB)
+        .Then(IStmt::BindValueFn<TValue>(), _KeyColumn, _KeyValue)
+        .Then(&IStmt::ExecuteCursor<TEntity>);
+}
+
 /// @brief Update the values of an entity in the database. The entity must have
 /// a valid ID set or an error code will be returned.
 template <class TEntity> Expected<TEntity> Update(DBPtr _DB, TEntity& _Entity)
@@ -138,7 +222,7 @@ template <class TEntity> Expected<TEntity> Update(DBPtr _DB, TEntity& _Entity)
     return DB::Query::UpdateEntity(TEntity::Table, _Entity)
         .Key("Id")
         .Prepare(_DB)
-        .Then(&Store<TEntity>, _Entity)
+        .Then(&Store<TEntity>, std::ref(_Entity))
         .Then(IStmt::BindValueFn<DB::INTEGER>(), "Id", _Entity.Id)
         .Then(&IStmt::StepUpdate, true)
         .ThenValue(_Entity);
@@ -3,9 +3,34 @@
 #include <booru/db.hh>
 #include <booru/db/visitors.hh>
 
+#include <variant>
+
 namespace Booru::DB::Query
 {
 
+// Select the ids bound to a parameter with IStmt::BindIds(), for use in IN
+// conditions.
+inline String SelectIds(StringView const& _Name)
+{
+    return std::format("SELECT value FROM IdSet( ${} )", _Name);
+}
+
+// Set of ids that is bound as a single parameter when a query is prepared, so
+// the query text doesn't depend on the ids.
+struct IdSet
+{
+    String Name; // parameter name without "$"
+    Vector<INTEGER> Ids;
+};
+
+// Value that is bound to a parameter when a query is prepared, so the query
+// text doesn't depend on it.
+struct Parameter
+{
+    String Name; // parameter name without "$"
+    std::variant<INTEGER, ByteVector> Value;
+};
+
 // Abstract where condition for queries.
 class Where
 {
@@ -25,6 +50,16 @@ class Where
         return Where(String(_A), String(_B), "IN"sv);
     }
 
+    template <class TA> static Where In(TA const& _A, IdSet const& _B)
+    {
+        Where where(String(_A), SelectIds(_B.Name), "IN"sv);
+        where.IdSets.push_back(_B);
+        return where;
+    }
+
+    // Id sets used by the condition.
+    Vector<IdSet> const& GetIdSets() const { return IdSets; }
+
     operator String() const
     {
         return Strings::Join(StringVector{"( ", A, ") ", Op, " ( ", B, " )"},
@@ -35,6 +70,7 @@ class Where
     String A;
     String B;
     String Op;
+    Vector<IdSet> IdSets;
 };
 
 // Abstract query base. Where conditions are ANDed together.
@@ -50,8 +86,26 @@ template <class Derived> class Query
     {
         auto queryString = AsString();
         LOG_DEBUG("Preparing query: {}", queryString);
-        if (_DB) return _DB->PrepareStatement(queryString);
-        return ResultCode::InvalidArgument;
+        if (!_DB) return ResultCode::InvalidArgument;
+
+        auto stmt = _DB->PrepareStatement(queryString);
+        for (auto const& idSet : IdSets)
+        {
+            stmt = stmt.Then(&IStmt::BindIds, StringView(idSet.Name),
+                             Span<INTEGER const>(idSet.Ids));
+        }
+        for (auto const& parameter : Parameters)
+        {
+            stmt = stmt.Then(
+                [&](StmtPtr _Stmt)
+                {
+                    return std::visit([&](auto const& _Value)
+                                      { return _Stmt->BindValue(
+                                            parameter.Name, _Value); },
+                                      parameter.Value);
+                });
+        }
+        return stmt;
     }
 
     // Add a column to the query.
@@ -68,6 +122,27 @@ template <class Derived> class Query
         return static_cast<Derived&>(*this);
     }
 
+    // Add a where condition and bind the id sets it uses.
+    Derived& Where(class Where const& _Where)
+    {
+        for (auto const& idSet : _Where.GetIdSets()) Bind(idSet);
+        return Where(String(_Where));
+    }
+
+    // Bind an id set when preparing, for conditions that select it by name.
+    Derived& Bind(IdSet _IdSet)
+    {
+        IdSets.push_back(std::move(_IdSet));
+        return static_cast<Derived&>(*this);
+    }
+
+    // Bind a value when preparing, for conditions that use it by name.
+    Derived& Bind(Parameter _Parameter)
+    {
+        Parameters.push_back(std::move(_Parameter));
+        return static_cast<Derived&>(*this);
+    }
+
     // Add a key where condition (WHERE key = $key). Bind "$key" in the prepared
     // statement.
     Derived& Key(StringView const& _Key)
@@ -82,6 +157,8 @@ template <class Derived> class Query
     String Table;
     StringVector Columns;
     StringVector WhereArgs;
+    Vector<IdSet> IdSets;
+    Vector<Parameter> Parameters;
 
     String GetWhereString() const
     {
@@ -98,7 +175,32 @@ class Select : public Query<Select>
   public:
     explicit Select(StringView const& _Table) : Query{_Table} {}
 
+    // Add an ordering term, eg. "Score DESC". Terms are applied in order.
+    Select& OrderBy(StringView const& _Term)
+    {
+        OrderTerms.push_back(String(_Term));
+        return *this;
+    }
+
+    // Limit the number of returned rows.
+    Select& Limit(size_t _Count)
+    {
+        RowLimit = std::to_string(_Count);
+        return *this;
+    }
+
+    // Limit the number of returned rows by an expression, eg. a parameter
+    // "$Limit" bound in the prepared statement.
+    Select& Limit(StringView const& _Expression)
+    {
+        RowLimit = String(_Expression);
+        return *this;
+    }
+
   protected:
+    StringVector OrderTerms;
+    Optional<String> RowLimit;
+
     String AsString() const override
     {
         String sqlString = "SELECT ";
@@ -109,6 +211,10 @@ class Select : public Query<Select>
         if (Table != "") sqlString += " FROM " + Table;
 
         sqlString += GetWhereString();
+
+        if (!OrderTerms.empty())
+            sqlString += " ORDER BY " + Strings::Join(OrderTerms, ", ");
+        if (RowLimit) sqlString += " LIMIT " + *RowLimit;
         return sqlString;
     }
 };
@@ -119,10 +225,25 @@ class Insert : public Query<Insert>
   public:
     explicit Insert(StringView const& _Table) : Query{_Table} {}
 
+    // Add a column of the inserted row to return as a result row.
+    Insert& Returning(StringView const& _Name)
+    {
+        ReturningColumns.push_back(String(_Name));
+        return *this;
+    }
+
   protected:
+    StringVector ReturningColumns;
+
     String AsString() const override
     {
-        return "INSERT INTO "s + Table + Values();
+        return "INSERT INTO "s + Table + Values() + GetReturningString();
+    }
+
+    String GetReturningString() const
+    {
+        if (ReturningColumns.empty()) return "";
+        return "RETURNING "s + Strings::Join(ReturningColumns, ", ");
     }
 
     String Values() const
@@ -149,7 +270,8 @@ class Upsert : public Insert
   protected:
     String AsString() const override
     {
-        return "INSERT OR REPLACE INTO "s + Table + Values();
+        return "INSERT OR REPLACE INTO "s + Table + Values() +
+               GetReturningString();
     }
 };
 
@@ -36,12 +36,50 @@ class IStmt : public std::enable_shared_from_this<IStmt>
     ExpectedStmt BindValue(StringView const& _Name,
                            NULLABLE<TValue> const& _Value);
 
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+    // Bind values by reference. The bound data is not copied, the caller must
+    // keep it alive and unchanged until the statement is reset, rebound or
+    // destroyed.
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+
+    virtual ExpectedStmt BindValueRef(StringView const& _Name,
+                                      ByteSpan const& _Blob)   = 0;
+    virtual ExpectedStmt BindValueRef(StringView const& _Name,
+                                      StringView const& _Text) = 0;
+
+    ExpectedStmt BindValueRef(StringView const& _Name, FLOAT const& _Value)
+    {
+        return BindValue(_Name, _Value);
+    }
+
+    ExpectedStmt BindValueRef(StringView const& _Name, INTEGER const& _Value)
+    {
+        return BindValue(_Name, _Value);
+    }
+
+    template <size_t BlobSize>
+    ExpectedStmt BindValueRef(StringView const& _Name,
+                              BLOB<BlobSize> const& _Value);
+
+    template <class TValue>
+    ExpectedStmt BindValueRef(StringView const& _Name,
+                              NULLABLE<TValue> const& _Value);
+
     template <class TValue> static auto BindValueFn()
     {
         return static_cast<ExpectedStmt (IStmt::*)(
             StringView const&, TValue const&)>(&IStmt::BindValue);
     }
 
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+    // Bind sets of values as a single parameter.
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+
+    /// @brief Bind a set of ids, expanded in SQL with IdSet( $Name ), see
+    /// Query::SelectIds(). The ids are copied.
+    virtual ExpectedStmt BindIds(StringView const& _Name,
+                                 Span<INTEGER const> _Ids) = 0;
+
     // ////////////////////////////////////////////////////////////////////////////////////////////
     // Retrieve returned values from an executed statement.
     // ////////////////////////////////////////////////////////////////////////////////////////////
@@ -54,6 +92,14 @@ class IStmt : public std::enable_shared_from_this<IStmt>
     virtual ExpectedStmt GetColumnValue(int _Index, TEXT& _Value)    = 0;
     virtual bool ColumnIsNull(int _Index)                            = 0;
 
+    /// @brief Get a view of a blob column. The data is owned by the statement
+    /// and stays valid until the next step, reset or destruction.
+    virtual ExpectedStmt GetColumnValue(int _Index, ByteSpan& _Value)   = 0;
+
+    /// @brief Get a view of a text column. The data is owned by the statement
+    /// and stays valid until the next step, reset or destruction.
+    virtual ExpectedStmt GetColumnValue(int _Index, StringView& _Value) = 0;
+
     template <size_t BlobSize>
     ResultCode GetColumnValue(int _Index, BLOB<BlobSize>& _Value);
 
@@ -73,6 +119,10 @@ class IStmt : public std::enable_shared_from_this<IStmt>
     virtual ExpectedStmt StepQuery(bool _NeedRow = false)  = 0;
     virtual ExpectedStmt StepUpdate(bool _NeedRow = false) = 0;
 
+    /// @brief Reset statement so it can be executed again and clear all bound
+    /// values.
+    virtual ExpectedStmt Reset()                           = 0;
+
     /// @brief Execute statement, return single value. First row, first column.
     /// @tparam TValue Type of value to return.
     /// @param _NeedRow If true, return an error if there is no row returned.
@@ -91,6 +141,12 @@ class IStmt : public std::enable_shared_from_this<IStmt>
     /// @tparam TEntity Type of entity to return.
     /// @return The expected entities or an error.
     template <class TEntity> ExpectedVector<TEntity> ExecuteList();
+
+    /// @brief Execute statement, return a cursor that decodes rows as entities
+    /// one at a time while it is iterated. Defined in booru/db/cursor.hh.
+    /// @tparam TEntity Type of entity to return.
+    /// @return A cursor positioned before the first row.
+    template <class TEntity> ExpectedCursor<TEntity> ExecuteCursor();
 };
 
 // ////////////////////////////////////////////////////////////////////////////////////////////
@@ -114,13 +170,28 @@ ExpectedStmt IStmt::BindValue(StringView const& _Name,
     else { return BindNull(_Name); }
 }
 
+template <size_t BlobSize>
+ExpectedStmt IStmt::BindValueRef(StringView const& _Name,
+                                 BLOB<BlobSize> const& _Value)
+{
+    return BindValueRef(_Name, ByteSpan(_Value));
+}
+
+template <class TValue>
+ExpectedStmt IStmt::BindValueRef(StringView const& _Name,
+                                 NULLABLE<TValue> const& _Value)
+{
+    if (_Value.has_value()) { return BindValueRef(_Name, _Value.value()); }
+    else { return BindNull(_Name); }
+}
+
 // GetColumnValue
 
 template <size_t BlobSize>
 ResultCode IStmt::GetColumnValue(int _Index, BLOB<BlobSize>& _Value)
 {
-    // get blob pointer and size
-    ByteVector blob;
+    // get a view of the blob, copy straight into the array
+    ByteSpan blob;
     CHECK_RETURN_RESULT_ON_ERROR(GetColumnValue(_Index, blob));
 
     _Value.fill(0);
@@ -129,7 +200,7 @@ ResultCode IStmt::GetColumnValue(int _Index, BLOB<BlobSize>& _Value)
         LOG_WARNING(
             "Data of size {} got truncated trying to store in blob of size {}",
             blob.size(), BlobSize);
-        blob.resize(BlobSize);
+        blob = blob.first(BlobSize);
     }
     else if (blob.size() < BlobSize)
     {
@@ -138,7 +209,7 @@ ResultCode IStmt::GetColumnValue(int _Index, BLOB<BlobSize>& _Value)
             "blob of size {}",
             blob.size(), BlobSize);
     }
-    std::copy(std::begin(blob), std::end(blob), std::begin(_Value));
+    std::ranges::copy(blob, std::begin(_Value));
     return ResultCode::OK;
 }
 
@@ -151,10 +222,9 @@ ResultCode IStmt::GetColumnValue(int _Index, NULLABLE<TValue>& _Value)
         return ResultCode::OK;
     }
 
-    TValue v;
-    ResultCode result = GetColumnValue(_Index, v);
-    _Value            = v;
-    return result;
+    // reuse existing value, avoids reallocating strings
+    if (!_Value.has_value()) _Value.emplace();
+    return GetColumnValue(_Index, _Value.value());
 }
 
 template <class TValue>
@@ -173,6 +243,8 @@ template <class TValue> Expected<TValue> IStmt::ExecuteScalar(bool _NeedRow)
     auto result = StepQuery(_NeedRow).Then(
         [&](auto s) { return s->GetColumnValue(0, value); });
 
+    // don't keep the statement active, it may be cached and reused
+    CHECK(Reset());
     return Expected<TValue>::ErrorOrObject(result, std::move(value));
 }
 
@@ -182,6 +254,9 @@ template <class TEntity> Expected<TEntity> IStmt::ExecuteRow(bool _NeedRow)
 
     TEntity value;
     CHECK_SILENT_RETURN_RESULT_ON_ERROR(LoadEntity(value, this));
+
+    // don't keep the statement active, it may be cached and reused
+    CHECK(Reset());
     return value;
 }
 
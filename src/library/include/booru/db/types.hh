@@ -16,6 +16,9 @@ class IStmt;
 using StmtPtr                          = Shared<IStmt>;
 using ExpectedStmt                     = Expected<StmtPtr>;
 
+template <class TEntity> class Cursor;
+template <class TEntity> using ExpectedCursor = Expected<Cursor<TEntity>>;
+
 // type aliases
 
 using INTEGER                          = int64_t;
@@ -14,7 +14,7 @@ template <class TStmt> class LoadFromStatementPropertyVisitor
 
     template <class TValue>
     ResultCode Property(StringView const& _Name, TValue& _Value,
-                        bool _IsPrimaryKey = false)
+                        bool _IsPrimaryKey = false, bool _IsReadOnly = false)
     {
         return m_Stmt->GetColumnValue(_Name, _Value);
     }
@@ -23,7 +23,8 @@ template <class TStmt> class LoadFromStatementPropertyVisitor
     TStmt m_Stmt;
 };
 
-// Visitor that binds data from an entity property to a statement.
+// Visitor that binds data from an entity property to a statement. Values are
+// bound by reference, the entity must outlive the execution of the statement.
 class StoreToStatementPropertyVisitor
 {
   public:
@@ -31,17 +32,17 @@ class StoreToStatementPropertyVisitor
 
     template <class TValue>
     ResultCode Property(StringView const& _Name, TValue const& _Value,
-                        bool _IsPrimaryKey = false)
+                        bool _IsPrimaryKey = false, bool _IsReadOnly = false)
     {
-        return m_Stmt->BindValue(_Name, _Value);
+        return m_Stmt->BindValueRef(_Name, _Value);
     }
 
   protected:
     StmtPtr m_Stmt;
 };
 
-// Visitor that add all properties of an entity (except the primary key) to a
-// query as a column. For update queries.
+// Visitor that add all properties of an entity (except the primary key and
+// read-only properties) to a query as a column. For update queries.
 template <class TQuery> class QueryNonPrimaryKeyColumnVisitor final
 {
   public:
@@ -49,9 +50,9 @@ template <class TQuery> class QueryNonPrimaryKeyColumnVisitor final
 
     template <class TValue>
     ResultCode Property(StringView const& _Name, TValue& _Value,
-                        bool _IsPrimaryKey = false)
+                        bool _IsPrimaryKey = false, bool _IsReadOnly = false)
     {
-        if (!_IsPrimaryKey) { Query.Column(_Name); }
+        if (!_IsPrimaryKey && !_IsReadOnly) { Query.Column(_Name); }
         return ResultCode::OK;
     }
 
@@ -73,7 +74,7 @@ class ToStringPropertyVisitor
 
     template <class TValue>
     ResultCode Property(StringView const& _Name, TValue const& _Value,
-                        bool _IsKey = false)
+                        bool _IsKey = false, bool _IsReadOnly = false)
     {
         if (!m_String.empty()) { m_String += ", "; }
         m_String += String(_Name);
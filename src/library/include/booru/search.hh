@@ -0,0 +1,78 @@
+#pragma once
+
+#include <booru/common.hh>
+#include <booru/db/entities/post.hh>
+
+namespace Booru::Search
+{
+
+/// @brief Counters describing the search result cache.
+struct ResultCacheStats
+{
+    uint64_t Hits          = 0; // searches answered from the cache
+    uint64_t Misses        = 0; // searches that had to be evaluated
+    uint64_t Invalidations = 0; // results dropped because of writes
+    uint64_t Evictions     = 0; // results dropped to stay within capacity
+    uint64_t SortKeyLoads  = 0; // results read again to sort them for pages
+    size_t Size            = 0; // results currently cached
+    size_t Capacity        = 0; // maximum number of cached results
+
+    /// @brief Fraction of searches answered from the cache.
+    double GetHitRate() const
+    {
+        uint64_t total = Hits + Misses;
+        return total == 0 ? 0.0 : double(Hits) / double(total);
+    }
+};
+
+/// @brief Tag suggested for a partially typed tag name.
+struct TagCompletion
+{
+    DB::INTEGER TagId     = -1;
+    String Name;
+    DB::INTEGER PostCount = 0;
+};
+
+/// @brief Tag with a name similar to a mistyped one.
+struct TagSuggestion
+{
+    DB::INTEGER TagId     = -1;
+    String Name;
+    DB::INTEGER PostCount = 0;
+
+    /// Number of single character insertions, deletions and substitutions
+    /// between both names.
+    size_t Distance       = 0;
+};
+
+/// @brief Sort keys for pages of search results. Ties are ordered by Id.
+enum class PostOrder
+{
+    Id,
+    AddedTime,
+    Score,
+};
+
+/// @brief Request for one page of posts matching a search query.
+struct PostPageRequest
+{
+    String Query;
+    PostOrder Order = PostOrder::Id;
+    bool Descending = false;
+    size_t PageSize = 50;
+
+    /// Position after the previous page, taken from PostPage::NextCursor.
+    /// Empty for the first page.
+    String Cursor;
+};
+
+/// @brief One page of posts matching a search query.
+struct PostPage
+{
+    Vector<DB::Entities::Post> Posts;
+
+    /// Cursor for the next page, empty if this is the last one.
+    String NextCursor;
+};
+
+} // namespace Booru::Search
@@ -3,6 +3,7 @@
 #include <booru/common.hh>
 
 #include <sstream>
+#include <unordered_map>
 namespace Booru
 {
 
@@ -169,5 +170,22 @@ String Join(CStringConvertibleConstIterable auto const& _Items,
 /// @brief Get a String that has all characters converted to lower case.
 String ToLower(StringView const& _Str);
 
+/// @brief Transparent string hash. Allows looking up String keys in unordered
+/// containers by StringView without constructing a temporary String.
+struct Hash
+{
+    using is_transparent = void;
+
+    size_t operator()(StringView const& _Str) const
+    {
+        return std::hash<StringView>{}(_Str);
+    }
+};
+
 } // namespace Strings
+
+/// @brief Unordered map with String keys that can be looked up by StringView.
+template <class TValue>
+using StringMap =
+    std::unordered_map<String, TValue, Strings::Hash, std::equal_to<>>;
 } // namespace Booru
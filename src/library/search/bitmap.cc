@@ -0,0 +1,360 @@
+#include "bitmap.hh"
+
+#include <bit>
+
+namespace Booru::Search
+{
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Container
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Bitmap::Container::Add(uint16_t _Value)
+{
+    if (IsBitset())
+    {
+        uint64_t& word = m_Bits[_Value / 64];
+        uint64_t bit   = uint64_t(1) << (_Value % 64);
+        if (word & bit) return false;
+
+        word |= bit;
+        m_Cardinality++;
+        return true;
+    }
+
+    auto it = std::ranges::lower_bound(m_Array, _Value);
+    if (it != std::end(m_Array) && *it == _Value) return false;
+
+    m_Array.insert(it, _Value);
+    m_Cardinality++;
+    if (m_Cardinality > MAX_ARRAY_SIZE) ToBitset();
+    return true;
+}
+
+bool Bitmap::Container::Remove(uint16_t _Value)
+{
+    if (IsBitset())
+    {
+        uint64_t& word = m_Bits[_Value / 64];
+        uint64_t bit   = uint64_t(1) << (_Value % 64);
+        if (!(word & bit)) return false;
+
+        word &= ~bit;
+        m_Cardinality--;
+        if (m_Cardinality <= MAX_ARRAY_SIZE) ToArray();
+        return true;
+    }
+
+    auto it = std::ranges::lower_bound(m_Array, _Value);
+    if (it == std::end(m_Array) || *it != _Value) return false;
+
+    m_Array.erase(it);
+    m_Cardinality--;
+    return true;
+}
+
+bool Bitmap::Container::Contains(uint16_t _Value) const
+{
+    if (IsBitset()) return m_Bits[_Value / 64] & (uint64_t(1) << (_Value % 64));
+    return std::ranges::binary_search(m_Array, _Value);
+}
+
+size_t Bitmap::Container::GetMemoryUsage() const
+{
+    return m_Array.capacity() * sizeof(uint16_t) +
+           m_Bits.capacity() * sizeof(uint64_t);
+}
+
+Bitmap::Container& Bitmap::Container::operator&=(Container const& _Other)
+{
+    if (!IsBitset() && !_Other.IsBitset())
+    {
+        Vector<uint16_t> result;
+        result.reserve(std::min(m_Array.size(), _Other.m_Array.size()));
+        std::ranges::set_intersection(m_Array, _Other.m_Array,
+                                      std::back_inserter(result));
+        m_Array       = std::move(result);
+        m_Cardinality = m_Array.size();
+        return *this;
+    }
+
+    if (!IsBitset())
+    {
+        // probe the sparse side against the dense one
+        std::erase_if(m_Array, [&](uint16_t _Value)
+                      { return !_Other.Contains(_Value); });
+        m_Cardinality = m_Array.size();
+        return *this;
+    }
+
+    if (!_Other.IsBitset())
+    {
+        Container result = _Other;
+        result &= *this;
+        return *this = std::move(result);
+    }
+
+    for (size_t i = 0; i < BITSET_WORDS; i++)
+        m_Bits[i] &= _Other.m_Bits[i];
+    Normalize();
+    return *this;
+}
+
+Bitmap::Container& Bitmap::Container::operator|=(Container const& _Other)
+{
+    if (!IsBitset() && !_Other.IsBitset() &&
+        m_Array.size() + _Other.m_Array.size() <= MAX_ARRAY_SIZE)
+    {
+        Vector<uint16_t> result;
+        result.reserve(m_Array.size() + _Other.m_Array.size());
+        std::ranges::set_union(m_Array, _Other.m_Array,
+                               std::back_inserter(result));
+        m_Array       = std::move(result);
+        m_Cardinality = m_Array.size();
+        return *this;
+    }
+
+    ToBitset();
+    if (_Other.IsBitset())
+    {
+        for (size_t i = 0; i < BITSET_WORDS; i++)
+            m_Bits[i] |= _Other.m_Bits[i];
+    }
+    else
+    {
+        for (uint16_t value : _Other.m_Array)
+            m_Bits[value / 64] |= uint64_t(1) << (value % 64);
+    }
+    Normalize();
+    return *this;
+}
+
+Bitmap::Container& Bitmap::Container::AndNot(Container const& _Other)
+{
+    if (!IsBitset())
+    {
+        if (_Other.IsBitset())
+        {
+            std::erase_if(m_Array, [&](uint16_t _Value)
+                          { return _Other.Contains(_Value); });
+        }
+        else
+        {
+            Vector<uint16_t> result;
+            result.reserve(m_Array.size());
+            std::ranges::set_difference(m_Array, _Other.m_Array,
+                                        std::back_inserter(result));
+            m_Array = std::move(result);
+        }
+        m_Cardinality = m_Array.size();
+        return *this;
+    }
+
+    if (_Other.IsBitset())
+    {
+        for (size_t i = 0; i < BITSET_WORDS; i++)
+            m_Bits[i] &= ~_Other.m_Bits[i];
+    }
+    else
+    {
+        for (uint16_t value : _Other.m_Array)
+            m_Bits[value / 64] &= ~(uint64_t(1) << (value % 64));
+    }
+    Normalize();
+    return *this;
+}
+
+void Bitmap::Container::AppendTo(Vector<uint32_t>& _Values,
+                                 uint32_t _High) const
+{
+    if (!IsBitset())
+    {
+        for (uint16_t value : m_Array)
+            _Values.push_back(_High | value);
+        return;
+    }
+
+    for (size_t i = 0; i < BITSET_WORDS; i++)
+    {
+        for (uint64_t word = m_Bits[i]; word != 0; word &= word - 1)
+        {
+            auto low = uint32_t(i * 64 + std::countr_zero(word));
+            _Values.push_back(_High | low);
+        }
+    }
+}
+
+void Bitmap::Container::ToBitset()
+{
+    if (IsBitset()) return;
+
+    m_Bits.assign(BITSET_WORDS, 0);
+    for (uint16_t value : m_Array)
+        m_Bits[value / 64] |= uint64_t(1) << (value % 64);
+
+    m_Array.clear();
+    m_Array.shrink_to_fit();
+}
+
+void Bitmap::Container::ToArray()
+{
+    if (!IsBitset()) return;
+
+    Vector<uint32_t> values;
+    values.reserve(m_Cardinality);
+    AppendTo(values, 0);
+
+    m_Array.assign(std::begin(values), std::end(values));
+    m_Bits.clear();
+    m_Bits.shrink_to_fit();
+}
+
+void Bitmap::Container::Normalize()
+{
+    if (!IsBitset()) return;
+
+    m_Cardinality = 0;
+    for (uint64_t word : m_Bits)
+        m_Cardinality += std::popcount(word);
+
+    if (m_Cardinality <= MAX_ARRAY_SIZE) ToArray();
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Bitmap
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+Vector<Bitmap::Entry>::iterator Bitmap::Find(uint16_t _High)
+{
+    auto it = std::ranges::lower_bound(m_Containers, _High, {}, &Entry::first);
+    if (it != std::end(m_Containers) && it->first == _High) return it;
+    return std::end(m_Containers);
+}
+
+Vector<Bitmap::Entry>::const_iterator Bitmap::Find(uint16_t _High) const
+{
+    auto it = std::ranges::lower_bound(m_Containers, _High, {}, &Entry::first);
+    if (it != std::end(m_Containers) && it->first == _High) return it;
+    return std::end(m_Containers);
+}
+
+bool Bitmap::Add(uint32_t _Value)
+{
+    uint16_t high = _Value >> 16;
+
+    auto it = std::ranges::lower_bound(m_Containers, high, {}, &Entry::first);
+    if (it == std::end(m_Containers) || it->first != high)
+        it = m_Containers.insert(it, Entry{high, {}});
+
+    return it->second.Add(uint16_t(_Value));
+}
+
+bool Bitmap::Remove(uint32_t _Value)
+{
+    auto it = Find(_Value >> 16);
+    if (it == std::end(m_Containers)) return false;
+    if (!it->second.Remove(uint16_t(_Value))) return false;
+
+    if (it->second.GetCardinality() == 0) m_Containers.erase(it);
+    return true;
+}
+
+bool Bitmap::Contains(uint32_t _Value) const
+{
+    auto it = Find(_Value >> 16);
+    return it != std::end(m_Containers) &&
+           it->second.Contains(uint16_t(_Value));
+}
+
+size_t Bitmap::GetCardinality() const
+{
+    size_t cardinality = 0;
+    for (auto const& [high, container] : m_Containers)
+        cardinality += container.GetCardinality();
+    return cardinality;
+}
+
+size_t Bitmap::GetMemoryUsage() const
+{
+    size_t usage = m_Containers.capacity() * sizeof(Entry);
+    for (auto const& [high, container] : m_Containers)
+        usage += container.GetMemoryUsage();
+    return usage;
+}
+
+Bitmap& Bitmap::operator&=(Bitmap const& _Other)
+{
+    Vector<Entry> result;
+
+    auto other = std::begin(_Other.m_Containers);
+    for (auto& [high, container] : m_Containers)
+    {
+        while (other != std::end(_Other.m_Containers) && other->first < high)
+            other++;
+        if (other == std::end(_Other.m_Containers)) break;
+        if (other->first != high) continue;
+
+        container &= other->second;
+        if (container.GetCardinality() > 0)
+            result.emplace_back(high, std::move(container));
+    }
+
+    m_Containers = std::move(result);
+    return *this;
+}
+
+Bitmap& Bitmap::operator|=(Bitmap const& _Other)
+{
+    Vector<Entry> result;
+    result.reserve(m_Containers.size() + _Other.m_Containers.size());
+
+    auto mine  = std::begin(m_Containers);
+    auto other = std::begin(_Other.m_Containers);
+    while (mine != std::end(m_Containers) ||
+           other != std::end(_Other.m_Containers))
+    {
+        if (other == std::end(_Other.m_Containers) ||
+            (mine != std::end(m_Containers) && mine->first < other->first))
+        {
+            result.push_back(std::move(*mine++));
+        }
+        else if (mine == std::end(m_Containers) || other->first < mine->first)
+        {
+            result.push_back(*other++);
+        }
+        else
+        {
+            mine->second |= other->second;
+            result.push_back(std::move(*mine++));
+            other++;
+        }
+    }
+
+    m_Containers = std::move(result);
+    return *this;
+}
+
+Bitmap& Bitmap::AndNot(Bitmap const& _Other)
+{
+    for (auto& [high, container] : m_Containers)
+    {
+        auto other = _Other.Find(high);
+        if (other != std::end(_Other.m_Containers))
+            container.AndNot(other->second);
+    }
+
+    std::erase_if(m_Containers, [](Entry const& _Entry)
+                  { return _Entry.second.GetCardinality() == 0; });
+    return *this;
+}
+
+Vector<uint32_t> Bitmap::ToVector() const
+{
+    Vector<uint32_t> values;
+    values.reserve(GetCardinality());
+    for (auto const& [high, container] : m_Containers)
+        container.AppendTo(values, uint32_t(high) << 16);
+    return values;
+}
+
+} // namespace Booru::Search
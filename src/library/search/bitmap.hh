@@ -0,0 +1,93 @@
+#pragma once
+
+#include <booru/common.hh>
+
+namespace Booru::Search
+{
+
+/// @brief Compressed set of 32 bit integers in the style of roaring bitmaps.
+/// Values are grouped by their upper 16 bits into containers that store the
+/// lower 16 bits either as a sorted array (sparse) or as a bitset (dense).
+class Bitmap
+{
+  public:
+    /// @brief Add a value. Returns false if it was already present.
+    bool Add(uint32_t _Value);
+
+    /// @brief Remove a value. Returns false if it was not present.
+    bool Remove(uint32_t _Value);
+
+    /// @brief Check if a value is present.
+    bool Contains(uint32_t _Value) const;
+
+    /// @brief Remove all values.
+    void Clear() { m_Containers.clear(); }
+
+    /// @brief Number of values in the set.
+    size_t GetCardinality() const;
+
+    bool IsEmpty() const { return m_Containers.empty(); }
+
+    /// @brief Approximate number of bytes used by the values.
+    size_t GetMemoryUsage() const;
+
+    /// @brief Keep only values that are also in _Other.
+    Bitmap& operator&=(Bitmap const& _Other);
+
+    /// @brief Add all values of _Other.
+    Bitmap& operator|=(Bitmap const& _Other);
+
+    /// @brief Remove all values that are in _Other.
+    Bitmap& AndNot(Bitmap const& _Other);
+
+    /// @brief Get all values in ascending order.
+    Vector<uint32_t> ToVector() const;
+
+  private:
+    /// @brief Lower 16 bits of all values sharing the same upper 16 bits.
+    class Container
+    {
+      public:
+        /// Containers with more values than this are stored as bitsets.
+        static constexpr size_t MAX_ARRAY_SIZE = 4096;
+        static constexpr size_t BITSET_WORDS   = 65536 / 64;
+
+        bool Add(uint16_t _Value);
+        bool Remove(uint16_t _Value);
+        bool Contains(uint16_t _Value) const;
+
+        size_t GetCardinality() const { return m_Cardinality; }
+        size_t GetMemoryUsage() const;
+
+        Container& operator&=(Container const& _Other);
+        Container& operator|=(Container const& _Other);
+        Container& AndNot(Container const& _Other);
+
+        /// @brief Append all values combined with _High to _Values.
+        void AppendTo(Vector<uint32_t>& _Values, uint32_t _High) const;
+
+      private:
+        bool IsBitset() const { return !m_Bits.empty(); }
+
+        void ToBitset();
+        void ToArray();
+
+        /// @brief Recount a bitset and switch representation if needed.
+        void Normalize();
+
+        Vector<uint16_t> m_Array;
+        Vector<uint64_t> m_Bits;
+        size_t m_Cardinality = 0;
+    };
+
+    using Entry = std::pair<uint16_t, Container>;
+
+    /// @brief Find container for upper 16 bits, or end if there is none.
+    Vector<Entry>::iterator Find(uint16_t _High);
+    Vector<Entry>::const_iterator Find(uint16_t _High) const;
+
+    /// Containers sorted by their upper 16 bits, never empty.
+    Vector<Entry> m_Containers;
+};
+
+} // namespace Booru::Search
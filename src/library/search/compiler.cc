@@ -0,0 +1,216 @@
+#include "compiler.hh"
+
+#include <booru/db/entities/post.hh>
+
+namespace Booru::Search
+{
+
+static constexpr auto LOGGER = "booru.search.compiler";
+
+/// @brief Id sets and values bound by a compiled query, named by their
+/// position.
+struct Bindings
+{
+    Vector<DB::Query::IdSet> IdSets;
+    Vector<DB::Query::Parameter> Parameters;
+
+    void BindTo(DB::Query::Select& _Query)
+    {
+        for (auto& idSet : IdSets) _Query.Bind(std::move(idSet));
+        for (auto& parameter : Parameters) _Query.Bind(std::move(parameter));
+    }
+};
+
+/// @brief Operand of an IN clause. Ids are bound as a set if _Bound is given,
+/// so the query text doesn't depend on them, or written into the SQL as a
+/// comma separated list otherwise.
+static String IdList(Vector<DB::INTEGER> const& _Ids, Bindings* _Bound)
+{
+    if (!_Bound) return "( " + Strings::JoinXForm(_Ids, ", ") + " )";
+
+    String name = std::format("Ids{}", _Bound->IdSets.size());
+    _Bound->IdSets.push_back({name, _Ids});
+    return "( " + DB::Query::SelectIds(name) + " )";
+}
+
+/// @brief Operand holding a value. Bound as a parameter if _Bound is given,
+/// written into the SQL as a literal otherwise.
+static String Value(DB::INTEGER _Value, Bindings* _Bound)
+{
+    if (!_Bound) return std::to_string(_Value);
+
+    String name = std::format("Value{}", _Bound->Parameters.size());
+    _Bound->Parameters.push_back({name, _Value});
+    return "$" + name;
+}
+
+static String Value(DB::MD5BLOB const& _Value, Bindings* _Bound)
+{
+    if (!_Bound) return std::format("X'{}'", ToString(_Value));
+
+    String name = std::format("Value{}", _Bound->Parameters.size());
+    _Bound->Parameters.push_back(
+        {name, ByteVector(std::begin(_Value), std::end(_Value))});
+    return "$" + name;
+}
+
+/// @brief Condition that produces the candidate set of posts for a term.
+static String CandidateCondition(Term const& _Term, Bindings* _Bound)
+{
+    return "Posts.Id IN ( "
+           "SELECT PostTags.PostId FROM PostTags "
+           "WHERE PostTags.TagId IN " +
+           IdList(_Term.Ids, _Bound) + " )";
+}
+
+/// @brief Condition that checks a single candidate post against a term.
+static String ProbeCondition(Term const& _Term, Bindings* _Bound)
+{
+    return "EXISTS ( "
+           "SELECT 1 FROM PostTags "
+           "WHERE PostTags.PostId = Posts.Id "
+           "AND PostTags.TagId IN " +
+           IdList(_Term.Ids, _Bound) + " )";
+}
+
+/// @brief Condition on a column of Posts. Open ends are left out, so the
+/// column's index serves both comparisons and ranges.
+static String RangeCondition(Term const& _Term, Bindings* _Bound)
+{
+    static constexpr auto MIN = std::numeric_limits<DB::INTEGER>::min();
+    static constexpr auto MAX = std::numeric_limits<DB::INTEGER>::max();
+
+    if (_Term.Min > _Term.Max) return "0";
+    if (_Term.Min == _Term.Max)
+        return std::format("Posts.{} = {}", _Term.Column,
+                           Value(_Term.Min, _Bound));
+    if (_Term.Min == MIN && _Term.Max == MAX) return "1";
+    if (_Term.Min == MIN)
+        return std::format("Posts.{} <= {}", _Term.Column,
+                           Value(_Term.Max, _Bound));
+    if (_Term.Max == MAX)
+        return std::format("Posts.{} >= {}", _Term.Column,
+                           Value(_Term.Min, _Bound));
+
+    auto min = Value(_Term.Min, _Bound);
+    return std::format("Posts.{} BETWEEN {} AND {}", _Term.Column, min,
+                       Value(_Term.Max, _Bound));
+}
+
+static String CompileCondition(Term const& _Term, Bindings* _Bound);
+
+/// @brief Condition matching any of the conjunctions of a term.
+static String AnyCondition(Term const& _Term, Bindings* _Bound)
+{
+    StringVector alternatives;
+    for (auto const& terms : _Term.Alternatives)
+    {
+        StringVector conditions;
+        for (auto const& term : terms)
+            conditions.push_back(CompileCondition(term, _Bound));
+
+        // an empty conjunction matches everything
+        if (conditions.empty()) conditions.push_back("1");
+        alternatives.push_back(Strings::Join(conditions, " AND "));
+    }
+
+    if (alternatives.empty()) return "0";
+    return "( " + Strings::Join(alternatives, " ) OR ( ") + " )";
+}
+
+static String CompileCondition(Term const& _Term, Bindings* _Bound)
+{
+    String condition;
+    switch (_Term.Kind)
+    {
+    case Term::Type::Rating:
+        condition = "Posts.Rating IN " + IdList(_Term.Ids, _Bound);
+        break;
+
+    case Term::Type::Tags:
+        condition = ProbeCondition(_Term, _Bound);
+        break;
+
+    case Term::Type::Range:
+        condition = RangeCondition(_Term, _Bound);
+        break;
+
+    case Term::Type::MD5:
+        condition = "Posts.MD5Sum = " + Value(_Term.MD5Sum, _Bound);
+        break;
+
+    case Term::Type::Any:
+        condition = AnyCondition(_Term, _Bound);
+        break;
+    }
+
+    // an empty set matches nothing, its negation everything
+    bool hasIds = _Term.Kind == Term::Type::Rating ||
+                  _Term.Kind == Term::Type::Tags;
+    if (hasIds && _Term.Ids.empty()) condition = "0";
+
+    if (_Term.Negated) return std::format("NOT ( {} )", condition);
+    return std::format("( {} )", condition);
+}
+
+String CompileCondition(Term const& _Term)
+{
+    return CompileCondition(_Term, nullptr);
+}
+
+DB::Query::Select CompilePostQuery(Vector<Term> _Terms)
+{
+    auto query = DB::Query::Select(DB::Entities::Post::Table);
+
+    // cheap column predicates first, then positive tag terms from most to
+    // least selective, groups and negated tag terms last
+    std::ranges::stable_sort(
+        _Terms,
+        [](Term const& _A, Term const& _B)
+        {
+            auto rank = [](Term const& _Term)
+            {
+                if (_Term.Kind == Term::Type::Any) return 2;
+                if (_Term.Kind != Term::Type::Tags) return 0;
+                return _Term.Negated ? 3 : 1;
+            };
+            if (rank(_A) != rank(_B)) return rank(_A) < rank(_B);
+            return _A.Estimate < _B.Estimate;
+        });
+
+    // the most selective positive tag term drives the query
+    auto driver = std::ranges::find_if(
+        _Terms, [](Term const& _Term)
+        { return _Term.Kind == Term::Type::Tags && !_Term.Negated; });
+    Bindings bound;
+    if (driver != std::end(_Terms) && !driver->Ids.empty())
+        query.Where(CandidateCondition(*driver, &bound));
+    else driver = std::end(_Terms);
+
+    for (auto term = std::begin(_Terms); term != std::end(_Terms); term++)
+    {
+        if (term != driver) query.Where(CompileCondition(*term, &bound));
+    }
+    bound.BindTo(query);
+
+    LOG_DEBUG("Compiled {} search terms", _Terms.size());
+    return query;
+}
+
+DB::Query::Select CompilePostIdQuery(Vector<DB::INTEGER> const& _PostIds,
+                                     Vector<Term> const& _Terms)
+{
+    auto query = DB::Query::Select(DB::Entities::Post::Table);
+    if (_PostIds.empty()) return query.Where("0");
+
+    query.Where(DB::Query::Where::In("Posts.Id",
+                                     DB::Query::IdSet{"PostIds", _PostIds}));
+
+    Bindings bound;
+    for (auto const& term : _Terms)
+        query.Where(CompileCondition(term, &bound));
+    bound.BindTo(query);
+    return query;
+}
+
+} // namespace Booru::Search
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <booru/db/query.hh>
+
+namespace Booru::Search
+{
+
+/// @brief A single search term with its tag pattern already resolved.
+struct Term
+{
+    enum class Type
+    {
+        Tags,   // matches posts that have any of the tags in Ids
+        Rating, // matches posts that have any of the ratings in Ids
+        Range,  // matches posts whose Column lies within [Min, Max]
+        MD5,    // matches the post with MD5Sum
+        Any     // matches posts matching any of the Alternatives
+    };
+
+    Type Kind    = Type::Tags;
+    bool Negated = false;
+
+    /// Tag ids or ratings matched by this term.
+    Vector<DB::INTEGER> Ids;
+
+    /// Posts column and inclusive bounds of a range term.
+    String Column;
+    DB::INTEGER Min = std::numeric_limits<DB::INTEGER>::min();
+    DB::INTEGER Max = std::numeric_limits<DB::INTEGER>::max();
+
+    DB::MD5BLOB MD5Sum{};
+
+    /// Conjunctions of terms, one of which has to match.
+    Vector<Vector<Term>> Alternatives;
+
+    /// Estimated number of posts matched by this term. Smaller is more
+    /// selective.
+    DB::INTEGER Estimate = 0;
+};
+
+/// @brief Compile a conjunction of terms into a query selecting the matching
+/// posts. The most selective tag term produces the candidate set from the
+/// PostTags index, the other tag terms are probed per candidate in order of
+/// increasing estimate, negations last. Tag ids and ratings are bound as id
+/// sets and other values as parameters, so the statement text doesn't depend
+/// on them.
+DB::Query::Select CompilePostQuery(Vector<Term> _Terms);
+
+/// @brief Compile a query selecting posts by id, eg. after evaluating a search
+/// in memory. Terms that could not be evaluated that way are added as
+/// conditions.
+DB::Query::Select CompilePostIdQuery(Vector<DB::INTEGER> const& _PostIds,
+                                     Vector<Term> const& _Terms = {});
+
+/// @brief Compile a single term into a standalone SQL condition on Posts.
+/// Unlike in compiled queries, where they are bound, tag ids, ratings and
+/// other values are written into the SQL.
+String CompileCondition(Term const& _Term);
+
+} // namespace Booru::Search
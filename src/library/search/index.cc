@@ -0,0 +1,236 @@
+#include "index.hh"
+
+#include <booru/db/stmt.hh>
+
+namespace Booru::Search
+{
+
+static constexpr auto LOGGER = "booru.search.index";
+
+/// @brief Call _Func for each row of a query returning two integer columns.
+template <class TFunc>
+static ResultCode ForEachRow(DB::DBPtr _DB, StringView const& _SQL,
+                             TFunc _Func)
+{
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(stmt, _DB->PrepareStatement(_SQL));
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(step, stmt.Value->StepQuery());
+    while (step != ResultCode::DatabaseEnd)
+    {
+        DB::INTEGER first = 0, second = 0;
+        CHECK_RETURN_RESULT_ON_ERROR(stmt.Value->GetColumnValue(0, first));
+        CHECK_RETURN_RESULT_ON_ERROR(stmt.Value->GetColumnValue(1, second));
+        _Func(first, second);
+
+        step = stmt.Value->StepQuery();
+        CHECK_RETURN_RESULT_ON_ERROR(step);
+    }
+    return ResultCode::OK;
+}
+
+ResultCode Index::Build(DB::DBPtr _DB)
+{
+    LOG_INFO("Building search index...");
+
+    m_Posts.Clear();
+    m_Tags.clear();
+    m_Ratings.clear();
+    m_RollbackCount = _DB->GetRollbackCount();
+    m_IsValid       = true;
+
+    auto result = ForEachRow(_DB, "SELECT Id, Rating FROM Posts",
+                             [this](auto _PostId, auto _Rating)
+                             { AddPost(_PostId, _Rating); });
+    if (!ResultIsError(result))
+    {
+        result = ForEachRow(_DB, "SELECT PostId, TagId FROM PostTags",
+                            [this](auto _PostId, auto _TagId)
+                            { AddPostTag(_PostId, _TagId); });
+    }
+
+    if (ResultIsError(result))
+    {
+        m_IsValid = false;
+        return result;
+    }
+
+    if (!m_IsValid)
+    {
+        LOG_WARNING("Post ids exceed the range of the search index.");
+        return ResultCode::DatabaseRangeError;
+    }
+
+    LOG_INFO("Search index contains {} posts and {} tags, using {} bytes.",
+             m_Posts.GetCardinality(), m_Tags.size(), GetMemoryUsage());
+    return ResultCode::OK;
+}
+
+bool Index::IsValid(DB::DBPtr const& _DB) const
+{
+    return m_IsValid && _DB && _DB->GetRollbackCount() == m_RollbackCount;
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Incremental updates
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Index::ToValue(DB::INTEGER _PostId, uint32_t& _Value)
+{
+    if (_PostId < 0 || _PostId > std::numeric_limits<uint32_t>::max())
+    {
+        m_IsValid = false;
+        return false;
+    }
+    _Value = uint32_t(_PostId);
+    return true;
+}
+
+void Index::AddPost(DB::INTEGER _PostId, DB::INTEGER _Rating)
+{
+    uint32_t value;
+    if (!ToValue(_PostId, value)) return;
+
+    m_Posts.Add(value);
+    m_Ratings[_Rating].Add(value);
+}
+
+void Index::UpdatePost(DB::INTEGER _PostId, DB::INTEGER _Rating)
+{
+    uint32_t value;
+    if (!ToValue(_PostId, value)) return;
+
+    // the previous rating is not known, there are only a handful
+    for (auto& [rating, posts] : m_Ratings)
+    {
+        if (rating != _Rating) posts.Remove(value);
+    }
+    m_Posts.Add(value);
+    m_Ratings[_Rating].Add(value);
+}
+
+void Index::RemovePost(DB::INTEGER _PostId)
+{
+    uint32_t value;
+    if (!ToValue(_PostId, value)) return;
+
+    m_Posts.Remove(value);
+    for (auto& [rating, posts] : m_Ratings)
+        posts.Remove(value);
+}
+
+void Index::AddPostTag(DB::INTEGER _PostId, DB::INTEGER _TagId)
+{
+    uint32_t value;
+    if (!ToValue(_PostId, value)) return;
+
+    m_Tags[_TagId].Add(value);
+}
+
+void Index::RemovePostTag(DB::INTEGER _PostId, DB::INTEGER _TagId)
+{
+    uint32_t value;
+    if (!ToValue(_PostId, value)) return;
+
+    auto it = m_Tags.find(_TagId);
+    if (it == std::end(m_Tags)) return;
+
+    it->second.Remove(value);
+    if (it->second.IsEmpty()) m_Tags.erase(it);
+}
+
+void Index::RemoveTag(DB::INTEGER _TagId) { m_Tags.erase(_TagId); }
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Queries
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+DB::INTEGER Index::CountPostTags(Vector<DB::INTEGER> const& _TagIds) const
+{
+    DB::INTEGER count = 0;
+    for (auto tagId : _TagIds)
+    {
+        auto it = m_Tags.find(tagId);
+        if (it != std::end(m_Tags)) count += it->second.GetCardinality();
+    }
+    return count;
+}
+
+bool Index::CanEvaluate(Term const& _Term)
+{
+    switch (_Term.Kind)
+    {
+    case Term::Type::Tags:
+    case Term::Type::Rating:
+        return true;
+
+    case Term::Type::Any:
+        return std::ranges::all_of(
+            _Term.Alternatives, [](Vector<Term> const& _Terms)
+            { return std::ranges::all_of(_Terms, &Index::CanEvaluate); });
+
+    case Term::Type::Range:
+    case Term::Type::MD5:
+        break;
+    }
+    return false;
+}
+
+Bitmap Index::GetTermBitmap(Term const& _Term) const
+{
+    if (_Term.Kind == Term::Type::Any)
+    {
+        Bitmap result;
+        for (auto const& terms : _Term.Alternatives)
+            result |= EvaluateBitmap(terms);
+        return result;
+    }
+
+    auto const& bitmaps =
+        _Term.Kind == Term::Type::Rating ? m_Ratings : m_Tags;
+
+    Bitmap result;
+    for (auto id : _Term.Ids)
+    {
+        auto it = bitmaps.find(id);
+        if (it != std::end(bitmaps)) result |= it->second;
+    }
+    return result;
+}
+
+Vector<DB::INTEGER> Index::Evaluate(Vector<Term> const& _Terms) const
+{
+    auto values = EvaluateBitmap(_Terms).ToVector();
+    return Vector<DB::INTEGER>(std::begin(values), std::end(values));
+}
+
+Bitmap Index::EvaluateBitmap(Vector<Term> const& _Terms) const
+{
+    Vector<Bitmap> positive, negative;
+    for (auto const& term : _Terms)
+    {
+        auto& bitmaps = term.Negated ? negative : positive;
+        bitmaps.push_back(GetTermBitmap(term));
+    }
+
+    // intersect the smallest sets first, the result only shrinks
+    std::ranges::sort(positive, {}, &Bitmap::GetCardinality);
+
+    Bitmap result = positive.empty() ? m_Posts : std::move(positive.front());
+    for (size_t i = 1; i < positive.size() && !result.IsEmpty(); i++)
+        result &= positive[i];
+    for (size_t i = 0; i < negative.size() && !result.IsEmpty(); i++)
+        result.AndNot(negative[i]);
+    return result;
+}
+
+size_t Index::GetMemoryUsage() const
+{
+    size_t usage = m_Posts.GetMemoryUsage();
+    for (auto const& [tagId, posts] : m_Tags)
+        usage += posts.GetMemoryUsage();
+    for (auto const& [rating, posts] : m_Ratings)
+        usage += posts.GetMemoryUsage();
+    return usage;
+}
+
+} // namespace Booru::Search
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <booru/db.hh>
+
+#include "bitmap.hh"
+#include "compiler.hh"
+
+#include <unordered_map>
+
+namespace Booru::Search
+{
+
+/// @brief In-memory inverted index from tags and ratings to the posts that
+/// have them. Post ids are stored in compressed bitmaps, so ids have to fit
+/// into 32 bits. The index is built from the database and must be told about
+/// every change made to posts and post tags afterwards.
+class Index
+{
+  public:
+    /// @brief (Re)build the index from the Posts and PostTags tables.
+    ResultCode Build(DB::DBPtr _DB);
+
+    /// @brief Check if the index reflects the database. It becomes stale when
+    /// it is invalidated or when a transaction on _DB was rolled back since it
+    /// was built, which may have undone changes it has already seen.
+    bool IsValid(DB::DBPtr const& _DB) const;
+
+    /// @brief Mark the index as stale, it has to be rebuilt before it is used
+    /// again.
+    void Invalidate() { m_IsValid = false; }
+
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+    // Incremental updates
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+
+    void AddPost(DB::INTEGER _PostId, DB::INTEGER _Rating);
+    void UpdatePost(DB::INTEGER _PostId, DB::INTEGER _Rating);
+
+    /// @brief Remove a post. Its tags have to be removed with RemovePostTag(),
+    /// looking for them in every tag would be too slow.
+    void RemovePost(DB::INTEGER _PostId);
+
+    void AddPostTag(DB::INTEGER _PostId, DB::INTEGER _TagId);
+    void RemovePostTag(DB::INTEGER _PostId, DB::INTEGER _TagId);
+    void RemoveTag(DB::INTEGER _TagId);
+
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+    // Queries
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+
+    /// @brief Number of post tags with any of the tag ids. Same as counting the
+    /// matching rows in PostTags.
+    DB::INTEGER CountPostTags(Vector<DB::INTEGER> const& _TagIds) const;
+
+    /// @brief Check if a term only depends on tags and ratings, the rest has
+    /// to be evaluated by the database.
+    static bool CanEvaluate(Term const& _Term);
+
+    /// @brief Evaluate a conjunction of terms, all of which have to pass
+    /// CanEvaluate().
+    /// @return Ids of all matching posts in ascending order.
+    Vector<DB::INTEGER> Evaluate(Vector<Term> const& _Terms) const;
+
+    /// @brief Approximate number of bytes used by the bitmaps.
+    size_t GetMemoryUsage() const;
+
+  private:
+    /// @brief Union of the bitmaps of all ids or alternatives of a term.
+    Bitmap GetTermBitmap(Term const& _Term) const;
+
+    /// @brief Posts matching a conjunction of terms.
+    Bitmap EvaluateBitmap(Vector<Term> const& _Terms) const;
+
+    /// @brief Convert a post id to a bitmap value. Invalidates the index if
+    /// the id does not fit.
+    bool ToValue(DB::INTEGER _PostId, uint32_t& _Value);
+
+    /// All posts, needed to evaluate queries without positive terms.
+    Bitmap m_Posts;
+
+    /// Posts by tag id.
+    std::unordered_map<DB::INTEGER, Bitmap> m_Tags;
+
+    /// Posts by rating.
+    std::unordered_map<DB::INTEGER, Bitmap> m_Ratings;
+
+    /// Rollback count of the database when the index was built.
+    uint64_t m_RollbackCount = 0;
+
+    bool m_IsValid           = false;
+};
+
+} // namespace Booru::Search
@@ -0,0 +1,478 @@
+#include "intersect.hh"
+
+#include <atomic>
+#include <bit>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BOORU_SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define BOORU_ALWAYS_INLINE [[gnu::always_inline]] inline
+#else
+#define BOORU_ALWAYS_INLINE inline
+#endif
+
+namespace Booru::Search
+{
+
+static constexpr auto LOGGER = "booru.search.intersect";
+
+/// Inputs that differ in size by at least this factor are galloped.
+static constexpr size_t GALLOP_RATIO = 32;
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Generic algorithms. A kernel compares blocks of WIDTH values:
+//
+//   MatchMask(a, b)  bit i set if a[i] equals any of b[0..WIDTH)
+//   CountLess(p, x)  number of values in p[0..WIDTH) less than x
+//
+// The algorithms are always inlined into the entry points below, so the
+// kernel calls end up in functions compiled for the kernel's instruction set.
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Merge both inputs block by block, emit values of _A that are
+/// (_Keep == true) or are not (_Keep == false) contained in _B.
+template <class TKernel, bool _Keep, class TValue>
+BOORU_ALWAYS_INLINE size_t BlockMerge(Span<TValue const> _A,
+                                      Span<TValue const> _B, TValue* _Out)
+{
+    constexpr size_t W = TKernel::WIDTH;
+
+    size_t i = 0, j = 0, n = 0;
+
+    // matches found so far for the current block of _A
+    unsigned mask = 0;
+
+    while (i + W <= _A.size() && j + W <= _B.size())
+    {
+        mask       |= TKernel::MatchMask(&_A[i], &_B[j]);
+
+        TValue aMax = _A[i + W - 1];
+        TValue bMax = _B[j + W - 1];
+
+        if (aMax <= bMax)
+        {
+            // no later block of _B can match this block of _A
+            for (size_t lane = 0; lane < W; lane++)
+            {
+                bool matched = (mask >> lane) & 1;
+                if (matched == _Keep) _Out[n++] = _A[i + lane];
+            }
+            i    += W;
+            mask  = 0;
+        }
+        if (bMax <= aMax) j += W;
+    }
+
+    // finish with a plain merge, blocks of _B already passed can only have
+    // matched the current block of _A
+    for (size_t k = i; k < _A.size(); k++)
+    {
+        while (j < _B.size() && _B[j] < _A[k])
+            j++;
+
+        bool matched = (k - i < W && ((mask >> (k - i)) & 1)) ||
+                       (j < _B.size() && _B[j] == _A[k]);
+        if (matched == _Keep) _Out[n++] = _A[k];
+    }
+    return n;
+}
+
+/// @brief Exponential search for the first value in _Values not less than
+/// _Value, starting at _Pos.
+template <class TKernel, class TValue>
+BOORU_ALWAYS_INLINE size_t GallopTo(Span<TValue const> _Values, size_t _Pos,
+                                    TValue _Value)
+{
+    constexpr size_t W = TKernel::WIDTH;
+
+    // double the step until we are past the value
+    size_t lo = _Pos, step = 1;
+    while (lo + step < _Values.size() && _Values[lo + step] < _Value)
+    {
+        lo   += step;
+        step *= 2;
+    }
+    size_t hi = std::min(lo + step + 1, _Values.size());
+
+    // narrow down to a few blocks
+    while (hi - lo > 2 * W)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_Values[mid] < _Value) lo = mid + 1;
+        else hi = mid;
+    }
+
+    // then skip whole blocks of smaller values
+    while (lo < hi && lo + W <= _Values.size())
+    {
+        size_t less  = TKernel::CountLess(&_Values[lo], _Value);
+        lo          += less;
+        if (less < W) break;
+    }
+    while (lo < hi && _Values[lo] < _Value)
+        lo++;
+
+    return lo;
+}
+
+/// @brief Find each value of _Small in _Large, emit values of _Small that
+/// are (_Keep == true) or are not (_Keep == false) contained in _Large.
+template <class TKernel, bool _Keep, class TValue>
+BOORU_ALWAYS_INLINE size_t GallopSmall(Span<TValue const> _Small,
+                                       Span<TValue const> _Large, TValue* _Out)
+{
+    size_t pos = 0, n = 0;
+    for (TValue value : _Small)
+    {
+        pos          = GallopTo<TKernel>(_Large, pos, value);
+        bool matched = pos < _Large.size() && _Large[pos] == value;
+        if (matched == _Keep) _Out[n++] = value;
+    }
+    return n;
+}
+
+/// @brief Remove the few values of _Small from _Large by copying the runs of
+/// values between them.
+template <class TKernel, class TValue>
+BOORU_ALWAYS_INLINE size_t GallopLarge(Span<TValue const> _Large,
+                                       Span<TValue const> _Small, TValue* _Out)
+{
+    size_t pos = 0, n = 0;
+    for (TValue value : _Small)
+    {
+        size_t next = GallopTo<TKernel>(_Large, pos, value);
+        std::copy(_Large.begin() + pos, _Large.begin() + next, _Out + n);
+        n   += next - pos;
+        pos  = next;
+
+        if (pos < _Large.size() && _Large[pos] == value) pos++;
+    }
+    std::copy(_Large.begin() + pos, _Large.end(), _Out + n);
+    return n + _Large.size() - pos;
+}
+
+template <class TKernel, class TValue>
+BOORU_ALWAYS_INLINE size_t IntersectWith(Span<TValue const> _A,
+                                         Span<TValue const> _B, TValue* _Out)
+{
+    if (_A.size() > _B.size()) std::swap(_A, _B);
+    if (_A.empty()) return 0;
+
+    if (_B.size() / _A.size() >= GALLOP_RATIO)
+        return GallopSmall<TKernel, true>(_A, _B, _Out);
+    return BlockMerge<TKernel, true>(_A, _B, _Out);
+}
+
+template <class TKernel, class TValue>
+BOORU_ALWAYS_INLINE size_t DifferenceWith(Span<TValue const> _A,
+                                          Span<TValue const> _B, TValue* _Out)
+{
+    if (_A.empty()) return 0;
+    if (_B.empty()) return std::ranges::copy(_A, _Out).out - _Out;
+
+    if (_B.size() / _A.size() >= GALLOP_RATIO)
+        return GallopSmall<TKernel, false>(_A, _B, _Out);
+    if (_A.size() / _B.size() >= GALLOP_RATIO)
+        return GallopLarge<TKernel>(_A, _B, _Out);
+    return BlockMerge<TKernel, false>(_A, _B, _Out);
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Kernels
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+struct ScalarKernel
+{
+    static constexpr size_t WIDTH = 1;
+
+    template <class TValue>
+    static unsigned MatchMask(TValue const* _A, TValue const* _B)
+    {
+        return *_A == *_B;
+    }
+
+    template <class TValue>
+    static size_t CountLess(TValue const* _Values, TValue _Value)
+    {
+        return *_Values < _Value;
+    }
+};
+
+#ifdef BOORU_SEARCH_X86
+
+template <class TValue> struct SSE42Kernel;
+template <class TValue> struct AVX2Kernel;
+
+template <> struct SSE42Kernel<uint32_t>
+{
+    static constexpr size_t WIDTH = 4;
+
+    [[gnu::target("sse4.2")]] static unsigned MatchMask(uint32_t const* _A,
+                                                         uint32_t const* _B)
+    {
+        __m128i a  = _mm_loadu_si128(reinterpret_cast<__m128i const*>(_A));
+        __m128i b  = _mm_loadu_si128(reinterpret_cast<__m128i const*>(_B));
+
+        // compare against all rotations of b
+        __m128i eq = _mm_cmpeq_epi32(a, b);
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, 0x39)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, 0x4E)));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, 0x93)));
+        return _mm_movemask_ps(_mm_castsi128_ps(eq));
+    }
+
+    [[gnu::target("sse4.2,popcnt")]] static size_t
+    CountLess(uint32_t const* _Values, uint32_t _Value)
+    {
+        // there is no unsigned compare, flip the sign bits instead
+        __m128i bias   = _mm_set1_epi32(INT32_MIN);
+        __m128i values = _mm_xor_si128(
+            _mm_loadu_si128(reinterpret_cast<__m128i const*>(_Values)), bias);
+        __m128i value = _mm_xor_si128(_mm_set1_epi32(int32_t(_Value)), bias);
+
+        __m128i less  = _mm_cmpgt_epi32(value, values);
+        return std::popcount(unsigned(_mm_movemask_ps(_mm_castsi128_ps(less))));
+    }
+};
+
+template <> struct SSE42Kernel<int64_t>
+{
+    static constexpr size_t WIDTH = 2;
+
+    [[gnu::target("sse4.2")]] static unsigned MatchMask(int64_t const* _A,
+                                                         int64_t const* _B)
+    {
+        __m128i a  = _mm_loadu_si128(reinterpret_cast<__m128i const*>(_A));
+        __m128i b  = _mm_loadu_si128(reinterpret_cast<__m128i const*>(_B));
+
+        __m128i eq = _mm_cmpeq_epi64(a, b);
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi64(a, _mm_shuffle_epi32(b, 0x4E)));
+        return _mm_movemask_pd(_mm_castsi128_pd(eq));
+    }
+
+    [[gnu::target("sse4.2,popcnt")]] static size_t
+    CountLess(int64_t const* _Values, int64_t _Value)
+    {
+        __m128i values =
+            _mm_loadu_si128(reinterpret_cast<__m128i const*>(_Values));
+        __m128i less = _mm_cmpgt_epi64(_mm_set1_epi64x(_Value), values);
+        return std::popcount(unsigned(_mm_movemask_pd(_mm_castsi128_pd(less))));
+    }
+};
+
+template <> struct AVX2Kernel<uint32_t>
+{
+    static constexpr size_t WIDTH = 8;
+
+    [[gnu::target("avx2")]] static unsigned MatchMask(uint32_t const* _A,
+                                                       uint32_t const* _B)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(_A));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(_B));
+
+        // compare against all rotations of b
+        __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+        __m256i eq     = _mm256_cmpeq_epi32(a, b);
+        for (int i = 1; i < 8; i++)
+        {
+            b  = _mm256_permutevar8x32_epi32(b, rotate);
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(a, b));
+        }
+        return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+    }
+
+    [[gnu::target("avx2,popcnt")]] static size_t
+    CountLess(uint32_t const* _Values, uint32_t _Value)
+    {
+        // there is no unsigned compare, flip the sign bits instead
+        __m256i bias   = _mm256_set1_epi32(INT32_MIN);
+        __m256i values = _mm256_xor_si256(
+            _mm256_loadu_si256(reinterpret_cast<__m256i const*>(_Values)),
+            bias);
+        __m256i value =
+            _mm256_xor_si256(_mm256_set1_epi32(int32_t(_Value)), bias);
+
+        __m256i less = _mm256_cmpgt_epi32(value, values);
+        return std::popcount(
+            unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(less))));
+    }
+};
+
+template <> struct AVX2Kernel<int64_t>
+{
+    static constexpr size_t WIDTH = 4;
+
+    [[gnu::target("avx2")]] static unsigned MatchMask(int64_t const* _A,
+                                                       int64_t const* _B)
+    {
+        __m256i a  = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(_A));
+        __m256i b  = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(_B));
+
+        __m256i eq = _mm256_cmpeq_epi64(a, b);
+        eq         = _mm256_or_si256(
+            eq, _mm256_cmpeq_epi64(a, _mm256_permute4x64_epi64(b, 0x39)));
+        eq = _mm256_or_si256(
+            eq, _mm256_cmpeq_epi64(a, _mm256_permute4x64_epi64(b, 0x4E)));
+        eq = _mm256_or_si256(
+            eq, _mm256_cmpeq_epi64(a, _mm256_permute4x64_epi64(b, 0x93)));
+        return _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    }
+
+    [[gnu::target("avx2,popcnt")]] static size_t
+    CountLess(int64_t const* _Values, int64_t _Value)
+    {
+        __m256i values =
+            _mm256_loadu_si256(reinterpret_cast<__m256i const*>(_Values));
+        __m256i less = _mm256_cmpgt_epi64(_mm256_set1_epi64x(_Value), values);
+        return std::popcount(
+            unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(less))));
+    }
+};
+
+#endif
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Entry points, one per instruction set
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+template <class TValue>
+using SetOperation = size_t (*)(Span<TValue const>, Span<TValue const>,
+                                TValue*);
+
+template <class TValue> struct Kernels
+{
+    SetOperation<TValue> Intersect;
+    SetOperation<TValue> Difference;
+};
+
+template <class TValue>
+static size_t IntersectScalar(Span<TValue const> _A, Span<TValue const> _B,
+                              TValue* _Out)
+{
+    return IntersectWith<ScalarKernel>(_A, _B, _Out);
+}
+
+template <class TValue>
+static size_t DifferenceScalar(Span<TValue const> _A, Span<TValue const> _B,
+                               TValue* _Out)
+{
+    return DifferenceWith<ScalarKernel>(_A, _B, _Out);
+}
+
+#ifdef BOORU_SEARCH_X86
+
+template <class TValue>
+[[gnu::target("sse4.2,popcnt")]] static size_t
+IntersectSSE42(Span<TValue const> _A, Span<TValue const> _B, TValue* _Out)
+{
+    return IntersectWith<SSE42Kernel<TValue>>(_A, _B, _Out);
+}
+
+template <class TValue>
+[[gnu::target("sse4.2,popcnt")]] static size_t
+DifferenceSSE42(Span<TValue const> _A, Span<TValue const> _B, TValue* _Out)
+{
+    return DifferenceWith<SSE42Kernel<TValue>>(_A, _B, _Out);
+}
+
+template <class TValue>
+[[gnu::target("avx2,popcnt")]] static size_t
+IntersectAVX2(Span<TValue const> _A, Span<TValue const> _B, TValue* _Out)
+{
+    return IntersectWith<AVX2Kernel<TValue>>(_A, _B, _Out);
+}
+
+template <class TValue>
+[[gnu::target("avx2,popcnt")]] static size_t
+DifferenceAVX2(Span<TValue const> _A, Span<TValue const> _B, TValue* _Out)
+{
+    return DifferenceWith<AVX2Kernel<TValue>>(_A, _B, _Out);
+}
+
+#endif
+
+template <class TValue> static Kernels<TValue> GetKernels()
+{
+    switch (GetInstructionSet())
+    {
+#ifdef BOORU_SEARCH_X86
+    case InstructionSet::AVX2:
+        return {IntersectAVX2<TValue>, DifferenceAVX2<TValue>};
+    case InstructionSet::SSE42:
+        return {IntersectSSE42<TValue>, DifferenceSSE42<TValue>};
+#endif
+    default:
+        return {IntersectScalar<TValue>, DifferenceScalar<TValue>};
+    }
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Instruction set selection
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+InstructionSet GetSupportedInstructionSet()
+{
+    static InstructionSet const supported = []
+    {
+#ifdef BOORU_SEARCH_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+            return InstructionSet::AVX2;
+        if (__builtin_cpu_supports("sse4.2") &&
+            __builtin_cpu_supports("popcnt"))
+            return InstructionSet::SSE42;
+#endif
+        return InstructionSet::Scalar;
+    }();
+    return supported;
+}
+
+static std::atomic<InstructionSet>& GetSelectedInstructionSet()
+{
+    static std::atomic<InstructionSet> selected = GetSupportedInstructionSet();
+    return selected;
+}
+
+InstructionSet GetInstructionSet() { return GetSelectedInstructionSet(); }
+
+void SetInstructionSet(InstructionSet _Set)
+{
+    GetSelectedInstructionSet() = std::min(_Set, GetSupportedInstructionSet());
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Set operations
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t Intersect(Span<uint32_t const> _A, Span<uint32_t const> _B,
+                 Span<uint32_t> _Out)
+{
+    CHECK_ASSERT(_Out.size() >= std::min(_A.size(), _B.size()));
+    return GetKernels<uint32_t>().Intersect(_A, _B, _Out.data());
+}
+
+size_t Intersect(Span<int64_t const> _A, Span<int64_t const> _B,
+                 Span<int64_t> _Out)
+{
+    CHECK_ASSERT(_Out.size() >= std::min(_A.size(), _B.size()));
+    return GetKernels<int64_t>().Intersect(_A, _B, _Out.data());
+}
+
+size_t Difference(Span<uint32_t const> _A, Span<uint32_t const> _B,
+                  Span<uint32_t> _Out)
+{
+    CHECK_ASSERT(_Out.size() >= _A.size());
+    return GetKernels<uint32_t>().Difference(_A, _B, _Out.data());
+}
+
+size_t Difference(Span<int64_t const> _A, Span<int64_t const> _B,
+                  Span<int64_t> _Out)
+{
+    CHECK_ASSERT(_Out.size() >= _A.size());
+    return GetKernels<int64_t>().Difference(_A, _B, _Out.data());
+}
+
+} // namespace Booru::Search
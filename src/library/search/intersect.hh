@@ -0,0 +1,50 @@
+#pragma once
+
+#include <booru/common.hh>
+
+namespace Booru::Search
+{
+
+/// @brief Instruction sets the set operation kernels can be built for.
+enum class InstructionSet
+{
+    Scalar,
+    SSE42,
+    AVX2,
+};
+
+/// @brief Best instruction set the kernels support on this CPU.
+InstructionSet GetSupportedInstructionSet();
+
+/// @brief Instruction set currently used by the kernels.
+InstructionSet GetInstructionSet();
+
+/// @brief Override the instruction set used by the kernels, eg. to compare
+/// them. Sets that are not supported are replaced by the best supported one.
+void SetInstructionSet(InstructionSet _Set);
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Set operations on sorted arrays of unique values. Very lopsided inputs are
+// processed by galloping through the larger one, others by comparing whole
+// blocks of values at once.
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Intersect two sorted sets.
+/// @param _Out Receives the common values in ascending order. Needs room for
+/// the smaller of both inputs.
+/// @return Number of values written to _Out.
+size_t Intersect(Span<uint32_t const> _A, Span<uint32_t const> _B,
+                 Span<uint32_t> _Out);
+size_t Intersect(Span<int64_t const> _A, Span<int64_t const> _B,
+                 Span<int64_t> _Out);
+
+/// @brief Remove the values of _B from _A.
+/// @param _Out Receives the remaining values in ascending order. Needs room
+/// for all of _A.
+/// @return Number of values written to _Out.
+size_t Difference(Span<uint32_t const> _A, Span<uint32_t const> _B,
+                  Span<uint32_t> _Out);
+size_t Difference(Span<int64_t const> _A, Span<int64_t const> _B,
+                  Span<int64_t> _Out);
+
+} // namespace Booru::Search
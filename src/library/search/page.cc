@@ -0,0 +1,188 @@
+#include "page.hh"
+
+#include <booru/db/stmt.hh>
+
+#include <charconv>
+
+namespace Booru::Search
+{
+
+static constexpr auto LOGGER = "booru.search.page";
+
+/// @brief Column holding the sort key of an ordering.
+static StringView GetOrderColumn(PostOrder _Order)
+{
+    switch (_Order)
+    {
+    case PostOrder::AddedTime:
+        return "Posts.AddedTime";
+
+    case PostOrder::Score:
+        return "Posts.Score";
+
+    case PostOrder::Id:
+        break;
+    }
+    return "Posts.Id";
+}
+
+/// @brief Cursor prefix identifying ordering and direction, so a cursor can't
+/// be used to continue a differently ordered page.
+static String GetCursorPrefix(PostPageRequest const& _Request)
+{
+    static constexpr char orders[] = {'i', 'a', 's'};
+
+    String prefix;
+    prefix += orders[size_t(_Request.Order)];
+    prefix += _Request.Descending ? 'd' : 'a';
+    return prefix;
+}
+
+static DB::INTEGER GetSortValue(PostOrder _Order,
+                                DB::Entities::Post const& _Post)
+{
+    switch (_Order)
+    {
+    case PostOrder::AddedTime:
+        return _Post.AddedTime;
+
+    case PostOrder::Score:
+        return _Post.Score;
+
+    case PostOrder::Id:
+        break;
+    }
+    return _Post.Id;
+}
+
+static bool ParseInteger(StringView const& _Str, DB::INTEGER& _Value)
+{
+    auto [end, error] = std::from_chars(_Str.data(),
+                                        _Str.data() + _Str.size(), _Value);
+    return error == std::errc{} && end == _Str.data() + _Str.size();
+}
+
+Expected<Optional<PageKey>> ParsePageCursor(PostPageRequest const& _Request)
+{
+    if (_Request.Cursor.empty()) return Optional<PageKey>{};
+
+    // <prefix>.<value>.<id>
+    StringVector parts = Strings::Split(_Request.Cursor, '.');
+    if (parts.size() != 3 || parts[0] != GetCursorPrefix(_Request))
+        return ResultCode::InvalidArgument;
+
+    PageKey key;
+    if (!ParseInteger(parts[1], key.Value) || !ParseInteger(parts[2], key.Id))
+        return ResultCode::InvalidArgument;
+
+    return Optional<PageKey>{key};
+}
+
+String MakePageCursor(PostPageRequest const& _Request,
+                      DB::Entities::Post const& _Post)
+{
+    return std::format("{}.{}.{}", GetCursorPrefix(_Request),
+                       GetSortValue(_Request.Order, _Post), _Post.Id);
+}
+
+/// @brief Cut a page out of sorted keys, with _Project giving the post id of
+/// a key.
+template <class TKey, class TProject>
+static Vector<DB::INTEGER> SliceKeys(Vector<TKey> const& _Keys,
+                                     PostPageRequest const& _Request,
+                                     Optional<TKey> const& _After,
+                                     TProject _Project)
+{
+    auto first = std::begin(_Keys);
+    auto last  = std::end(_Keys);
+    if (_After && _Request.Descending)
+        last = std::ranges::lower_bound(_Keys, *_After);
+    else if (_After) first = std::ranges::upper_bound(_Keys, *_After);
+
+    // one more than requested to detect the next page
+    auto count = std::min(size_t(last - first), _Request.PageSize + 1);
+    if (_Request.Descending) first = last - count;
+    else last = first + count;
+
+    Vector<DB::INTEGER> postIds(count);
+    std::ranges::transform(first, last, std::begin(postIds), _Project);
+    return postIds;
+}
+
+Vector<DB::INTEGER> SlicePage(Vector<DB::INTEGER> const& _PostIds,
+                              PostPageRequest const& _Request,
+                              Optional<PageKey> const& _After)
+{
+    CHECK_ASSERT(_Request.Order == PostOrder::Id);
+
+    Optional<DB::INTEGER> after;
+    if (_After) after = _After->Id;
+    return SliceKeys(_PostIds, _Request, after, std::identity{});
+}
+
+Vector<DB::INTEGER> SlicePage(Vector<PageKey> const& _Keys,
+                              PostPageRequest const& _Request,
+                              Optional<PageKey> const& _After)
+{
+    return SliceKeys(_Keys, _Request, _After, &PageKey::Id);
+}
+
+Expected<Vector<PageKey>> LoadPageKeys(DB::DBPtr _DB, DB::Query::Select _Query,
+                                       PostOrder _Order)
+{
+    _Query.Column(GetOrderColumn(_Order)).Column("Posts.Id");
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(stmt, _Query.Prepare(_DB));
+
+    Vector<PageKey> keys;
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(step, stmt.Value->StepQuery());
+    while (step != ResultCode::DatabaseEnd)
+    {
+        PageKey key;
+        CHECK_RETURN_RESULT_ON_ERROR(stmt.Value->GetColumnValue(0, key.Value));
+        CHECK_RETURN_RESULT_ON_ERROR(stmt.Value->GetColumnValue(1, key.Id));
+        keys.push_back(key);
+
+        step = stmt.Value->StepQuery();
+        CHECK_RETURN_RESULT_ON_ERROR(step);
+    }
+
+    std::ranges::sort(keys);
+    return keys;
+}
+
+void ApplyPage(DB::Query::Select& _Query, PostPageRequest const& _Request,
+               Optional<PageKey> const& _After)
+{
+    StringView column    = GetOrderColumn(_Request.Order);
+    StringView op        = _Request.Descending ? "<" : ">";
+    StringView direction = _Request.Descending ? "DESC" : "ASC";
+
+    // keyset: continue after the last post instead of skipping rows
+    if (_After && _Request.Order == PostOrder::Id)
+    {
+        _Query.Where(std::format("Posts.Id {} $AfterId", op));
+    }
+    else if (_After)
+    {
+        _Query.Where(std::format(
+            "( {}, Posts.Id ) {} ( $AfterValue, $AfterId )", column, op));
+    }
+
+    if (_Request.Order != PostOrder::Id)
+        _Query.OrderBy(std::format("{} {}", column, direction));
+    _Query.OrderBy(std::format("Posts.Id {}", direction));
+    _Query.Limit("$Limit");
+}
+
+DB::ExpectedStmt BindPage(DB::StmtPtr _Stmt, PostPageRequest const& _Request,
+                          Optional<PageKey> const& _After)
+{
+    auto stmt = _Stmt->BindValue("Limit", DB::INTEGER(_Request.PageSize + 1));
+    if (!_After) return stmt;
+
+    return stmt.Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "AfterValue",
+                     _After->Value)
+        .Then(DB::IStmt::BindValueFn<DB::INTEGER>(), "AfterId", _After->Id);
+}
+
+} // namespace Booru::Search
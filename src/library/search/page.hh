@@ -0,0 +1,55 @@
+#pragma once
+
+#include <booru/db/query.hh>
+#include <booru/search.hh>
+
+namespace Booru::Search
+{
+
+/// @brief Sort key of the last post of a page.
+struct PageKey
+{
+    DB::INTEGER Value = 0;
+    DB::INTEGER Id    = -1;
+
+    auto operator<=>(PageKey const&) const = default;
+};
+
+/// @brief Decode the cursor of a page request.
+/// @return Key to continue after, nullopt for the first page, InvalidArgument
+/// if the cursor is malformed or was made for another ordering.
+Expected<Optional<PageKey>> ParsePageCursor(PostPageRequest const& _Request);
+
+/// @brief Encode the position after a post into a cursor.
+String MakePageCursor(PostPageRequest const& _Request,
+                      DB::Entities::Post const& _Post);
+
+/// @brief Cut the ids of a page ordered by Id out of sorted post ids.
+/// @return Post ids of the page and the one after it, if any.
+Vector<DB::INTEGER> SlicePage(Vector<DB::INTEGER> const& _PostIds,
+                              PostPageRequest const& _Request,
+                              Optional<PageKey> const& _After);
+
+/// @brief Cut the ids of a page out of sort keys in ascending order, see
+/// LoadPageKeys().
+/// @return Post ids of the page and the one after it, if any.
+Vector<DB::INTEGER> SlicePage(Vector<PageKey> const& _Keys,
+                              PostPageRequest const& _Request,
+                              Optional<PageKey> const& _After);
+
+/// @brief Read the sort keys of the posts selected by a query.
+/// @return Keys in ascending order.
+Expected<Vector<PageKey>> LoadPageKeys(DB::DBPtr _DB, DB::Query::Select _Query,
+                                       PostOrder _Order);
+
+/// @brief Order and limit a post query to a page. Selects one post more than
+/// the page size to tell whether there is a next page. The cursor and limit
+/// are parameters, bind them with BindPage() once the query is prepared.
+void ApplyPage(DB::Query::Select& _Query, PostPageRequest const& _Request,
+               Optional<PageKey> const& _After);
+
+/// @brief Bind the cursor and limit of a query paged with ApplyPage().
+DB::ExpectedStmt BindPage(DB::StmtPtr _Stmt, PostPageRequest const& _Request,
+                          Optional<PageKey> const& _After);
+
+} // namespace Booru::Search
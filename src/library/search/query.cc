@@ -0,0 +1,288 @@
+#include "query.hh"
+
+#include <booru/db/entities.hh>
+
+#include <charconv>
+#include <chrono>
+
+namespace Booru::Search
+{
+
+static constexpr auto LOGGER = "booru.search.query";
+
+/// @brief Tokens of a query and the position of the next one to parse.
+struct QueryParser
+{
+    StringVector Tokens;
+    size_t Pos = 0;
+
+    bool IsDone() const { return Pos == Tokens.size(); }
+    StringView Peek() const { return Tokens[Pos]; }
+};
+
+static bool IsOr(StringView const& _Token)
+{
+    return _Token.size() == 2 && Strings::ToLower(_Token) == "or";
+}
+
+static bool IsGroupStart(StringView const& _Token)
+{
+    return _Token == "(" || _Token == "-(";
+}
+
+bool IsQueryOperator(StringView const& _Token)
+{
+    return IsGroupStart(_Token) || _Token == ")" || IsOr(_Token);
+}
+
+/// @brief Reduce a node with a single child to that child.
+static QueryNode Collapse(QueryNode _Node)
+{
+    if (_Node.Children.size() != 1) return _Node;
+
+    QueryNode child = std::move(_Node.Children.front());
+    child.Negated   = child.Negated != _Node.Negated;
+    return child;
+}
+
+static Expected<QueryNode> ParseOr(QueryParser& _Parser);
+
+/// @brief Parse terms up to the next "or", ")" or the end.
+static Expected<QueryNode> ParseAnd(QueryParser& _Parser)
+{
+    QueryNode node;
+    while (!_Parser.IsDone() && _Parser.Peek() != ")" &&
+           !IsOr(_Parser.Peek()))
+    {
+        StringView token = _Parser.Tokens[_Parser.Pos++];
+        if (IsGroupStart(token))
+        {
+            CHECK_VAR_RETURN_RESULT_ON_ERROR(group, ParseOr(_Parser));
+            if (_Parser.IsDone()) return ResultCode::InvalidRequest;
+            _Parser.Pos++;
+
+            group.Value.Negated = group.Value.Negated != (token == "-(");
+            node.Children.push_back(std::move(group.Value));
+            continue;
+        }
+
+        QueryNode& child = node.Children.emplace_back();
+        child.Kind       = QueryNode::Type::Token;
+        child.Negated    = token.starts_with('-');
+        child.Value      = token.substr(child.Negated ? 1 : 0);
+    }
+
+    // nothing before "or", ")" or the end
+    if (node.Children.empty()) return ResultCode::InvalidRequest;
+    return Collapse(std::move(node));
+}
+
+/// @brief Parse alternatives separated by "or".
+static Expected<QueryNode> ParseOr(QueryParser& _Parser)
+{
+    QueryNode node;
+    node.Kind = QueryNode::Type::Or;
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(first, ParseAnd(_Parser));
+    node.Children.push_back(std::move(first.Value));
+
+    while (!_Parser.IsDone() && IsOr(_Parser.Peek()))
+    {
+        _Parser.Pos++;
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(next, ParseAnd(_Parser));
+        node.Children.push_back(std::move(next.Value));
+    }
+    return Collapse(std::move(node));
+}
+
+Expected<QueryNode> ParseQuery(StringView const& _QueryString)
+{
+    QueryParser parser;
+    for (auto& token : Strings::Split(_QueryString))
+    {
+        // consecutive spaces produce empty tokens
+        if (token.empty() || token == "-") continue;
+        parser.Tokens.push_back(std::move(token));
+    }
+    if (parser.Tokens.empty()) return ResultCode::InvalidRequest;
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(root, ParseOr(parser));
+
+    // unmatched ")"
+    if (!parser.IsDone()) return ResultCode::InvalidRequest;
+    return root;
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Metatags
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Inclusive range of values a single value stands for, eg. all
+/// seconds of a day.
+using ValueSpan   = std::pair<DB::INTEGER, DB::INTEGER>;
+using ValueParser = bool (*)(StringView const&, ValueSpan&);
+
+static bool ParseIntegerValue(StringView const& _Str, ValueSpan& _Span)
+{
+    DB::INTEGER value = 0;
+    auto [end, error] =
+        std::from_chars(_Str.data(), _Str.data() + _Str.size(), value);
+    if (error != std::errc{} || end != _Str.data() + _Str.size()) return false;
+
+    _Span = {value, value};
+    return true;
+}
+
+static bool ParseDateValue(StringView const& _Str, ValueSpan& _Span)
+{
+    using namespace std::chrono;
+
+    // YYYY, YYYY-MM or YYYY-MM-DD
+    StringVector parts = Strings::Split(_Str, '-');
+    if (parts.size() > 3) return false;
+
+    int values[3] = {0, 1, 1};
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        auto [end, error] = std::from_chars(
+            parts[i].data(), parts[i].data() + parts[i].size(), values[i]);
+        if (error != std::errc{} || end != parts[i].data() + parts[i].size())
+            return false;
+    }
+
+    year_month_day first{year(values[0]), month(unsigned(values[1])),
+                         day(unsigned(values[2]))};
+    if (!first.ok()) return false;
+
+    sys_days begin = first;
+    sys_days end   = begin + days(1);
+    if (parts.size() == 1) end = year_month_day(first + years(1));
+    else if (parts.size() == 2) end = year_month_day(first + months(1));
+
+    _Span = {duration_cast<seconds>(begin.time_since_epoch()).count(),
+             duration_cast<seconds>(end.time_since_epoch()).count() - 1};
+    return true;
+}
+
+/// @brief Parse an exact value, a comparison or a range into Min and Max of a
+/// term.
+static bool ParseRange(StringView const& _Value, ValueParser _Parser,
+                       Term& _Term)
+{
+    static constexpr auto MIN = std::numeric_limits<DB::INTEGER>::min();
+    static constexpr auto MAX = std::numeric_limits<DB::INTEGER>::max();
+
+    ValueSpan span;
+    if (auto dots = _Value.find(".."); dots != StringView::npos)
+    {
+        StringView first = _Value.substr(0, dots);
+        StringView last  = _Value.substr(dots + 2);
+        if (first.empty() && last.empty()) return false;
+
+        if (!first.empty() && !_Parser(first, span)) return false;
+        if (!first.empty()) _Term.Min = span.first;
+        if (!last.empty() && !_Parser(last, span)) return false;
+        if (!last.empty()) _Term.Max = span.second;
+        return true;
+    }
+
+    if (_Value.starts_with(">="))
+    {
+        if (!_Parser(_Value.substr(2), span)) return false;
+        _Term.Min = span.first;
+    }
+    else if (_Value.starts_with('>'))
+    {
+        if (!_Parser(_Value.substr(1), span) || span.second == MAX)
+            return false;
+        _Term.Min = span.second + 1;
+    }
+    else if (_Value.starts_with("<="))
+    {
+        if (!_Parser(_Value.substr(2), span)) return false;
+        _Term.Max = span.second;
+    }
+    else if (_Value.starts_with('<'))
+    {
+        if (!_Parser(_Value.substr(1), span) || span.first == MIN)
+            return false;
+        _Term.Max = span.first - 1;
+    }
+    else
+    {
+        if (!_Parser(_Value, span)) return false;
+        _Term.Min = span.first;
+        _Term.Max = span.second;
+    }
+    return true;
+}
+
+Expected<Optional<Term>> ParseMetatag(StringView const& _Token)
+{
+    auto colon = _Token.find(':');
+    if (colon == StringView::npos) return Optional<Term>{};
+
+    String name      = Strings::ToLower(_Token.substr(0, colon));
+    StringView value = _Token.substr(colon + 1);
+
+    Term term;
+    if (name == "rating")
+    {
+        static std::pair<char, Vector<DB::INTEGER>> const ratings[] = {
+            {'g', {DB::Entities::RATING_GENERAL}},
+            {'s', {DB::Entities::RATING_SENSITIVE}},
+            // questionable + unrated
+            {'q',
+             {DB::Entities::RATING_UNRATED, DB::Entities::RATING_QUESTIONABLE}},
+            {'e', {DB::Entities::RATING_EXPLICIT}},
+            {'u', {DB::Entities::RATING_UNRATED}},
+        };
+
+        // anything else is taken as a tag name
+        if (value.empty()) return Optional<Term>{};
+        for (auto const& [letter, values] : ratings)
+        {
+            if (::tolower(value.front()) != letter) continue;
+
+            term.Kind = Term::Type::Rating;
+            term.Ids  = values;
+            return Optional<Term>{term};
+        }
+        return Optional<Term>{};
+    }
+
+    if (name == "md5")
+    {
+        auto md5 = Strings::ParseHexArray<16>(value);
+        if (!md5) return ResultCode::InvalidRequest;
+
+        term.Kind   = Term::Type::MD5;
+        term.MD5Sum = md5.Value;
+        return Optional<Term>{term};
+    }
+
+    static std::tuple<StringView, StringView, ValueParser> const columns[] = {
+        {"score", "Score", ParseIntegerValue},
+        {"width", "Width", ParseIntegerValue},
+        {"height", "Height", ParseIntegerValue},
+        {"id", "Id", ParseIntegerValue},
+        {"date", "AddedTime", ParseDateValue},
+    };
+
+    for (auto const& [metatag, column, parser] : columns)
+    {
+        if (name != metatag) continue;
+
+        term.Kind   = Term::Type::Range;
+        term.Column = column;
+        if (!ParseRange(value, parser, term))
+        {
+            LOG_DEBUG("Invalid value for metatag {}: {}", name, value);
+            return ResultCode::InvalidRequest;
+        }
+        return Optional<Term>{term};
+    }
+    return Optional<Term>{};
+}
+
+} // namespace Booru::Search
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "compiler.hh"
+
+namespace Booru::Search
+{
+
+/// @brief Node of a parsed search query.
+///
+/// Terms are separated by spaces and all have to match. "or" between terms
+/// matches either side and binds weaker than the implicit "and". Parentheses
+/// group terms and have to be separated by spaces as well, since tag names may
+/// contain them. A "-" in front of a term or "-(" negates it.
+struct QueryNode
+{
+    enum class Type
+    {
+        And,  // all children have to match
+        Or,   // any child has to match
+        Token // a tag pattern or metatag in Value
+    };
+
+    Type Kind    = Type::And;
+    bool Negated = false;
+
+    /// Text of a token, without negation.
+    String Value;
+
+    Vector<QueryNode> Children;
+};
+
+/// @brief Check if a token is an operator of the query language rather than a
+/// term.
+bool IsQueryOperator(StringView const& _Token);
+
+/// @brief Parse a search query into a tree.
+/// @return Root node, InvalidRequest if the query is empty or its groups are
+/// not balanced.
+Expected<QueryNode> ParseQuery(StringView const& _QueryString);
+
+/// @brief Parse a metatag that only depends on the token itself:
+///
+///   rating:g|s|q|e|u         rating, only the first letter counts
+///   score:, width:, height:  Posts columns, eg. "score:>10", "width:>=1920"
+///   id:                      post id, eg. "id:100..200"
+///   date:                    AddedTime, eg. "date:2024-01..2024-06"
+///   md5:                     hexadecimal MD5 sum of the post
+///
+/// Numeric values are an exact value, a comparison (<, <=, >, >=) or an
+/// inclusive range "a..b" with either end optional. Dates are YYYY, YYYY-MM or
+/// YYYY-MM-DD in UTC and cover the whole year, month or day in Unix time.
+/// @return Term, nullopt if the token is no such metatag, InvalidRequest if
+/// its value is malformed.
+Expected<Optional<Term>> ParseMetatag(StringView const& _Token);
+
+} // namespace Booru::Search
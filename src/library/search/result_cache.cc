@@ -0,0 +1,252 @@
+#include "result_cache.hh"
+#include "query.hh"
+
+namespace Booru::Search
+{
+
+static constexpr auto LOGGER = "booru.search.cache";
+
+ResultCache::ResultCache(size_t _Capacity) { m_Stats.Capacity = _Capacity; }
+
+String ResultCache::MakeKey(StringView const& _QueryString)
+{
+    StringVector tokens = Strings::Split(Strings::ToLower(_QueryString));
+
+    // consecutive spaces produce empty tokens
+    std::erase_if(tokens, [](String const& _Token)
+                  { return _Token.empty() || _Token == "-"; });
+
+    // the order of grouped terms matters
+    if (std::ranges::any_of(tokens, IsQueryOperator))
+        return Strings::Join(tokens, " ");
+
+    std::ranges::sort(tokens);
+    tokens.erase(std::unique(std::begin(tokens), std::end(tokens)),
+                 std::end(tokens));
+    return Strings::Join(tokens, " ");
+}
+
+void ResultCache::Validate(uint64_t _RollbackCount)
+{
+    std::lock_guard lock(m_Mutex);
+    if (_RollbackCount == m_RollbackCount) return;
+
+    LOG_DEBUG("Transaction was rolled back, clearing search results");
+    m_RollbackCount = _RollbackCount;
+    ClearEntries();
+}
+
+uint64_t ResultCache::GetGeneration() const
+{
+    std::lock_guard lock(m_Mutex);
+    return m_Generation;
+}
+
+ResultCache::PostIds ResultCache::Find(String const& _Key)
+{
+    std::lock_guard lock(m_Mutex);
+    if (m_Stats.Capacity == 0) return nullptr;
+
+    auto cached = m_Index.find(_Key);
+    if (cached == std::end(m_Index))
+    {
+        m_Stats.Misses++;
+        return nullptr;
+    }
+
+    m_Stats.Hits++;
+    m_Entries.splice(std::begin(m_Entries), m_Entries, cached->second);
+    return cached->second->PostIds;
+}
+
+ResultCache::PostIds ResultCache::Insert(String const& _Key,
+                                         Vector<DB::INTEGER> _PostIds,
+                                         Vector<Term> const& _Terms,
+                                         Optional<uint64_t> _Generation)
+{
+    std::ranges::sort(_PostIds);
+    auto postIds = MakeShared<Vector<DB::INTEGER> const>(std::move(_PostIds));
+
+    std::lock_guard lock(m_Mutex);
+    if (m_Stats.Capacity == 0 || _Generation != m_Generation) return postIds;
+
+    // replace a result that was inserted in the meantime
+    auto cached = m_Index.find(_Key);
+    if (cached != std::end(m_Index))
+    {
+        m_Entries.erase(cached->second);
+        m_Index.erase(cached);
+    }
+
+    Entry entry;
+    entry.Key             = _Key;
+    entry.PostIds         = postIds;
+    entry.MatchesUntagged = true;
+
+    for (auto const& term : _Terms)
+    {
+        if (term.Kind == Term::Type::Tags && !term.Negated)
+            entry.MatchesUntagged = false;
+    }
+    AddTerms(entry, _Terms);
+    std::ranges::sort(entry.TagIds);
+
+    m_Entries.push_front(std::move(entry));
+    m_Index.emplace(m_Entries.front().Key, std::begin(m_Entries));
+    Trim();
+    return postIds;
+}
+
+ResultCache::SortKeys ResultCache::FindSortKeys(String const& _Key,
+                                                PostOrder _Order)
+{
+    std::lock_guard lock(m_Mutex);
+    auto cached = m_Index.find(_Key);
+    if (cached == std::end(m_Index)) return nullptr;
+
+    auto& sortKeys = cached->second->SortKeys;
+    auto found     = sortKeys.find(_Order);
+    return found == std::end(sortKeys) ? nullptr : found->second;
+}
+
+ResultCache::SortKeys
+ResultCache::InsertSortKeys(String const& _Key, PostOrder _Order,
+                            Vector<PageKey> _Keys,
+                            Optional<uint64_t> _Generation)
+{
+    auto sortKeys = MakeShared<Vector<PageKey> const>(std::move(_Keys));
+
+    std::lock_guard lock(m_Mutex);
+    auto cached = m_Index.find(_Key);
+    if (cached == std::end(m_Index) || _Generation != m_Generation)
+        return sortKeys;
+
+    m_Stats.SortKeyLoads++;
+    cached->second->SortKeys[_Order] = sortKeys;
+    return sortKeys;
+}
+
+void ResultCache::AddTerms(Entry& _Entry, Vector<Term> const& _Terms)
+{
+    for (auto const& term : _Terms)
+    {
+        switch (term.Kind)
+        {
+        case Term::Type::Tags:
+            _Entry.HasTagTerms = true;
+            _Entry.TagIds.insert(std::end(_Entry.TagIds), std::begin(term.Ids),
+                                 std::end(term.Ids));
+            break;
+
+        case Term::Type::Any:
+            for (auto const& terms : term.Alternatives)
+                AddTerms(_Entry, terms);
+            break;
+
+        case Term::Type::Rating:
+        case Term::Type::Range:
+        case Term::Type::MD5:
+            _Entry.HasColumnTerms = true;
+            break;
+        }
+    }
+}
+
+void ResultCache::Clear()
+{
+    std::lock_guard lock(m_Mutex);
+    ClearEntries();
+}
+
+void ResultCache::SetCapacity(size_t _Capacity)
+{
+    std::lock_guard lock(m_Mutex);
+    m_Stats.Capacity = _Capacity;
+    Trim();
+}
+
+ResultCacheStats ResultCache::GetStats() const
+{
+    std::lock_guard lock(m_Mutex);
+    return m_Stats;
+}
+
+void ResultCache::ClearEntries()
+{
+    m_Generation++;
+    m_Stats.Invalidations += m_Entries.size();
+    m_Index.clear();
+    m_Entries.clear();
+    m_Stats.Size = 0;
+}
+
+void ResultCache::Trim()
+{
+    while (m_Entries.size() > m_Stats.Capacity)
+    {
+        m_Index.erase(m_Entries.back().Key);
+        m_Entries.pop_back();
+        m_Stats.Evictions++;
+    }
+    m_Stats.Size = m_Entries.size();
+}
+
+template <class TPredicate> void ResultCache::Invalidate(TPredicate _Predicate)
+{
+    m_Generation++;
+    for (auto it = std::begin(m_Entries); it != std::end(m_Entries);)
+    {
+        if (!_Predicate(*it))
+        {
+            it++;
+            continue;
+        }
+
+        m_Index.erase(it->Key);
+        it = m_Entries.erase(it);
+        m_Stats.Invalidations++;
+    }
+    m_Stats.Size = m_Entries.size();
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Invalidation
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+void ResultCache::OnPostCreated()
+{
+    std::lock_guard lock(m_Mutex);
+    Invalidate([](Entry const& _Entry) { return _Entry.MatchesUntagged; });
+}
+
+void ResultCache::OnPostUpdated()
+{
+    std::lock_guard lock(m_Mutex);
+    Invalidate([](Entry const& _Entry) { return _Entry.HasColumnTerms; });
+
+    // the matches stay the same, but sort keys may have changed
+    for (auto& entry : m_Entries) entry.SortKeys.clear();
+}
+
+void ResultCache::OnPostDeleted(DB::INTEGER _PostId)
+{
+    std::lock_guard lock(m_Mutex);
+    Invalidate(
+        [&](Entry const& _Entry)
+        { return std::ranges::binary_search(*_Entry.PostIds, _PostId); });
+}
+
+void ResultCache::OnPostTagsChanged(DB::INTEGER _TagId)
+{
+    std::lock_guard lock(m_Mutex);
+    Invalidate([&](Entry const& _Entry)
+               { return std::ranges::binary_search(_Entry.TagIds, _TagId); });
+}
+
+void ResultCache::OnTagsChanged()
+{
+    std::lock_guard lock(m_Mutex);
+    Invalidate([](Entry const& _Entry) { return _Entry.HasTagTerms; });
+}
+
+} // namespace Booru::Search
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <booru/db/types.hh>
+#include <booru/search.hh>
+
+#include "compiler.hh"
+#include "page.hh"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace Booru::Search
+{
+
+/// @brief Bounded cache of search results, keyed by normalized query. Each
+/// result remembers what it was computed from, so writes only drop the
+/// results they can actually change.
+///
+/// Searches of several threads may use it at once. Results are shared, so they
+/// stay valid when they are dropped from the cache.
+class ResultCache
+{
+  public:
+    static constexpr size_t DEFAULT_CAPACITY = 256;
+
+    using PostIds  = Shared<Vector<DB::INTEGER> const>;
+    using SortKeys = Shared<Vector<PageKey> const>;
+
+    explicit ResultCache(size_t _Capacity = DEFAULT_CAPACITY);
+
+    /// @brief Normalize a search query: lower case, sorted, no duplicates.
+    /// Queries that only differ in term order or spacing get the same key.
+    /// Queries with groups or "or" keep their order.
+    static String MakeKey(StringView const& _QueryString);
+
+    /// @brief Drop all results if a transaction was rolled back since the
+    /// last call, results may contain changes that were undone.
+    void Validate(uint64_t _RollbackCount);
+
+    /// @brief Get a counter of changes that dropped results. Read it before
+    /// evaluating a query, a result that may have missed a change is not
+    /// cached.
+    uint64_t GetGeneration() const;
+
+    /// @brief Find cached post ids for a query key. Counts a hit or miss.
+    /// @return Post ids in ascending order or nullptr.
+    PostIds Find(String const& _Key);
+
+    /// @brief Cache post ids of a query evaluated from _Terms, unless results
+    /// were dropped since _Generation or it is unset.
+    /// @return The post ids in ascending order.
+    PostIds Insert(String const& _Key, Vector<DB::INTEGER> _PostIds,
+                   Vector<Term> const& _Terms, Optional<uint64_t> _Generation);
+
+    /// @brief Find the sort keys of a cached result, see LoadPageKeys(). Does
+    /// not count as a hit or miss.
+    /// @return Keys in ascending order or nullptr.
+    SortKeys FindSortKeys(String const& _Key, PostOrder _Order);
+
+    /// @brief Keep the sort keys of a cached result, so pages in that order
+    /// are cut out without reading all matches again. Same as Insert(), keys
+    /// read before a change are not kept.
+    /// @return The keys.
+    SortKeys InsertSortKeys(String const& _Key, PostOrder _Order,
+                            Vector<PageKey> _Keys,
+                            Optional<uint64_t> _Generation);
+
+    void Clear();
+    void SetCapacity(size_t _Capacity);
+    ResultCacheStats GetStats() const;
+
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+    // Invalidation
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+
+    /// @brief A new post without tags exists.
+    void OnPostCreated();
+
+    /// @brief The rating or other columns of a post may have changed.
+    void OnPostUpdated();
+
+    /// @brief A post and its tags were removed.
+    void OnPostDeleted(DB::INTEGER _PostId);
+
+    /// @brief Posts were added to or removed from a tag.
+    void OnPostTagsChanged(DB::INTEGER _TagId);
+
+    /// @brief Tags were created or renamed, tag names may match other tags.
+    void OnTagsChanged();
+
+  private:
+    struct Entry
+    {
+        String Key;
+        ResultCache::PostIds PostIds;
+
+        /// Sort keys of the posts by order, loaded for pages.
+        std::unordered_map<PostOrder, ResultCache::SortKeys> SortKeys;
+
+        /// Ids of all tags in tag terms, sorted.
+        Vector<DB::INTEGER> TagIds;
+
+        bool HasTagTerms    = false;
+        bool HasColumnTerms = false;
+
+        /// True if a post without tags can match, ie. there is no positive tag
+        /// term.
+        bool MatchesUntagged = false;
+    };
+    using EntryList = std::list<Entry>;
+
+    /// @brief Note what terms an entry depends on.
+    static void AddTerms(Entry& _Entry, Vector<Term> const& _Terms);
+
+    /// @brief Drop all entries.
+    void ClearEntries();
+
+    /// @brief Drop all entries matching a predicate.
+    template <class TPredicate> void Invalidate(TPredicate _Predicate);
+
+    /// @brief Evict least recently used entries until within capacity.
+    void Trim();
+
+    /// Cached results, most recently used first.
+    EntryList m_Entries;
+
+    /// Lookup of entries by key. Keys point into m_Entries.
+    std::unordered_map<StringView, EntryList::iterator> m_Index;
+
+    ResultCacheStats m_Stats;
+    uint64_t m_RollbackCount = 0;
+    uint64_t m_Generation    = 0;
+
+    mutable std::mutex m_Mutex;
+};
+
+} // namespace Booru::Search
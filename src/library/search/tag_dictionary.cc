@@ -0,0 +1,808 @@
+#include "tag_dictionary.hh"
+#include "intersect.hh"
+
+#include <booru/db/stmt.hh>
+
+#include <numeric>
+#include <queue>
+
+namespace Booru::Search
+{
+
+static constexpr auto LOGGER = "booru.search.dictionary";
+
+/// Pending tags are merged into the sorted array when there are more of them
+/// than this, or than an eighth of the array.
+static constexpr size_t MIN_PENDING_TAGS = 256;
+
+/// @brief Piece of a parsed name pattern.
+struct TagPatternToken
+{
+    enum class Type
+    {
+        Char,
+        AnyChar,
+        AnySequence,
+    };
+
+    Type Kind  = Type::Char;
+    char Value = 0;
+};
+
+/// @brief Name pattern split into the literal prefix before the first wildcard
+/// and the rest.
+struct TagPattern
+{
+    String Prefix;
+    Vector<TagPatternToken> Rest;
+};
+
+static uint32_t MakeTrigram(StringView const& _Text, size_t _Pos)
+{
+    return uint32_t(uint8_t(_Text[_Pos])) << 16 |
+           uint32_t(uint8_t(_Text[_Pos + 1])) << 8 |
+           uint32_t(uint8_t(_Text[_Pos + 2]));
+}
+
+/// @brief Lower case like SQL LIKE, which only folds ASCII letters.
+static char ToLowerAscii(char _Char)
+{
+    return _Char >= 'A' && _Char <= 'Z' ? char(_Char - 'A' + 'a') : _Char;
+}
+
+static String ToKey(StringView const& _Name)
+{
+    String key{_Name};
+    std::ranges::transform(key, std::begin(key), ToLowerAscii);
+    return key;
+}
+
+static TagPattern ParsePattern(StringView const& _Pattern)
+{
+    TagPattern pattern;
+    for (size_t i = 0; i < _Pattern.size(); i++)
+    {
+        TagPatternToken token;
+        if (_Pattern[i] == '\\')
+        {
+            // escaped character is taken literally, a trailing escape ignored
+            if (++i == _Pattern.size()) break;
+            token.Value = ToLowerAscii(_Pattern[i]);
+        }
+        else if (_Pattern[i] == '*')
+            token.Kind = TagPatternToken::Type::AnySequence;
+        else if (_Pattern[i] == '?')
+            token.Kind = TagPatternToken::Type::AnyChar;
+        else token.Value = ToLowerAscii(_Pattern[i]);
+
+        if (pattern.Rest.empty() && token.Kind == TagPatternToken::Type::Char)
+            pattern.Prefix += token.Value;
+        else pattern.Rest.push_back(token);
+    }
+    return pattern;
+}
+
+/// @brief Distinct trigrams of the literal parts of a pattern.
+static Vector<uint32_t> GetTrigrams(TagPattern const& _Pattern)
+{
+    Vector<uint32_t> trigrams;
+    auto addRun = [&](StringView const& _Run)
+    {
+        for (size_t i = 0; i + 3 <= _Run.size(); i++)
+            trigrams.push_back(MakeTrigram(_Run, i));
+    };
+
+    // runs of literal characters between wildcards
+    String run = _Pattern.Prefix;
+    for (auto const& token : _Pattern.Rest)
+    {
+        if (token.Kind == TagPatternToken::Type::Char)
+        {
+            run += token.Value;
+            continue;
+        }
+        addRun(run);
+        run.clear();
+    }
+    addRun(run);
+
+    std::ranges::sort(trigrams);
+    trigrams.erase(std::unique(std::begin(trigrams), std::end(trigrams)),
+                   std::end(trigrams));
+    return trigrams;
+}
+
+/// @brief Position of the next UTF-8 character.
+static size_t NextChar(StringView const& _Text, size_t _Pos)
+{
+    for (_Pos++; _Pos < _Text.size(); _Pos++)
+    {
+        if ((uint8_t(_Text[_Pos]) & 0xc0) != 0x80) break;
+    }
+    return _Pos;
+}
+
+/// @brief Match a key against pattern tokens. Backtracks to the last "*"
+/// only, which is enough as earlier ones could not match more.
+static bool MatchTokens(Vector<TagPatternToken> const& _Tokens,
+                        StringView const& _Key)
+{
+    using Type       = TagPatternToken::Type;
+
+    size_t token     = 0;
+    size_t pos       = 0;
+    size_t starToken = _Tokens.size();
+    size_t starPos   = 0;
+    while (pos < _Key.size())
+    {
+        if (token < _Tokens.size())
+        {
+            auto const& current = _Tokens[token];
+            if (current.Kind == Type::AnySequence)
+            {
+                starToken = token++;
+                starPos   = pos;
+                continue;
+            }
+            if (current.Kind == Type::AnyChar)
+            {
+                token++;
+                pos = NextChar(_Key, pos);
+                continue;
+            }
+            if (current.Value == _Key[pos])
+            {
+                token++;
+                pos++;
+                continue;
+            }
+        }
+
+        // let the last "*" swallow one more character
+        if (starToken == _Tokens.size()) return false;
+        starPos = NextChar(_Key, starPos);
+        token   = starToken + 1;
+        pos     = starPos;
+    }
+
+    while (token < _Tokens.size() && _Tokens[token].Kind == Type::AnySequence)
+        token++;
+    return token == _Tokens.size();
+}
+
+/// @brief Compute the row of the edit distance matrix of _Text against a key
+/// after _Char, the key's character at _Depth. Cells further than _Max off the
+/// diagonal can't get back within _Max and are not computed, values above
+/// _Max are clamped.
+/// @return Smallest value of the row, a lower bound for any continuation.
+static size_t NextDistanceRow(StringView const& _Text, char _Char,
+                              size_t _Depth, size_t _Max,
+                              Span<uint32_t const> _Previous,
+                              Span<uint32_t> _Row)
+{
+    uint32_t limit = uint32_t(_Max + 1);
+    size_t row     = _Depth + 1;
+    size_t first   = row > _Max ? row - _Max : 0;
+    size_t last    = std::min(_Text.size(), row + _Max);
+
+    // the cells next to the band are read by the next row
+    if (first > 0) _Row[first - 1] = limit;
+    if (last < _Text.size())
+    {
+        _Row[last + 1]     = limit;
+        _Row[_Text.size()] = limit;
+    }
+
+    size_t best = limit;
+    for (size_t i = first; i <= last; i++)
+    {
+        uint32_t value = _Previous[0] + 1;
+        if (i > 0)
+        {
+            uint32_t substitute = _Previous[i - 1] + (_Text[i - 1] != _Char);
+            value = std::min({_Previous[i] + 1, _Row[i - 1] + 1, substitute});
+        }
+        _Row[i] = std::min(value, limit);
+        best    = std::min<size_t>(best, _Row[i]);
+    }
+    return best;
+}
+
+/// @brief Edit distance between two keys, or a value above _Max if it
+/// exceeds _Max.
+static size_t GetEditDistance(StringView const& _A, StringView const& _B,
+                              size_t _Max)
+{
+    Vector<uint32_t> previous(_A.size() + 1), row(_A.size() + 1);
+    std::iota(std::begin(previous), std::end(previous), 0);
+    for (size_t i = 0; i < _B.size(); i++)
+    {
+        if (NextDistanceRow(_A, _B[i], i, _Max, previous, row) > _Max)
+            return _Max + 1;
+        std::swap(previous, row);
+    }
+    return previous.back();
+}
+
+/// @brief Call _Func for each pending tag whose key matches a pattern.
+template <class TPending, class TFunc>
+static void ForEachMatch(TPending const& _Pending, TagPattern const& _Pattern,
+                         TFunc _Func)
+{
+    auto it = _Pending.lower_bound(
+        {_Pattern.Prefix, std::numeric_limits<DB::INTEGER>::min()});
+    for (; it != std::end(_Pending); it++)
+    {
+        StringView key = it->first.first;
+        if (!key.starts_with(_Pattern.Prefix)) break;
+
+        if (MatchTokens(_Pattern.Rest, key.substr(_Pattern.Prefix.size())))
+            _Func(it->second);
+    }
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Building
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+ResultCode TagDictionary::Build(DB::DBPtr _DB)
+{
+    LOG_INFO("Building tag dictionary...");
+
+    m_IsValid = false;
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        stmt, _DB->PrepareStatement("SELECT Id, Name, PostCount FROM Tags"));
+
+    Vector<PendingTag> tags;
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(step, stmt.Value->StepQuery());
+    while (step != ResultCode::DatabaseEnd)
+    {
+        PendingTag& tag = tags.emplace_back();
+        CHECK_RETURN_RESULT_ON_ERROR(stmt.Value->GetColumnValue(0, tag.TagId));
+        CHECK_RETURN_RESULT_ON_ERROR(stmt.Value->GetColumnValue(1, tag.Name));
+        CHECK_RETURN_RESULT_ON_ERROR(
+            stmt.Value->GetColumnValue(2, tag.PostCount));
+
+        step = stmt.Value->StepQuery();
+        CHECK_RETURN_RESULT_ON_ERROR(step);
+    }
+
+    Assign(std::move(tags));
+    m_RollbackCount  = _DB->GetRollbackCount();
+    m_IsValid        = true;
+    m_HasValidCounts = true;
+
+    LOG_INFO("Tag dictionary contains {} tags, using {} bytes.", GetSize(),
+             GetMemoryUsage());
+    return ResultCode::OK;
+}
+
+bool TagDictionary::IsValid(DB::DBPtr const& _DB) const
+{
+    return m_IsValid && _DB && _DB->GetRollbackCount() == m_RollbackCount;
+}
+
+void TagDictionary::Assign(Vector<PendingTag> _Tags)
+{
+    Vector<String> keys;
+    keys.reserve(_Tags.size());
+    for (auto const& tag : _Tags)
+        keys.push_back(ToKey(tag.Name));
+
+    Vector<uint32_t> order(_Tags.size());
+    std::iota(std::begin(order), std::end(order), 0);
+    std::ranges::sort(order,
+                      [&](uint32_t _A, uint32_t _B)
+                      {
+                          if (keys[_A] != keys[_B]) return keys[_A] < keys[_B];
+                          return _Tags[_A].TagId < _Tags[_B].TagId;
+                      });
+
+    m_Strings.clear();
+    m_Entries.clear();
+    m_Counts.clear();
+    m_EntryById.clear();
+    m_Pending.clear();
+    m_PendingKeys.clear();
+    m_RemovedCount = 0;
+
+    m_Entries.reserve(_Tags.size());
+    m_Counts.reserve(_Tags.size());
+    for (uint32_t index : order)
+    {
+        PendingTag const& tag = _Tags[index];
+        String const& key     = keys[index];
+
+        Entry entry;
+        entry.KeyOffset  = uint32_t(m_Strings.size());
+        entry.KeyLength  = uint32_t(key.size());
+        entry.NameOffset = entry.KeyOffset;
+        entry.NameLength = entry.KeyLength;
+        entry.TagId      = tag.TagId;
+        m_Strings.append(key);
+
+        // most names already are lower case
+        if (tag.Name != key)
+        {
+            entry.NameOffset = uint32_t(m_Strings.size());
+            m_Strings.append(tag.Name);
+        }
+
+        m_EntryById[tag.TagId] = uint32_t(m_Entries.size());
+        m_Entries.push_back(entry);
+        m_Counts.push_back(tag.PostCount);
+    }
+    m_Strings.shrink_to_fit();
+
+    // leaves are the entries themselves, inner nodes are filled bottom up
+    size_t size = m_Entries.size();
+    m_MaxTree.assign(2 * size, 0);
+    for (size_t i = 0; i < size; i++)
+        m_MaxTree[size + i] = uint32_t(i);
+    for (size_t node = size; node-- > 1;)
+    {
+        m_MaxTree[node] =
+            uint32_t(GetBetter(m_MaxTree[2 * node], m_MaxTree[2 * node + 1]));
+    }
+
+    BuildTrigrams();
+}
+
+void TagDictionary::BuildTrigrams()
+{
+    // trigram in the upper, entry index in the lower half, so sorting groups
+    // the postings of each trigram in ascending order
+    Vector<uint64_t> pairs;
+    for (uint32_t i = 0; i < m_Entries.size(); i++)
+    {
+        StringView key = GetKey(m_Entries[i]);
+        for (size_t pos = 0; pos + 3 <= key.size(); pos++)
+            pairs.push_back(uint64_t(MakeTrigram(key, pos)) << 32 | i);
+    }
+    std::ranges::sort(pairs);
+    pairs.erase(std::unique(std::begin(pairs), std::end(pairs)),
+                std::end(pairs));
+
+    m_Trigrams.clear();
+    m_TrigramOffsets.clear();
+    m_TrigramPostings.clear();
+    m_TrigramPostings.reserve(pairs.size());
+    for (uint64_t pair : pairs)
+    {
+        uint32_t trigram = uint32_t(pair >> 32);
+        if (m_Trigrams.empty() || m_Trigrams.back() != trigram)
+        {
+            m_Trigrams.push_back(trigram);
+            m_TrigramOffsets.push_back(uint32_t(m_TrigramPostings.size()));
+        }
+        m_TrigramPostings.push_back(uint32_t(pair));
+    }
+    m_TrigramOffsets.push_back(uint32_t(m_TrigramPostings.size()));
+
+    m_Trigrams.shrink_to_fit();
+    m_TrigramOffsets.shrink_to_fit();
+}
+
+void TagDictionary::CompactIfNeeded()
+{
+    size_t changes = m_Pending.size() + m_RemovedCount;
+    if (changes <= std::max(MIN_PENDING_TAGS, m_Entries.size() / 8)) return;
+
+    LOG_DEBUG("Merging {} changes into tag dictionary", changes);
+
+    Vector<PendingTag> tags;
+    tags.reserve(GetSize());
+    for (size_t i = 0; i < m_Entries.size(); i++)
+    {
+        if (m_Counts[i] < 0) continue;
+        tags.push_back(
+            {m_Entries[i].TagId, String(GetName(m_Entries[i])), m_Counts[i]});
+    }
+    for (auto& [key, tag] : m_Pending)
+        tags.push_back(std::move(tag));
+
+    Assign(std::move(tags));
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Incremental updates
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+void TagDictionary::AddTag(DB::INTEGER _TagId, StringView const& _Name,
+                           DB::INTEGER _PostCount)
+{
+    RemoveTag(_TagId);
+
+    String key = ToKey(_Name);
+    m_Pending[{key, _TagId}] = {_TagId, String(_Name), _PostCount};
+    m_PendingKeys[_TagId]    = std::move(key);
+    CompactIfNeeded();
+}
+
+void TagDictionary::RenameTag(DB::INTEGER _TagId, StringView const& _Name)
+{
+    DB::INTEGER postCount = 0;
+    if (auto pending = m_PendingKeys.find(_TagId);
+        pending != std::end(m_PendingKeys))
+    {
+        postCount = m_Pending[{pending->second, _TagId}].PostCount;
+    }
+    else if (auto entry = m_EntryById.find(_TagId);
+             entry != std::end(m_EntryById))
+    {
+        postCount = m_Counts[entry->second];
+    }
+    AddTag(_TagId, _Name, postCount);
+}
+
+void TagDictionary::RemoveTag(DB::INTEGER _TagId)
+{
+    if (auto pending = m_PendingKeys.find(_TagId);
+        pending != std::end(m_PendingKeys))
+    {
+        m_Pending.erase({pending->second, _TagId});
+        m_PendingKeys.erase(pending);
+    }
+    else if (auto entry = m_EntryById.find(_TagId);
+             entry != std::end(m_EntryById))
+    {
+        SetCount(entry->second, -1);
+        m_EntryById.erase(entry);
+        m_RemovedCount++;
+    }
+}
+
+void TagDictionary::AddPostCount(DB::INTEGER _TagId, DB::INTEGER _Delta)
+{
+    if (auto pending = m_PendingKeys.find(_TagId);
+        pending != std::end(m_PendingKeys))
+    {
+        m_Pending[{pending->second, _TagId}].PostCount += _Delta;
+    }
+    else if (auto entry = m_EntryById.find(_TagId);
+             entry != std::end(m_EntryById))
+    {
+        SetCount(entry->second, m_Counts[entry->second] + _Delta);
+    }
+}
+
+void TagDictionary::SetCount(size_t _Index, DB::INTEGER _PostCount)
+{
+    m_Counts[_Index] = _PostCount;
+
+    size_t size      = m_Entries.size();
+    for (size_t node = (size + _Index) / 2; node > 0; node /= 2)
+    {
+        m_MaxTree[node] =
+            uint32_t(GetBetter(m_MaxTree[2 * node], m_MaxTree[2 * node + 1]));
+    }
+}
+
+// ////////////////////////////////////////////////////////////////////////////////////////////
+// Queries
+// ////////////////////////////////////////////////////////////////////////////////////////////
+
+StringView TagDictionary::GetKey(Entry const& _Entry) const
+{
+    return StringView(m_Strings).substr(_Entry.KeyOffset, _Entry.KeyLength);
+}
+
+StringView TagDictionary::GetName(Entry const& _Entry) const
+{
+    return StringView(m_Strings).substr(_Entry.NameOffset, _Entry.NameLength);
+}
+
+std::pair<size_t, size_t>
+TagDictionary::FindPrefixRange(StringView const& _Prefix) const
+{
+    // keys with a common prefix are adjacent, starting at the prefix itself
+    auto first = std::ranges::partition_point(
+        m_Entries,
+        [&](Entry const& _Entry) { return GetKey(_Entry) < _Prefix; });
+    auto last = std::partition_point(
+        first, std::end(m_Entries), [&](Entry const& _Entry)
+        { return GetKey(_Entry).starts_with(_Prefix); });
+
+    return {size_t(first - std::begin(m_Entries)),
+            size_t(last - std::begin(m_Entries))};
+}
+
+size_t TagDictionary::SkipPrefix(size_t _Index, StringView const& _Prefix) const
+{
+    auto hasPrefix = [&](Entry const& _Entry)
+    { return GetKey(_Entry).starts_with(_Prefix); };
+
+    // gallop ahead first, most prefixes only span a few entries
+    size_t step = 1;
+    while (_Index + step < m_Entries.size() &&
+           hasPrefix(m_Entries[_Index + step]))
+    {
+        _Index += step;
+        step   *= 2;
+    }
+
+    auto first = std::begin(m_Entries) + _Index + 1;
+    auto last  = std::begin(m_Entries) +
+                std::min(_Index + step, m_Entries.size());
+    return size_t(std::partition_point(first, last, hasPrefix) -
+                  std::begin(m_Entries));
+}
+
+size_t TagDictionary::GetBetter(size_t _A, size_t _B) const
+{
+    if (m_Counts[_B] != m_Counts[_A])
+        return m_Counts[_B] > m_Counts[_A] ? _B : _A;
+    return std::min(_A, _B);
+}
+
+size_t TagDictionary::FindMaxCount(size_t _First, size_t _Last) const
+{
+    size_t size = m_Entries.size();
+    size_t best = _First;
+    for (size_t first = _First + size, last = _Last + size; first < last;
+         first /= 2, last /= 2)
+    {
+        if (first & 1) best = GetBetter(best, m_MaxTree[first++]);
+        if (last & 1) best = GetBetter(best, m_MaxTree[--last]);
+    }
+    return best;
+}
+
+Optional<Vector<uint32_t>>
+TagDictionary::FindTrigramCandidates(Vector<uint32_t> const& _Trigrams,
+                                     size_t _First, size_t _Last) const
+{
+    if (_Trigrams.empty()) return std::nullopt;
+
+    Vector<Span<uint32_t const>> postings;
+    for (uint32_t trigram : _Trigrams)
+    {
+        auto it = std::ranges::lower_bound(m_Trigrams, trigram);
+        if (it == std::end(m_Trigrams) || *it != trigram)
+            return Vector<uint32_t>{};
+
+        size_t index = size_t(it - std::begin(m_Trigrams));
+        postings.emplace_back(
+            m_TrigramPostings.data() + m_TrigramOffsets[index],
+            m_TrigramOffsets[index + 1] - m_TrigramOffsets[index]);
+    }
+
+    // a short prefix range is cheaper to scan than long postings
+    std::ranges::sort(postings, {}, &Span<uint32_t const>::size);
+    if (postings.front().size() >= _Last - _First) return std::nullopt;
+
+    // rarest trigram first keeps the intermediate results small
+    Vector<uint32_t> candidates(std::begin(postings.front()),
+                                std::end(postings.front()));
+    Vector<uint32_t> buffer(candidates.size());
+    for (size_t i = 1; i < postings.size() && !candidates.empty(); i++)
+    {
+        size_t count = Intersect(candidates, postings[i], buffer);
+        buffer.resize(count);
+        std::swap(candidates, buffer);
+        buffer.resize(candidates.size());
+    }
+
+    std::erase_if(candidates, [&](uint32_t _Index)
+                  { return _Index < _First || _Index >= _Last; });
+    return candidates;
+}
+
+Vector<uint32_t> TagDictionary::MatchEntries(TagPattern const& _Pattern) const
+{
+    Vector<uint32_t> entries;
+    auto check = [&](size_t _Index)
+    {
+        StringView rest =
+            GetKey(m_Entries[_Index]).substr(_Pattern.Prefix.size());
+        if (m_Counts[_Index] >= 0 && MatchTokens(_Pattern.Rest, rest))
+            entries.push_back(uint32_t(_Index));
+    };
+
+    auto [first, last] = FindPrefixRange(_Pattern.Prefix);
+    auto candidates = FindTrigramCandidates(GetTrigrams(_Pattern), first, last);
+    if (candidates)
+    {
+        for (uint32_t index : *candidates)
+            check(index);
+    }
+    else
+    {
+        for (size_t i = first; i < last; i++)
+            check(i);
+    }
+    return entries;
+}
+
+Vector<DB::INTEGER> TagDictionary::Match(StringView const& _Pattern) const
+{
+    TagPattern pattern = ParsePattern(_Pattern);
+
+    Vector<DB::INTEGER> tagIds;
+    for (uint32_t index : MatchEntries(pattern))
+        tagIds.push_back(m_Entries[index].TagId);
+
+    ForEachMatch(m_Pending, pattern, [&](PendingTag const& _Tag)
+                 { tagIds.push_back(_Tag.TagId); });
+    return tagIds;
+}
+
+Vector<TagCompletion> TagDictionary::Complete(StringView const& _Pattern,
+                                              size_t _Limit) const
+{
+    TagPattern pattern = ParsePattern(_Pattern);
+    bool isPrefix      = pattern.Rest.empty();
+    pattern.Rest.push_back({TagPatternToken::Type::AnySequence});
+
+    Vector<TagCompletion> completions;
+    auto add = [&](size_t _Index)
+    {
+        Entry const& entry = m_Entries[_Index];
+        completions.push_back(
+            {entry.TagId, String(GetName(entry)), m_Counts[_Index]});
+    };
+
+    auto [first, last] = FindPrefixRange(pattern.Prefix);
+    if (isPrefix)
+    {
+        // repeatedly take the best entry of a range and split the range there,
+        // only visits about _Limit entries
+        struct Candidate
+        {
+            size_t Best, First, Last;
+        };
+        auto isWorse = [this](Candidate const& _A, Candidate const& _B)
+        {
+            return _A.Best != _B.Best &&
+                   GetBetter(_A.Best, _B.Best) == _B.Best;
+        };
+
+        std::priority_queue<Candidate, Vector<Candidate>, decltype(isWorse)>
+            candidates(isWorse);
+        if (first < last)
+            candidates.push({FindMaxCount(first, last), first, last});
+
+        while (!candidates.empty() && completions.size() < _Limit)
+        {
+            Candidate candidate = candidates.top();
+            candidates.pop();
+            if (m_Counts[candidate.Best] < 0) break;
+
+            add(candidate.Best);
+            if (candidate.First < candidate.Best)
+            {
+                candidates.push({FindMaxCount(candidate.First, candidate.Best),
+                                 candidate.First, candidate.Best});
+            }
+            if (candidate.Best + 1 < candidate.Last)
+            {
+                candidates.push(
+                    {FindMaxCount(candidate.Best + 1, candidate.Last),
+                     candidate.Best + 1, candidate.Last});
+            }
+        }
+    }
+    else
+    {
+        for (uint32_t index : MatchEntries(pattern))
+            add(index);
+    }
+
+    ForEachMatch(m_Pending, pattern,
+                 [&](PendingTag const& _Tag) {
+                     completions.push_back(
+                         {_Tag.TagId, _Tag.Name, _Tag.PostCount});
+                 });
+
+    auto byCount = [](TagCompletion const& _A, TagCompletion const& _B)
+    {
+        if (_A.PostCount != _B.PostCount) return _A.PostCount > _B.PostCount;
+        return _A.Name < _B.Name;
+    };
+    size_t count = std::min(_Limit, completions.size());
+    std::ranges::partial_sort(completions, std::begin(completions) + count,
+                              byCount);
+    completions.resize(count);
+    return completions;
+}
+
+Vector<TagSuggestion> TagDictionary::Suggest(StringView const& _Name,
+                                             size_t _MaxDistance,
+                                             size_t _Limit) const
+{
+    String name  = ToKey(_Name);
+    size_t width = name.size() + 1;
+
+    // the sorted keys form an implicit trie: one row of the distance matrix
+    // per character, rows of the prefix shared with the previous key are
+    // reused and prefixes that are already too far away are skipped entirely
+    Vector<uint32_t> rows(width);
+    std::iota(std::begin(rows), std::end(rows), 0);
+    auto getRow = [&](size_t _Depth)
+    { return Span<uint32_t>(rows).subspan(_Depth * width, width); };
+
+    Vector<TagSuggestion> suggestions;
+    StringView previous;
+    size_t validDepth = 0;
+    for (size_t i = 0; i < m_Entries.size();)
+    {
+        StringView key = GetKey(m_Entries[i]);
+        size_t depth   = 0;
+        while (depth < validDepth && depth < key.size() &&
+               key[depth] == previous[depth])
+        {
+            depth++;
+        }
+
+        if (rows.size() < (key.size() + 1) * width)
+            rows.resize((key.size() + 1) * width);
+
+        bool pruned = false;
+        for (; depth < key.size(); depth++)
+        {
+            if (NextDistanceRow(name, key[depth], depth, _MaxDistance,
+                                getRow(depth), getRow(depth + 1)) <=
+                _MaxDistance)
+            {
+                continue;
+            }
+
+            // no key starting like this can get close enough
+            i      = SkipPrefix(i, key.substr(0, depth + 1));
+            pruned = true;
+            break;
+        }
+
+        previous   = key;
+        validDepth = depth;
+        if (pruned) continue;
+
+        size_t distance = getRow(key.size()).back();
+        if (m_Counts[i] >= 0 && distance <= _MaxDistance)
+        {
+            suggestions.push_back({m_Entries[i].TagId,
+                                   String(GetName(m_Entries[i])), m_Counts[i],
+                                   distance});
+        }
+        i++;
+    }
+
+    for (auto const& [key, tag] : m_Pending)
+    {
+        size_t distance = GetEditDistance(name, key.first, _MaxDistance);
+        if (distance > _MaxDistance) continue;
+
+        suggestions.push_back({tag.TagId, tag.Name, tag.PostCount, distance});
+    }
+
+    auto byDistance = [](TagSuggestion const& _A, TagSuggestion const& _B)
+    {
+        if (_A.Distance != _B.Distance) return _A.Distance < _B.Distance;
+        if (_A.PostCount != _B.PostCount) return _A.PostCount > _B.PostCount;
+        return _A.Name < _B.Name;
+    };
+    size_t count = std::min(_Limit, suggestions.size());
+    std::ranges::partial_sort(suggestions, std::begin(suggestions) + count,
+                              byDistance);
+    suggestions.resize(count);
+    return suggestions;
+}
+
+size_t TagDictionary::GetMemoryUsage() const
+{
+    size_t usage  = m_Strings.capacity();
+    usage        += m_Entries.capacity() * sizeof(Entry);
+    usage        += m_Counts.capacity() * sizeof(DB::INTEGER);
+    usage        += m_MaxTree.capacity() * sizeof(uint32_t);
+    usage        += m_Trigrams.capacity() * sizeof(uint32_t);
+    usage        += m_TrigramOffsets.capacity() * sizeof(uint32_t);
+    usage        += m_TrigramPostings.capacity() * sizeof(uint32_t);
+
+    // rough size of hash and tree nodes
+    usage += m_EntryById.size() * (sizeof(DB::INTEGER) + 2 * sizeof(void*));
+    for (auto const& [key, tag] : m_Pending)
+        usage += key.first.capacity() + tag.Name.capacity() + sizeof(tag);
+    return usage;
+}
+
+} // namespace Booru::Search
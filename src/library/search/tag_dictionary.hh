@@ -0,0 +1,196 @@
+#pragma once
+
+#include <booru/db.hh>
+#include <booru/search.hh>
+
+#include <map>
+#include <unordered_map>
+
+namespace Booru::Search
+{
+
+struct TagPattern;
+
+/// @brief In-memory dictionary of tag names for autocompletion and wildcard
+/// matching. Names are matched like SQL LIKE, ie. ASCII case-insensitive.
+///
+/// Most tags live in an immutable, sorted array of names packed into a single
+/// string, so a prefix is a contiguous range found by binary search. A max
+/// tree over the post counts of that array yields the most used tags of a
+/// range without visiting all of it. Tags created or renamed afterwards are
+/// kept in a small sorted overlay that is merged into the array once it grows.
+///
+/// Patterns starting with a wildcard can't use the sorted order. For them the
+/// array is also indexed by the trigrams (three byte substrings) of its keys,
+/// so only entries containing all trigrams of the literal parts of a pattern
+/// have to be checked.
+class TagDictionary
+{
+  public:
+    /// @brief (Re)build the dictionary from the Tags table.
+    ResultCode Build(DB::DBPtr _DB);
+
+    /// @brief Check if the dictionary reflects the database. It becomes stale
+    /// when it is invalidated or a transaction on _DB was rolled back.
+    bool IsValid(DB::DBPtr const& _DB) const;
+
+    /// @brief Mark the dictionary as stale, it has to be rebuilt before it is
+    /// used again.
+    void Invalidate() { m_IsValid = false; }
+
+    /// @brief Check if post counts are known, they are lost when posts are
+    /// deleted along with an unknown set of post tags.
+    bool HasValidCounts() const { return m_HasValidCounts; }
+
+    /// @brief Mark post counts as unknown until the dictionary is rebuilt.
+    void InvalidateCounts() { m_HasValidCounts = false; }
+
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+    // Incremental updates
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+
+    void AddTag(DB::INTEGER _TagId, StringView const& _Name,
+                DB::INTEGER _PostCount);
+    void RenameTag(DB::INTEGER _TagId, StringView const& _Name);
+    void RemoveTag(DB::INTEGER _TagId);
+    void AddPostCount(DB::INTEGER _TagId, DB::INTEGER _Delta);
+
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+    // Queries
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+
+    /// @brief Find all tags matching a pattern. "*" matches any number of
+    /// characters, "?" a single one and "\" escapes the next character.
+    /// @return Matching tag ids in no particular order.
+    Vector<DB::INTEGER> Match(StringView const& _Pattern) const;
+
+    /// @brief Find the most used tags starting with a pattern. Same syntax as
+    /// Match(), but anything may follow the pattern.
+    /// @return Up to _Limit tags by descending post count, then by name.
+    Vector<TagCompletion> Complete(StringView const& _Pattern,
+                                   size_t _Limit) const;
+
+    /// @brief Find tags whose name is at most _MaxDistance edits away from
+    /// _Name. Bytes are compared, so non-ASCII characters may count as more
+    /// than one edit.
+    /// @return Up to _Limit tags by ascending distance, descending post count,
+    /// then by name.
+    Vector<TagSuggestion> Suggest(StringView const& _Name, size_t _MaxDistance,
+                                  size_t _Limit) const;
+
+    /// @brief Number of tags.
+    size_t GetSize() const { return m_EntryById.size() + m_Pending.size(); }
+
+    /// @brief Approximate number of bytes used.
+    size_t GetMemoryUsage() const;
+
+  private:
+    /// @brief Tag in the sorted array. Names are only stored separately if
+    /// they differ from the lower case key.
+    struct Entry
+    {
+        uint32_t KeyOffset  = 0;
+        uint32_t KeyLength  = 0;
+        uint32_t NameOffset = 0;
+        uint32_t NameLength = 0;
+        DB::INTEGER TagId   = -1;
+    };
+
+    /// @brief Tag added since the array was built.
+    struct PendingTag
+    {
+        DB::INTEGER TagId     = -1;
+        String Name;
+        DB::INTEGER PostCount = 0;
+    };
+
+    /// Keys are not unique, names only differing in case have the same key.
+    using PendingKey = std::pair<String, DB::INTEGER>;
+
+    /// @brief Rebuild the sorted array from a list of tags.
+    void Assign(Vector<PendingTag> _Tags);
+
+    /// @brief Merge pending tags into the sorted array once there are enough.
+    void CompactIfNeeded();
+
+    StringView GetKey(Entry const& _Entry) const;
+    StringView GetName(Entry const& _Entry) const;
+
+    /// @brief Range of array entries whose key starts with _Prefix.
+    std::pair<size_t, size_t> FindPrefixRange(StringView const& _Prefix) const;
+
+    /// @brief Index the trigrams of all keys in the sorted array.
+    void BuildTrigrams();
+
+    /// @brief Entries of the sorted array within [_First, _Last) containing
+    /// all of the given trigrams.
+    /// @return Ascending entry indices, nullopt if the trigrams are not
+    /// selective enough and the range should be scanned instead.
+    Optional<Vector<uint32_t>>
+    FindTrigramCandidates(Vector<uint32_t> const& _Trigrams, size_t _First,
+                          size_t _Last) const;
+
+    /// @brief Indices of live array entries matching a pattern.
+    Vector<uint32_t> MatchEntries(TagPattern const& _Pattern) const;
+
+    /// @brief First entry after _Index whose key doesn't start with _Prefix,
+    /// the key at _Index has to.
+    size_t SkipPrefix(size_t _Index, StringView const& _Prefix) const;
+
+    /// @brief Set the post count of an array entry, -1 removes it.
+    void SetCount(size_t _Index, DB::INTEGER _PostCount);
+
+    /// @brief Entry with the highest post count in [_First, _Last), the first
+    /// one on ties.
+    size_t FindMaxCount(size_t _First, size_t _Last) const;
+
+    /// @brief Of two entries the one with the higher post count, the first one
+    /// on ties.
+    size_t GetBetter(size_t _A, size_t _B) const;
+
+    // Sorted array
+
+    /// Keys and names of all entries.
+    String m_Strings;
+
+    /// Entries sorted by key and tag id.
+    Vector<Entry> m_Entries;
+
+    /// Post counts of entries, -1 for removed entries.
+    Vector<DB::INTEGER> m_Counts;
+
+    /// Implicit binary tree over m_Counts, each node holding the index of the
+    /// entry with the highest count below it. Leaves start at m_Entries.size().
+    Vector<uint32_t> m_MaxTree;
+
+    /// Distinct trigrams of all keys, ascending.
+    Vector<uint32_t> m_Trigrams;
+
+    /// Start of the postings of each trigram, with the end as last element.
+    Vector<uint32_t> m_TrigramOffsets;
+
+    /// Ascending indices of the entries containing each trigram.
+    Vector<uint32_t> m_TrigramPostings;
+
+    /// Index of live entries by tag id.
+    std::unordered_map<DB::INTEGER, uint32_t> m_EntryById;
+
+    /// Number of removed entries still in the array.
+    size_t m_RemovedCount = 0;
+
+    // Overlay
+
+    /// Tags added since the array was built, by key.
+    std::map<PendingKey, PendingTag> m_Pending;
+
+    /// Keys of pending tags by tag id.
+    std::unordered_map<DB::INTEGER, String> m_PendingKeys;
+
+    /// Rollback count of the database when the dictionary was built.
+    uint64_t m_RollbackCount = 0;
+
+    bool m_IsValid           = false;
+    bool m_HasValidCounts    = false;
+};
+
+} // namespace Booru::Search
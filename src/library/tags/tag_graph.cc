@@ -0,0 +1,225 @@
+#include "tag_graph.hh"
+
+#include <booru/db/entities/tag_implication.hh>
+#include <booru/db/stmt.hh>
+
+#include <unordered_set>
+
+namespace Booru::Tags
+{
+
+static constexpr auto LOGGER = "booru.tags.graph";
+
+/// Final tag of redirections that form a cycle, and of redirections still
+/// being resolved.
+static constexpr DB::INTEGER BROKEN_REDIRECT = -1;
+
+ResultCode TagGraph::Build(DB::DBPtr _DB)
+{
+    LOG_INFO("Building tag graph...");
+
+    m_IsValid = false;
+    m_Redirects.clear();
+    m_RedirectsResolved = false;
+    m_Implications.clear();
+    m_Closures.clear();
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        redirects, _DB->PrepareStatement("SELECT Id, RedirectId FROM Tags "
+                                         "WHERE RedirectId IS NOT NULL"));
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(step, redirects.Value->StepQuery());
+    while (step != ResultCode::DatabaseEnd)
+    {
+        DB::INTEGER tagId = -1, redirectId = -1;
+        CHECK_RETURN_RESULT_ON_ERROR(
+            redirects.Value->GetColumnValue(0, tagId));
+        CHECK_RETURN_RESULT_ON_ERROR(
+            redirects.Value->GetColumnValue(1, redirectId));
+        m_Redirects[tagId] = redirectId;
+
+        step = redirects.Value->StepQuery();
+        CHECK_RETURN_RESULT_ON_ERROR(step);
+    }
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        implications,
+        _DB->PrepareStatement(
+            "SELECT TagId, ImpliedTagId, Flags FROM TagImplications"));
+
+    step = implications.Value->StepQuery();
+    CHECK_RETURN_RESULT_ON_ERROR(step);
+    while (step != ResultCode::DatabaseEnd)
+    {
+        DB::INTEGER tagId = -1, impliedTagId = -1, flags = 0;
+        CHECK_RETURN_RESULT_ON_ERROR(
+            implications.Value->GetColumnValue(0, tagId));
+        CHECK_RETURN_RESULT_ON_ERROR(
+            implications.Value->GetColumnValue(1, impliedTagId));
+        CHECK_RETURN_RESULT_ON_ERROR(
+            implications.Value->GetColumnValue(2, flags));
+        AddImplication(
+            tagId, impliedTagId,
+            flags & DB::Entities::TagImplication::FLAG_REMOVE_TAG);
+
+        step = implications.Value->StepQuery();
+        CHECK_RETURN_RESULT_ON_ERROR(step);
+    }
+
+    m_RollbackCount = _DB->GetRollbackCount();
+    m_IsValid       = true;
+
+    LOG_INFO("Tag graph contains {} redirections and implications of {} tags.",
+             m_Redirects.size(), m_Implications.size());
+    return ResultCode::OK;
+}
+
+bool TagGraph::IsValid(DB::DBPtr const& _DB) const
+{
+    return m_IsValid && _DB && _DB->GetRollbackCount() == m_RollbackCount;
+}
+
+void TagGraph::SetRedirect(DB::INTEGER _TagId,
+                           Optional<DB::INTEGER> _RedirectId)
+{
+    if (_RedirectId) m_Redirects[_TagId] = *_RedirectId;
+    else m_Redirects.erase(_TagId);
+    m_RedirectsResolved = false;
+    m_Closures.clear();
+}
+
+void TagGraph::AddImplication(DB::INTEGER _TagId, DB::INTEGER _ImpliedTagId,
+                              bool _Remove)
+{
+    m_Implications[_TagId].push_back({_ImpliedTagId, _Remove});
+    m_Closures.clear();
+}
+
+void TagGraph::ResolveRedirects()
+{
+    m_ResolvedRedirects.clear();
+
+    Vector<DB::INTEGER> chain;
+    for (auto const& [tagId, redirectId] : m_Redirects)
+    {
+        if (m_ResolvedRedirects.contains(tagId)) continue;
+
+        // follow the chain until a tag that isn't redirected or that has
+        // already been resolved, tags of this chain are marked as broken
+        // until then, so a cycle ends up at one of them
+        chain.clear();
+        DB::INTEGER current = tagId;
+        DB::INTEGER target  = BROKEN_REDIRECT;
+        while (true)
+        {
+            auto resolved = m_ResolvedRedirects.find(current);
+            if (resolved != std::end(m_ResolvedRedirects))
+            {
+                target = resolved->second;
+                break;
+            }
+
+            auto redirect = m_Redirects.find(current);
+            if (redirect == std::end(m_Redirects))
+            {
+                target = current;
+                break;
+            }
+
+            m_ResolvedRedirects[current] = BROKEN_REDIRECT;
+            chain.push_back(current);
+            current = redirect->second;
+        }
+
+        for (auto id : chain) m_ResolvedRedirects[id] = target;
+    }
+    m_RedirectsResolved = true;
+}
+
+Expected<DB::INTEGER> TagGraph::ResolveRedirect(DB::INTEGER _TagId)
+{
+    std::lock_guard lock(m_QueryMutex);
+    if (!m_RedirectsResolved) ResolveRedirects();
+
+    auto resolved = m_ResolvedRedirects.find(_TagId);
+    if (resolved == std::end(m_ResolvedRedirects)) return _TagId;
+    if (resolved->second == BROKEN_REDIRECT)
+        return ResultCode::RecursionExceeded;
+    return resolved->second;
+}
+
+Vector<std::pair<DB::INTEGER, DB::INTEGER>> TagGraph::GetIndirectRedirects()
+{
+    std::lock_guard lock(m_QueryMutex);
+    if (!m_RedirectsResolved) ResolveRedirects();
+
+    Vector<std::pair<DB::INTEGER, DB::INTEGER>> redirects;
+    for (auto const& [tagId, redirectId] : m_Redirects)
+    {
+        DB::INTEGER target = m_ResolvedRedirects[tagId];
+        if (target != BROKEN_REDIRECT && target != redirectId)
+            redirects.emplace_back(tagId, target);
+    }
+    return redirects;
+}
+
+Expected<TagClosure> TagGraph::GetClosure(DB::INTEGER _TagId)
+{
+    std::lock_guard lock(m_QueryMutex);
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(tagId, ResolveRedirect(_TagId));
+
+    auto cached = m_Closures.find(tagId.Value);
+    if (cached != std::end(m_Closures)) return cached->second;
+
+    TagClosure closure;
+    closure.Add.push_back(tagId.Value);
+
+    std::unordered_set<DB::INTEGER> added{tagId.Value};
+    std::unordered_set<DB::INTEGER> removed;
+
+    // breadth first, the added tags double as queue
+    for (size_t i = 0; i < closure.Add.size(); i++)
+    {
+        auto found = m_Implications.find(closure.Add[i]);
+        if (found == std::end(m_Implications)) continue;
+
+        for (auto const& implication : found->second)
+        {
+            auto impliedTagId = ResolveRedirect(implication.ImpliedTagId);
+            if (!impliedTagId)
+            {
+                LOG_WARNING("Ignoring implied tag {}: {}",
+                            implication.ImpliedTagId,
+                            ResultToString(impliedTagId.Code));
+                continue;
+            }
+
+            if (implication.Remove)
+            {
+                if (removed.insert(impliedTagId.Value).second)
+                    closure.Remove.push_back(impliedTagId.Value);
+            }
+            else if (added.insert(impliedTagId.Value).second)
+            {
+                closure.Add.push_back(impliedTagId.Value);
+            }
+        }
+    }
+
+    std::erase_if(closure.Remove,
+                  [&](DB::INTEGER _Id) { return added.contains(_Id); });
+
+    m_Closures.emplace(tagId.Value, closure);
+    return closure;
+}
+
+Expected<bool> TagGraph::WouldCreateCycle(DB::INTEGER _TagId,
+                                          DB::INTEGER _ImpliedTagId)
+{
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(tagId, ResolveRedirect(_TagId));
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(closure, GetClosure(_ImpliedTagId));
+    return std::ranges::find(closure.Value.Add, tagId.Value) !=
+           std::end(closure.Value.Add);
+}
+
+} // namespace Booru::Tags
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <booru/db.hh>
+
+#include <mutex>
+#include <unordered_map>
+
+namespace Booru::Tags
+{
+
+/// @brief Changes implied by adding a tag to a post, redirections resolved.
+struct TagClosure
+{
+    /// The tag itself, followed by all tags it implies directly or through
+    /// other implied tags.
+    Vector<DB::INTEGER> Add;
+
+    /// Tags removed by any of the added tags. Tags that are also added are
+    /// kept.
+    Vector<DB::INTEGER> Remove;
+};
+
+/// @brief In-memory snapshot of tag redirections and implications.
+///
+/// Redirections are resolved to their final tag all at once, after the
+/// snapshot is built or a redirection changed, so looking them up is a single
+/// hash map access. Closures are computed on first use and kept until the
+/// snapshot changes.
+///
+/// Implications that would make a tag imply itself are rejected before they
+/// are written, but closures also terminate on cycles created elsewhere.
+///
+/// Queries may run on several threads at once, what they compute on first use
+/// is guarded by a lock of its own. Changes must not run concurrently with
+/// anything else.
+class TagGraph
+{
+  public:
+    /// @brief (Re)build the snapshot from the Tags and TagImplications tables.
+    ResultCode Build(DB::DBPtr _DB);
+
+    /// @brief Check if the snapshot reflects the database. It becomes stale
+    /// when it is invalidated or a transaction on _DB was rolled back.
+    bool IsValid(DB::DBPtr const& _DB) const;
+
+    /// @brief Mark the snapshot as stale, it has to be rebuilt before it is
+    /// used again.
+    void Invalidate() { m_IsValid = false; }
+
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+    // Incremental updates
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+
+    void SetRedirect(DB::INTEGER _TagId, Optional<DB::INTEGER> _RedirectId);
+    void AddImplication(DB::INTEGER _TagId, DB::INTEGER _ImpliedTagId,
+                        bool _Remove);
+
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+    // Queries
+    // ////////////////////////////////////////////////////////////////////////////////////////////
+
+    /// @brief Follow the redirections of a tag.
+    /// @return Id of the final tag, RecursionExceeded if the redirections form
+    /// a cycle.
+    Expected<DB::INTEGER> ResolveRedirect(DB::INTEGER _TagId);
+
+    /// @brief Get redirections that lead to their final tag only through
+    /// other redirected tags.
+    /// @return Pairs of tag id and final tag id.
+    Vector<std::pair<DB::INTEGER, DB::INTEGER>> GetIndirectRedirects();
+
+    /// @brief Get the closure of a tag. Implied tags whose redirections can't
+    /// be resolved are left out.
+    Expected<TagClosure> GetClosure(DB::INTEGER _TagId);
+
+    /// @brief Check if _TagId implying _ImpliedTagId would make a tag imply
+    /// itself.
+    Expected<bool> WouldCreateCycle(DB::INTEGER _TagId,
+                                    DB::INTEGER _ImpliedTagId);
+
+  private:
+    struct Implication
+    {
+        DB::INTEGER ImpliedTagId = -1;
+        bool Remove              = false;
+    };
+
+    /// @brief Resolve all redirections to their final tag.
+    void ResolveRedirects();
+
+    /// Redirections by tag id, only for redirected tags.
+    std::unordered_map<DB::INTEGER, DB::INTEGER> m_Redirects;
+
+    /// Final tag of each redirected tag, -1 if its redirections form a cycle.
+    std::unordered_map<DB::INTEGER, DB::INTEGER> m_ResolvedRedirects;
+    bool m_RedirectsResolved = false;
+
+    /// Implications by implying tag id.
+    std::unordered_map<DB::INTEGER, Vector<Implication>> m_Implications;
+
+    /// Closures computed so far, by resolved tag id.
+    std::unordered_map<DB::INTEGER, TagClosure> m_Closures;
+
+    /// Held by queries, they resolve redirections and compute closures.
+    std::recursive_mutex m_QueryMutex;
+
+    /// Rollback count of the database when the snapshot was built.
+    uint64_t m_RollbackCount = 0;
+
+    bool m_IsValid           = false;
+};
+
+} // namespace Booru::Tags
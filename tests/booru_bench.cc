@@ -0,0 +1,380 @@
+#include <booru/booru.hh>
+#include <booru/db/entities/post.hh>
+#include <booru/db/entities/post_tag.hh>
+#include <booru/db/entities/tag.hh>
+#include <booru/db/query.hh>
+#include <booru/db/stmt.hh>
+
+#include "search/intersect.hh"
+
+#include <log4cxx/basicconfigurator.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <set>
+
+#include <unistd.h>
+
+#define LOGGER "booru_bench"
+
+static constexpr size_t POST_COUNT    = 50000;
+static constexpr size_t TAG_COUNT     = 200;
+static constexpr size_t TAGS_PER_POST = 8;
+static constexpr size_t REPEAT        = 5;
+
+static constexpr size_t TAG_DICTIONARY_SIZE = 500000;
+
+#define BENCH_CASE(name)                                                       \
+    {                                                                          \
+        #name, [](Booru::Booru& booru, const Booru::StringView& _Path) -> bool {
+#define BENCH_END                                                              \
+    }                                                                          \
+    }                                                                          \
+    ,
+
+/// @brief Run a function a few times and return the average wall time in
+/// milliseconds.
+template <class TFunc> static double Measure(TFunc _Func)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < REPEAT; i++)
+        _Func();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / REPEAT;
+}
+
+namespace Booru
+{
+
+/// @brief The condition FindPosts used to generate for a single tag: one
+/// correlated COUNT subquery per candidate post.
+static Expected<String> CorrelatedCondition(Booru& _Booru, StringView _Tag)
+{
+    if (_Tag.starts_with('-'))
+    {
+        return CorrelatedCondition(_Booru, _Tag.substr(1))
+            .Then([](auto c) { return Expected("NOT "s + c); });
+    }
+
+    CHECK_VAR_RETURN_RESULT_ON_ERROR(
+        ids, _Booru.MatchTags(_Tag).Then(
+                 DB::Entities::CollectIds<DB::Entities::Tag>));
+
+    return "( ( SELECT COUNT(*) FROM PostTags "
+           "WHERE PostTags.PostId = Posts.Id "
+           "AND PostTags.TagId IN ( " +
+           Strings::JoinXForm(ids.Value, ", ") + " ) ) > 0 )";
+}
+
+/// @brief FindPosts as it was before the query compiler.
+static ExpectedVector<DB::Entities::Post>
+FindPostsCorrelated(Booru& _Booru, StringView _QueryString)
+{
+    auto query = DB::Query::Select(DB::Entities::Post::Table);
+    for (auto const& tag : Strings::Split(_QueryString))
+    {
+        CHECK_VAR_RETURN_RESULT_ON_ERROR(condition,
+                                         CorrelatedCondition(_Booru, tag));
+        query.Where(condition.Value);
+    }
+
+    return _Booru.GetDatabase()
+        .Then(&DB::Query::Select::Prepare, query)
+        .Then(&DB::IStmt::ExecuteList<DB::Entities::Post>);
+}
+
+/// @brief Sorted random set of _Count values below _Range.
+template <class TValue>
+static Vector<TValue> RandomSet(size_t _Count, TValue _Range,
+                                std::mt19937& _Rng)
+{
+    std::uniform_int_distribution<TValue> distribution(0, _Range - 1);
+
+    Vector<TValue> values(_Count);
+    for (auto& value : values)
+        value = distribution(_Rng);
+
+    std::ranges::sort(values);
+    values.erase(std::unique(std::begin(values), std::end(values)),
+                 std::end(values));
+    return values;
+}
+
+/// @brief Time intersection and difference of two sets with the standard
+/// library and each supported kernel instruction set.
+template <class TValue>
+static bool BenchSetOperations(char const* _Name, Vector<TValue> const& _A,
+                               Vector<TValue> const& _B)
+{
+    using Search::InstructionSet;
+
+    static std::pair<InstructionSet, char const*> const sets[] = {
+        {InstructionSet::Scalar, "scalar"},
+        {InstructionSet::SSE42, "sse4.2"},
+        {InstructionSet::AVX2, "avx2"},
+    };
+
+    Vector<TValue> expected(_A.size()), actual(_A.size());
+    Span<TValue const> a(_A), b(_B);
+
+    for (bool intersect : {true, false})
+    {
+        size_t expectedCount = 0;
+        double stdTime       = Measure(
+            [&]
+            {
+                auto end = intersect ? std::ranges::set_intersection(
+                                           _A, _B, std::begin(expected))
+                                           .out
+                                     : std::ranges::set_difference(
+                                           _A, _B, std::begin(expected))
+                                           .out;
+                expectedCount = end - std::begin(expected);
+            });
+
+        std::printf("%-24s %-10s std %8.3f ms", _Name,
+                    intersect ? "intersect" : "difference", stdTime);
+
+        for (auto const& [set, name] : sets)
+        {
+            if (set > Search::GetSupportedInstructionSet()) continue;
+            Search::SetInstructionSet(set);
+
+            size_t count = 0;
+            double time  = Measure(
+                [&]
+                {
+                    count = intersect ? Search::Intersect(a, b, actual)
+                                       : Search::Difference(a, b, actual);
+                });
+            std::printf("  %s %8.3f ms", name, time);
+
+            // every kernel has to produce the same result
+            if (count != expectedCount ||
+                !std::equal(std::begin(expected),
+                            std::begin(expected) + count, std::begin(actual)))
+            {
+                std::printf("\nmismatch\n");
+                return false;
+            }
+        }
+        std::printf("  (%zu values)\n", expectedCount);
+    }
+
+    Search::SetInstructionSet(Search::GetSupportedInstructionSet());
+    return true;
+}
+
+} // namespace Booru
+
+static Booru::Vector<
+    std::pair<Booru::String, bool (*)(Booru::Booru&, const Booru::StringView&)>>
+    bench_cases = {BENCH_CASE(populate)
+                   // start from scratch
+                   unlink(Booru::String(_Path).c_str());
+if (Booru::ResultIsError(booru.OpenDatabase(_Path, true))) return false;
+
+// a few very common tags and a long tail of rare ones
+for (size_t i = 0; i < TAG_COUNT; i++)
+{
+    Booru::DB::Entities::Tag tag;
+    tag.Name      = "tag_" + std::to_string(i);
+    tag.TagTypeId = 1;
+    if (Booru::ResultIsError(booru.Create(tag).Code)) return false;
+}
+
+auto tagIds = booru.GetTags().Then(
+    Booru::DB::Entities::CollectIds<Booru::DB::Entities::Tag>);
+if (!tagIds) return false;
+
+std::mt19937 rng(1234);
+std::uniform_real_distribution<double> skew(0.0, 1.0);
+std::uniform_int_distribution<Booru::DB::INTEGER> rating(
+    Booru::DB::Entities::RATING_GENERAL, Booru::DB::Entities::RATING_EXPLICIT);
+
+Booru::Vector<Booru::DB::Entities::Post> posts(POST_COUNT);
+for (size_t i = 0; i < posts.size(); i++)
+{
+    std::memcpy(posts[i].MD5Sum.data(), &i, sizeof(i));
+    posts[i].PostTypeId = 2;
+    posts[i].Rating     = rating(rng);
+}
+if (!booru.CreateMany<Booru::DB::Entities::Post>(posts)) return false;
+
+Booru::Vector<Booru::DB::Entities::PostTag> postTags;
+for (auto const& post : posts)
+{
+    for (size_t i = 0; i < TAGS_PER_POST; i++)
+    {
+        auto tag = size_t(TAG_COUNT * std::pow(skew(rng), 3.0));
+
+        Booru::DB::Entities::PostTag postTag;
+        postTag.PostId = post.Id;
+        postTag.TagId  = tagIds.Value[tag];
+        postTags.push_back(postTag);
+    }
+}
+// duplicate tags on the same post are rejected individually, that's fine
+if (!booru.CreateMany<Booru::DB::Entities::PostTag>(postTags)) return false;
+
+std::printf("created %zu posts with %zu tags\n", posts.size(),
+            postTags.size());
+return true;
+BENCH_END
+
+BENCH_CASE(find_posts)
+if (Booru::ResultIsError(booru.OpenDatabase(_Path, false))) return false;
+
+Booru::StringVector queries = {
+    "tag_0 tag_1",   // two common tags
+    "tag_0 tag_150", // common and rare
+    "tag_150 tag_0", // same, rare tag first
+    "tag_2 -tag_0",  // negation
+    "tag_5 tag_10 tag_20 tag_40",
+};
+
+std::printf("%-28s %12s %12s %12s %8s\n", "query", "correlated",
+            "compiled", "indexed", "rows");
+for (auto const& query : queries)
+{
+    size_t oldRows = 0, newRows = 0, indexRows = 0;
+
+    double oldTime = Measure(
+        [&]
+        { oldRows = Booru::FindPostsCorrelated(booru, query).Value.size(); });
+    double newTime =
+        Measure([&] { newRows = booru.FindPosts(query).Value.size(); });
+
+    if (Booru::ResultIsError(booru.SetSearchIndexEnabled(true))) return false;
+    double indexTime =
+        Measure([&] { indexRows = booru.FindPosts(query).Value.size(); });
+    if (Booru::ResultIsError(booru.SetSearchIndexEnabled(false))) return false;
+
+    std::printf("%-28s %9.2f ms %9.2f ms %9.2f ms %8zu\n", query.c_str(),
+                oldTime, newTime, indexTime, newRows);
+
+    // all plans have to agree
+    if (oldRows != newRows || indexRows != newRows) return false;
+}
+return true;
+BENCH_END
+
+BENCH_CASE(tag_dictionary)
+// separate database, the tags would skew the other cases
+Booru::String path = Booru::String(_Path) + ".tags";
+unlink(path.c_str());
+if (Booru::ResultIsError(booru.OpenDatabase(path, true))) return false;
+
+// names of one to three random words
+std::mt19937 rng(1234);
+std::uniform_int_distribution<int> letter('a', 'z'), length(3, 8), words(1, 3);
+auto makeWord = [&]
+{
+    Booru::String word(size_t(length(rng)), 'a');
+    for (char& c : word)
+        c = char(letter(rng));
+    return word;
+};
+
+std::set<Booru::String> names;
+while (names.size() < TAG_DICTIONARY_SIZE)
+{
+    Booru::String name = makeWord();
+    for (int i = words(rng); i > 1; i--)
+        name += "_" + makeWord();
+    names.insert(std::move(name));
+}
+
+Booru::Vector<Booru::DB::Entities::Tag> tags;
+for (auto const& name : names)
+{
+    Booru::DB::Entities::Tag& tag = tags.emplace_back();
+    tag.Name                      = name;
+    tag.TagTypeId                 = 1;
+}
+if (!booru.CreateMany<Booru::DB::Entities::Tag>(tags)) return false;
+
+// misspell an existing name
+Booru::String typo = *std::next(std::begin(names), names.size() / 2);
+std::swap(typo[1], typo[2]);
+Booru::String infix = "*" + typo.substr(1, 3) + "*";
+Booru::String prefix = typo.substr(0, 2);
+
+std::printf("%-28s %12s %12s %8s\n", "operation", "sql", "dictionary",
+            "rows");
+auto compare = [&](Booru::String const& _Name, auto _Func)
+{
+    size_t sqlRows = 0, dictionaryRows = 0;
+    double sqlTime = Measure([&] { sqlRows = _Func(); });
+
+    if (Booru::ResultIsError(booru.SetTagDictionaryEnabled(true))) return false;
+    double dictionaryTime = Measure([&] { dictionaryRows = _Func(); });
+    if (Booru::ResultIsError(booru.SetTagDictionaryEnabled(false)))
+        return false;
+
+    std::printf("%-28s %9.2f ms %9.2f ms %8zu\n", _Name.c_str(), sqlTime,
+                dictionaryTime, dictionaryRows);
+    return sqlRows == dictionaryRows;
+};
+
+// without the dictionary suggestions build a temporary one
+return compare("match " + infix,
+               [&] { return booru.MatchTags(infix).Value.size(); }) &&
+       compare("complete " + prefix,
+               [&] { return booru.CompleteTags(prefix).Value.size(); }) &&
+       compare("suggest " + typo,
+               [&] { return booru.SuggestTags(typo).Value.size(); });
+BENCH_END
+
+BENCH_CASE(intersect)
+// no database needed, just sorted id lists
+std::mt19937 rng(1234);
+
+auto large32  = Booru::RandomSet<uint32_t>(1000000, 4000000, rng);
+auto other32  = Booru::RandomSet<uint32_t>(1000000, 4000000, rng);
+auto small32  = Booru::RandomSet<uint32_t>(1000, 4000000, rng);
+auto large64  = Booru::RandomSet<int64_t>(1000000, 4000000, rng);
+auto other64  = Booru::RandomSet<int64_t>(1000000, 4000000, rng);
+auto small64  = Booru::RandomSet<int64_t>(1000, 4000000, rng);
+
+return Booru::BenchSetOperations("uint32 1M / 1M", large32, other32) &&
+       Booru::BenchSetOperations("uint32 1k / 1M", small32, large32) &&
+       Booru::BenchSetOperations("uint32 1M / 1k", large32, small32) &&
+       Booru::BenchSetOperations("int64 1M / 1M", large64, other64) &&
+       Booru::BenchSetOperations("int64 1k / 1M", small64, large64) &&
+       Booru::BenchSetOperations("int64 1M / 1k", large64, small64);
+BENCH_END
+}
+;
+
+// syntax: booru_bench <db> <case>
+int main(int argc, char* argv[])
+{
+    // initialize logging in case we have to speak before booru initializes it
+    log4cxx::BasicConfigurator::configure();
+
+    if (argc != 3)
+    {
+        LOG_ERROR("Usage: {} <db> <case>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    auto booru = Booru::Booru::InitializeLibrary();
+    if (!booru) return EXIT_FAILURE;
+
+    // keep the library quiet while measuring
+    log4cxx::Logger::getRootLogger()->setLevel(log4cxx::Level::getWarn());
+
+    for (auto& [name, func] : bench_cases)
+    {
+        if (name != argv[2]) continue;
+        return func(*booru, argv[1]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    LOG_ERROR("Unknown benchmark {}\n", argv[2]);
+    return EXIT_FAILURE;
+}
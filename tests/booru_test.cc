@@ -1,11 +1,21 @@
 #include <booru/booru.hh>
+#include <booru/db/entities/post.hh>
+#include <booru/db/entities/post_file.hh>
+#include <booru/db/entities/post_tag.hh>
 #include <booru/db/entities/tag.hh>
+#include <booru/db/entities/tag_implication.hh>
 
 #include <log4cxx/basicconfigurator.h>
 
+#include <atomic>
+#include <random>
+#include <stdexcept>
+#include <thread>
 #include <unistd.h>
 
 #include "booru_test.hh"
+#include "db/sqlite3/pool.hh"
+#include "search/intersect.hh"
 
 #define TEST_CASE(name)                                                        \
     {                                                                          \
@@ -15,6 +25,94 @@
     }                                                                          \
     ,
 
+/// @brief Sorted set of random values in [_Base, _Base + _Range).
+template <class TValue>
+static Booru::Vector<TValue> RandomSet(std::mt19937_64& _Random, size_t _Size,
+                                       TValue _Base, uint64_t _Range)
+{
+    Booru::Vector<TValue> values;
+    for (size_t i = 0; i < _Size; i++)
+        values.push_back(TValue(_Base + TValue(_Random() % _Range)));
+
+    std::ranges::sort(values);
+    values.erase(std::unique(std::begin(values), std::end(values)),
+                 std::end(values));
+    return values;
+}
+
+/// @brief Compare the set operation kernels of the current instruction set
+/// with the standard library.
+/// @return Number of mismatching results.
+template <class TValue>
+static size_t CheckSetOperations(Booru::Vector<TValue> const& _A,
+                                 Booru::Vector<TValue> const& _B)
+{
+    Booru::Vector<TValue> expected;
+    std::ranges::set_intersection(_A, _B, std::back_inserter(expected));
+
+    // outputs only as large as documented
+    Booru::Vector<TValue> actual(std::min(_A.size(), _B.size()));
+    size_t count = Booru::Search::Intersect(Booru::Span<TValue const>(_A),
+                                            Booru::Span<TValue const>(_B),
+                                            Booru::Span<TValue>(actual));
+    actual.resize(count);
+    size_t mismatches = actual != expected;
+
+    expected.clear();
+    std::ranges::set_difference(_A, _B, std::back_inserter(expected));
+
+    actual.resize(_A.size());
+    count = Booru::Search::Difference(Booru::Span<TValue const>(_A),
+                                      Booru::Span<TValue const>(_B),
+                                      Booru::Span<TValue>(actual));
+    actual.resize(count);
+    return mismatches + (actual != expected);
+}
+
+/// @brief Compare the kernels on sets of sizes around the block widths, very
+/// lopsided sets and values at the end of the 32 bit range.
+template <class TValue> static size_t CheckSetOperations()
+{
+    std::mt19937_64 random(42);
+
+    static size_t const sizes[] = {0,  1,  2,  3,  4,  5,  7,  8,  9,
+                                   15, 16, 17, 31, 32, 33, 63, 64, 65};
+
+    Booru::Vector<std::pair<size_t, size_t>> sizePairs;
+    for (auto a : sizes)
+    {
+        for (auto b : sizes) sizePairs.push_back({a, b});
+    }
+    for (size_t small : {1, 3, 8, 17})
+    {
+        sizePairs.push_back({small, small * 1000});
+        sizePairs.push_back({small * 1000, small});
+    }
+
+    size_t mismatches = 0;
+    for (TValue base : {TValue(0), TValue(UINT32_MAX - 4095)})
+    {
+        for (auto [sizeA, sizeB] : sizePairs)
+        {
+            // dense enough to share values, sparse enough to miss some
+            uint64_t range = std::min<uint64_t>(2 * (sizeA + sizeB) + 1, 4096);
+            auto a = RandomSet<TValue>(random, sizeA, base, range);
+            auto b = RandomSet<TValue>(random, sizeB, base, range);
+            mismatches += CheckSetOperations(a, b);
+
+            // identical and disjoint inputs
+            mismatches += CheckSetOperations(a, a);
+            if (base == 0)
+            {
+                auto c = b;
+                for (auto& value : c) value += TValue(range);
+                mismatches += CheckSetOperations(a, c);
+            }
+        }
+    }
+    return mismatches;
+}
+
 static Booru::Vector<
     std::pair<Booru::String, void (*)(Booru::Booru&, const Booru::StringView&)>>
     test_cases = {TEST_CASE(open)
@@ -147,6 +245,1329 @@ TEST_EQUAL(tag.Id, -1);
 tag.Id = 1;
 TEST_CHECK_ERROR(booru.Delete(tag));
 TEST_END
+
+TEST_CASE(statement_cache)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+auto db = booru.GetDatabase();
+TEST_CHECK(db);
+
+// same query twice, second one should be served from the cache
+TEST_CHECK(booru.GetConfig("db.version"));
+auto stats = db.Value->GetStatementCacheStats();
+TEST_CHECK(booru.GetConfig("db.version"));
+TEST_EQUAL(db.Value->GetStatementCacheStats().Hits, stats.Hits + 1);
+TEST_EQUAL(db.Value->GetStatementCacheStats().Misses, stats.Misses);
+
+// cached statement must have been reset, bindings cleared
+TEST_CHECK_ERROR(booru.GetConfig("does.not.exist"));
+TEST_CHECK_EQUAL(booru.GetConfigInt64("db.version"),
+                 Booru::Booru::GetSchemaVersion());
+
+// shrinking the cache evicts statements
+db.Value->SetStatementCacheCapacity(0);
+TEST_EQUAL(db.Value->GetStatementCacheStats().Size, 0);
+TEST_CHECK(booru.GetConfig("db.version"));
+TEST_EQUAL(db.Value->GetStatementCacheStats().Size, 0);
+TEST_END
+
+TEST_CASE(post_create)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+// three posts, tagged "red", "red blue" and "blue"
+Booru::StringVector tagNames = {"red", "blue"};
+for (auto const& name : tagNames)
+{
+    Booru::DB::Entities::Tag tag;
+    tag.Name      = name;
+    tag.TagTypeId = 1;
+    TEST_CHECK(booru.Create(tag));
+}
+
+auto red  = booru.GetTag("red");
+auto blue = booru.GetTag("blue");
+TEST_CHECK(red);
+TEST_CHECK(blue);
+
+for (int i = 0; i < 3; i++)
+{
+    Booru::DB::Entities::Post post;
+    post.MD5Sum.fill(i);
+    post.PostTypeId = 2;
+    post.Rating     = Booru::DB::Entities::RATING_GENERAL + i;
+    TEST_CHECK(booru.Create(post).Update(post));
+    if (i < 2) TEST_CHECK(booru.AddTagToPost(post, red));
+    if (i > 0) TEST_CHECK(booru.AddTagToPost(post, blue));
+}
+
+TEST_EQUAL(booru.GetPosts().Value.size(), 3);
+TEST_EQUAL(booru.GetPostTags().Value.size(), 4);
+TEST_END
+
+TEST_CASE(post_stream)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+auto posts  = booru.StreamAll<Booru::DB::Entities::Post>();
+TEST_CHECK(posts);
+
+// same rows as GetPosts, decoded one at a time
+auto all    = booru.GetPosts();
+size_t rows = 0;
+for (auto const& post : posts.Value)
+{
+    TEST_EQUAL(post.Id, all.Value[rows].Id);
+    TEST_EQUAL(post.MD5Sum, all.Value[rows].MD5Sum);
+    rows++;
+}
+TEST_EQUAL(rows, all.Value.size());
+TEST_TRUE(posts.Value.GetResult() == Booru::ResultCode::DatabaseEnd);
+
+auto red    = booru.GetTag("red");
+TEST_CHECK(red);
+auto tagged = booru.StreamPostsForTag(red.Value.Id);
+TEST_CHECK(tagged);
+TEST_EQUAL(std::ranges::distance(tagged.Value), 2);
+
+// stopping early must not block the next statement
+auto found = booru.StreamFindPosts("blue");
+TEST_CHECK(found);
+TEST_TRUE(found.Value.begin() != found.Value.end());
+TEST_EQUAL(booru.FindPosts("blue").Value.size(), 2);
+TEST_END
+
+TEST_CASE(post_find)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+// posts are tagged "red", "red blue" and "blue", rated g, s and q
+TEST_EQUAL(booru.FindPosts("red blue").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("red -blue").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("-red").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("red  rating:s").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("-rating:g blue").Value.size(), 2);
+TEST_EQUAL(booru.FindPosts("-rating:q -rating:s").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("red nonexistent").Value.size(), 0);
+TEST_EQUAL(booru.FindPosts("red -nonexistent").Value.size(), 2);
+TEST_CHECK_ERROR(booru.FindPosts(""));
+TEST_END
+
+TEST_CASE(post_find_index)
+TEST_CHECK(booru.SetSearchIndexEnabled(true));
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+// same results as the SQL searches
+TEST_EQUAL(booru.FindPosts("red blue").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("red -blue").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("-red").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("red  rating:s").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("-rating:g blue").Value.size(), 2);
+TEST_EQUAL(booru.FindPosts("red nonexistent").Value.size(), 0);
+
+// changes are seen without rebuilding
+auto red  = booru.GetTag("red");
+auto post = booru.FindPosts("-red");
+TEST_CHECK(red);
+TEST_EQUAL(post.Value.size(), 1);
+TEST_CHECK(booru.AddTagToPost(post.Value[0], red));
+TEST_EQUAL(booru.FindPosts("red").Value.size(), 3);
+TEST_CHECK(booru.RemoveTagFromPost(post.Value[0], red));
+TEST_EQUAL(booru.FindPosts("red").Value.size(), 2);
+
+post.Value[0].Rating = Booru::DB::Entities::RATING_EXPLICIT;
+TEST_CHECK(booru.Update(post.Value[0]));
+TEST_EQUAL(booru.FindPosts("rating:e").Value.size(), 1);
+
+// rolled back changes must not linger in the index
+auto db = booru.GetDatabase();
+TEST_CHECK(db);
+{
+    Booru::DB::TransactionGuard guard(db.Value);
+    TEST_CHECK(booru.AddTagToPost(post.Value[0], red));
+    TEST_EQUAL(booru.FindPosts("red").Value.size(), 3);
+}
+TEST_EQUAL(booru.FindPosts("red").Value.size(), 2);
+
+post.Value[0].Rating = Booru::DB::Entities::RATING_QUESTIONABLE;
+TEST_CHECK(booru.Update(post.Value[0]));
+
+// deleting a post removes its tags from the index
+Booru::DB::Entities::Post deleted;
+deleted.MD5Sum.fill(0x7f);
+deleted.PostTypeId = 2;
+deleted.Rating     = Booru::DB::Entities::RATING_GENERAL;
+TEST_CHECK(booru.Create(deleted).Update(deleted));
+TEST_CHECK(booru.AddTagToPost(deleted, red));
+TEST_EQUAL(booru.FindPosts("red").Value.size(), 3);
+TEST_CHECK(booru.Delete(deleted));
+TEST_EQUAL(booru.FindPosts("red").Value.size(), 2);
+TEST_CHECK(booru.SetSearchIndexEnabled(false));
+TEST_END
+
+TEST_CASE(search_cache)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+// term order, case and spacing do not matter
+auto stats = booru.GetSearchCacheStats();
+TEST_EQUAL(booru.FindPosts("red blue").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("Blue  red").Value.size(), 1);
+TEST_EQUAL(booru.GetSearchCacheStats().Misses, stats.Misses + 1);
+TEST_EQUAL(booru.GetSearchCacheStats().Hits, stats.Hits + 1);
+
+// writes drop affected results only
+auto red  = booru.GetTag("red");
+auto post = booru.FindPosts("-red");
+TEST_CHECK(red);
+TEST_EQUAL(post.Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("rating:g").Value.size(), 1);
+TEST_CHECK(booru.AddTagToPost(post.Value[0], red));
+
+stats = booru.GetSearchCacheStats();
+TEST_EQUAL(booru.FindPosts("rating:g").Value.size(), 1);
+TEST_EQUAL(booru.FindPosts("red").Value.size(), 3);
+TEST_EQUAL(booru.GetSearchCacheStats().Hits, stats.Hits + 1);
+TEST_EQUAL(booru.GetSearchCacheStats().Misses, stats.Misses + 1);
+
+TEST_CHECK(booru.RemoveTagFromPost(post.Value[0], red));
+TEST_EQUAL(booru.FindPosts("red").Value.size(), 2);
+TEST_EQUAL(booru.FindPosts("-red").Value.size(), 1);
+
+// capacity bounds the number of results
+booru.SetSearchCacheCapacity(1);
+TEST_EQUAL(booru.GetSearchCacheStats().Size, 1);
+booru.SetSearchCacheCapacity(0);
+stats = booru.GetSearchCacheStats();
+TEST_EQUAL(booru.FindPosts("red").Value.size(), 2);
+TEST_EQUAL(booru.GetSearchCacheStats().Hits, stats.Hits);
+TEST_TRUE(stats.GetHitRate() > 0.0);
+TEST_END
+
+TEST_CASE(post_page)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+TEST_CHECK_EQUAL(booru.CountPosts("blue"), 2);
+TEST_CHECK_EQUAL(booru.CountPosts("red -blue"), 1);
+TEST_CHECK_EQUAL(booru.CountPosts("-rating:e"), 3);
+
+for (bool indexed : {false, true})
+{
+    TEST_CHECK(booru.SetSearchIndexEnabled(indexed));
+
+    Booru::Search::PostPageRequest request;
+    request.Query    = "-rating:e";
+    request.PageSize = 2;
+
+    auto first = booru.FindPostsPage(request);
+    TEST_CHECK(first);
+    TEST_EQUAL(first.Value.Posts.size(), 2);
+    TEST_TRUE(first.Value.Posts[0].Id < first.Value.Posts[1].Id);
+    TEST_FALSE(first.Value.NextCursor.empty());
+
+    request.Cursor = first.Value.NextCursor;
+    auto second    = booru.FindPostsPage(request);
+    TEST_CHECK(second);
+    TEST_EQUAL(second.Value.Posts.size(), 1);
+    TEST_TRUE(second.Value.Posts[0].Id > first.Value.Posts[1].Id);
+    TEST_TRUE(second.Value.NextCursor.empty());
+
+    // ties are broken by Id
+    request.Order      = Booru::Search::PostOrder::Score;
+    request.Descending = true;
+    request.Cursor     = "";
+    first              = booru.FindPostsPage(request);
+    TEST_CHECK(first);
+    TEST_EQUAL(first.Value.Posts.size(), 2);
+    TEST_TRUE(first.Value.Posts[0].Id > first.Value.Posts[1].Id);
+
+    request.Cursor = first.Value.NextCursor;
+    second         = booru.FindPostsPage(request);
+    TEST_CHECK(second);
+    TEST_EQUAL(second.Value.Posts.size(), 1);
+    TEST_TRUE(second.Value.Posts[0].Id < first.Value.Posts[1].Id);
+
+    // cursors only continue the ordering they were made for
+    request.Order = Booru::Search::PostOrder::AddedTime;
+    TEST_FALSE(booru.FindPostsPage(request));
+}
+
+// pages of cached matches are cut out of sort keys read only once
+Booru::Search::PostPageRequest request;
+request.Query    = "blue";
+request.Order    = Booru::Search::PostOrder::AddedTime;
+request.PageSize = 1;
+
+auto stats = booru.GetSearchCacheStats();
+Booru::Vector<Booru::DB::INTEGER> pagedIds;
+do
+{
+    auto page = booru.FindPostsPage(request);
+    TEST_CHECK(page);
+    TEST_EQUAL(page.Value.Posts.size(), 1);
+    pagedIds.push_back(page.Value.Posts[0].Id);
+    request.Cursor = page.Value.NextCursor;
+} while (!request.Cursor.empty());
+
+TEST_EQUAL(pagedIds.size(), 2);
+TEST_TRUE(pagedIds[0] < pagedIds[1]);
+TEST_EQUAL(booru.GetSearchCacheStats().SortKeyLoads, stats.SortKeyLoads + 1);
+
+// changed sort keys are read again, the matches stay cached
+auto post = booru.GetPost(pagedIds[0]);
+TEST_CHECK(post);
+auto addedTime       = post.Value.AddedTime;
+post.Value.AddedTime = addedTime + 100;
+TEST_CHECK(booru.Update(post.Value));
+auto page = booru.FindPostsPage(request);
+TEST_CHECK(page);
+TEST_EQUAL(page.Value.Posts[0].Id, pagedIds[1]);
+TEST_EQUAL(booru.GetSearchCacheStats().SortKeyLoads, stats.SortKeyLoads + 2);
+TEST_EQUAL(booru.GetSearchCacheStats().Misses, stats.Misses + 1);
+
+post.Value.AddedTime = addedTime;
+TEST_CHECK(booru.Update(post.Value));
+TEST_CHECK(booru.SetSearchIndexEnabled(false));
+TEST_END
+
+TEST_CASE(post_create_many)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+Booru::Vector<Booru::DB::Entities::Post> posts(3);
+for (size_t i = 0; i < posts.size(); i++)
+{
+    posts[i].MD5Sum.fill(0x10 + i);
+    posts[i].PostTypeId = 2;
+}
+// duplicate of an existing post, must not abort the batch
+posts[1].MD5Sum.fill(0);
+
+auto results = booru.CreateMany<Booru::DB::Entities::Post>(posts);
+TEST_CHECK(results);
+TEST_EQUAL(results.Value.size(), 3);
+TEST_TRUE(results.Value[0] == Booru::ResultCode::CreatedOK);
+TEST_TRUE(results.Value[1] == Booru::ResultCode::AlreadyExists);
+TEST_TRUE(results.Value[2] == Booru::ResultCode::CreatedOK);
+
+TEST_EQUAL(posts[1].Id, -1);
+TEST_CHECK_EQUAL(booru.GetPost(posts[0].Id), posts[0]);
+TEST_CHECK_EQUAL(booru.GetPost(posts[2].Id), posts[2]);
+TEST_EQUAL(booru.GetPosts().Value.size(), 5);
+TEST_END
+
+TEST_CASE(tag_post_count)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+auto red = booru.GetTag("red");
+TEST_CHECK(red);
+TEST_EQUAL(red.Value.PostCount, 2);
+
+// most used tags first
+auto tags = booru.MatchTags("*");
+TEST_CHECK(tags);
+TEST_TRUE(tags.Value.front().PostCount >= tags.Value.back().PostCount);
+
+auto post = booru.FindPosts("-red");
+TEST_CHECK(post);
+TEST_CHECK(booru.AddTagToPost(post.Value[0], red));
+TEST_EQUAL(booru.GetTag("red").Value.PostCount, 3);
+
+// post tags are deleted by cascade
+TEST_CHECK(booru.Delete(post.Value[0]));
+TEST_EQUAL(booru.GetTag("red").Value.PostCount, 2);
+
+// counts changed behind our back are corrected
+auto db = booru.GetDatabase();
+TEST_CHECK(db);
+TEST_CHECK(db.Value->ExecuteSQL(
+    "UPDATE Tags SET PostCount = 100 WHERE Name = 'red'"));
+auto corrected = booru.ReconcileTagPostCounts();
+TEST_CHECK_EQUAL(corrected, 1);
+TEST_EQUAL(booru.GetTag("red").Value.PostCount, 2);
+
+// periodic runs only recount once the interval passed
+TEST_CHECK(db.Value->ExecuteSQL(
+    "UPDATE Tags SET PostCount = 100 WHERE Name = 'red'"));
+TEST_CHECK_EQUAL(booru.ReconcileTagPostCountsIfDue(), 0);
+TEST_CHECK_EQUAL(booru.ReconcileTagPostCountsIfDue(std::chrono::seconds(0)),
+                 1);
+TEST_EQUAL(booru.GetTag("red").Value.PostCount, 2);
+TEST_END
+
+TEST_CASE(tag_complete)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+auto sqlCompletions = booru.CompleteTags("r");
+TEST_CHECK(sqlCompletions);
+TEST_TRUE(!sqlCompletions.Value.empty());
+TEST_EQUAL(sqlCompletions.Value.front().Name, "red");
+
+auto sqlMatches = booru.MatchTags("*lu*");
+TEST_CHECK(sqlMatches);
+
+// dictionary must agree with the database
+TEST_CHECK(booru.SetTagDictionaryEnabled(true));
+auto completions = booru.CompleteTags("R");
+TEST_CHECK(completions);
+TEST_EQUAL(completions.Value.size(), sqlCompletions.Value.size());
+TEST_EQUAL(completions.Value.front().Name, "red");
+TEST_EQUAL(completions.Value.front().PostCount, 2);
+
+auto matches = booru.MatchTags("*lu*");
+TEST_CHECK(matches);
+TEST_EQUAL(matches.Value.size(), sqlMatches.Value.size());
+for (size_t i = 0; i < matches.Value.size(); i++)
+    TEST_EQUAL(matches.Value[i].Name, sqlMatches.Value[i].Name);
+
+auto single = booru.MatchTags("re?");
+TEST_CHECK(single);
+TEST_EQUAL(single.Value.size(), 1);
+TEST_EQUAL(booru.MatchTags("re\\?").Value.size(), 0);
+
+// incremental updates
+Booru::DB::Entities::Tag rose;
+rose.Name      = "rose";
+rose.TagTypeId = 1;
+TEST_CHECK(booru.Create(rose).Update(rose));
+auto post = booru.GetPosts();
+TEST_CHECK(post);
+TEST_CHECK(booru.AddTagToPost(post.Value[0], rose));
+TEST_CHECK(booru.AddTagToPost(post.Value[1], rose));
+TEST_CHECK(booru.AddTagToPost(post.Value[2], rose));
+
+completions = booru.CompleteTags("r", 1);
+TEST_CHECK(completions);
+TEST_EQUAL(completions.Value.size(), 1);
+TEST_EQUAL(completions.Value.front().Name, "rose");
+TEST_EQUAL(completions.Value.front().PostCount, 3);
+
+TEST_CHECK(booru.Delete(rose));
+TEST_EQUAL(booru.MatchTags("ro*").Value.size(), 0);
+TEST_CHECK(booru.SetTagDictionaryEnabled(false));
+TEST_END
+
+TEST_CASE(tag_match_infix)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+Booru::StringVector tagNames = {"long_hair", "short_hair", "Blue_Hair",
+                                "hairband", "chair"};
+for (auto const& name : tagNames)
+{
+    Booru::DB::Entities::Tag tag;
+    tag.Name      = name;
+    tag.TagTypeId = 1;
+    TEST_CHECK(booru.Create(tag));
+}
+
+// dictionary and database must agree
+Booru::StringVector patterns = {"*_hair", "*_hai?", "*air*", "*xyz*",
+                                "b*air", "*_h*r", "*lue*"};
+Booru::Vector<Booru::Vector<Booru::DB::Entities::Tag>> expected;
+for (auto const& pattern : patterns)
+{
+    auto tags = booru.MatchTags(pattern);
+    TEST_CHECK(tags);
+    expected.push_back(tags.Value);
+}
+TEST_EQUAL(expected[0].size(), 3);
+
+auto checkMatches = [&]()
+{
+    for (size_t i = 0; i < patterns.size(); i++)
+    {
+        auto matches = booru.MatchTags(patterns[i]);
+        TEST_CHECK(matches);
+        TEST_EQUAL(matches.Value.size(), expected[i].size());
+        for (size_t j = 0; j < matches.Value.size(); j++)
+            TEST_EQUAL(matches.Value[j].Name, expected[i][j].Name);
+    }
+};
+
+TEST_CHECK(booru.SetTagDictionaryEnabled(true));
+
+// matches of all patterns are read with the same statement
+auto db = booru.GetDatabase();
+TEST_CHECK(db);
+TEST_CHECK(booru.MatchTags(patterns[0]));
+auto stats = db.Value->GetStatementCacheStats();
+checkMatches();
+TEST_EQUAL(db.Value->GetStatementCacheStats().Misses, stats.Misses);
+
+// updated tags are no longer indexed by trigrams
+for (auto const& name : tagNames)
+{
+    auto tag = booru.GetTag(name);
+    TEST_CHECK(tag);
+    TEST_CHECK(booru.Update(tag.Value));
+}
+checkMatches();
+TEST_CHECK(booru.SetTagDictionaryEnabled(false));
+TEST_END
+
+TEST_CASE(tag_suggest)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+auto checkSuggestions = [&]()
+{
+    auto suggestions = booru.SuggestTags("blue_har");
+    TEST_CHECK(suggestions);
+    TEST_TRUE(!suggestions.Value.empty());
+    TEST_EQUAL(suggestions.Value.front().Name, "Blue_Hair");
+    TEST_EQUAL(suggestions.Value.front().Distance, 1);
+
+    // swapped letters are two edits
+    suggestions = booru.SuggestTags("bleu", 2);
+    TEST_CHECK(suggestions);
+    TEST_EQUAL(suggestions.Value.size(), 1);
+    TEST_EQUAL(suggestions.Value.front().Name, "blue");
+    TEST_EQUAL(suggestions.Value.front().Distance, 2);
+
+    suggestions = booru.SuggestTags("chiar", 1);
+    TEST_CHECK(suggestions);
+    TEST_EQUAL(suggestions.Value.size(), 0);
+};
+
+checkSuggestions();
+
+TEST_CHECK(booru.SetTagDictionaryEnabled(true));
+checkSuggestions();
+
+// updated tags are no longer in the sorted part of the dictionary
+auto blue = booru.GetTag("blue");
+TEST_CHECK(blue);
+TEST_CHECK(booru.Update(blue.Value));
+checkSuggestions();
+TEST_CHECK(booru.SetTagDictionaryEnabled(false));
+TEST_END
+
+TEST_CASE(post_query)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+// "a", "a b" and "b" with increasing score, width and date
+Booru::StringVector tagNames = {"query_a", "query_b"};
+for (auto const& name : tagNames)
+{
+    Booru::DB::Entities::Tag tag;
+    tag.Name      = name;
+    tag.TagTypeId = 1;
+    TEST_CHECK(booru.Create(tag));
+}
+
+auto a = booru.GetTag("query_a");
+auto b = booru.GetTag("query_b");
+TEST_CHECK(a);
+TEST_CHECK(b);
+
+Booru::DB::INTEGER const times[] = {1705276800, 1710028800, 1719792000};
+Booru::Vector<Booru::DB::Entities::Post> posts(3);
+for (size_t i = 0; i < posts.size(); i++)
+{
+    posts[i].MD5Sum.fill(0x20 + i);
+    posts[i].PostTypeId = i == 1 ? 5 : 2;
+    posts[i].Score      = 5 + 10 * i;
+    posts[i].Width      = i == 0 ? 800 : 1920 * i;
+    posts[i].AddedTime  = times[i];
+    TEST_CHECK(booru.Create(posts[i]).Update(posts[i]));
+    if (i < 2) TEST_CHECK(booru.AddTagToPost(posts[i], a));
+    if (i > 0) TEST_CHECK(booru.AddTagToPost(posts[i], b));
+}
+
+std::pair<Booru::String, Booru::DB::INTEGER> const queries[] = {
+    {"query_a or query_b", 3},
+    {"( query_a or query_b ) score:>10", 2},
+    {"( query_a or query_b ) width:>=1920", 2},
+    {"( query_a or query_b ) date:2024-01..2024-06", 2},
+    {"( query_a or query_b ) date:2024-03", 1},
+    {"( query_a or query_b ) type:video", 1},
+    {"( query_a or query_b ) -type:video", 2},
+    {"( query_a or query_b ) type:Video", 1},
+    {"( query_a or query_b ) type:unknown_type", 0},
+    {"( query_a or query_b ) -type:unknown_type", 3},
+    {"-( query_a query_b ) ( query_a or query_b )", 2},
+    {"( query_a score:<10 ) or ( query_b score:>20 )", 2},
+    {"md5:" + Booru::ToString(posts[1].MD5Sum), 1},
+};
+
+// index and database have to agree, also when splitting the work
+for (bool indexed : {false, true})
+{
+    TEST_CHECK(booru.SetSearchIndexEnabled(indexed));
+    for (auto const& [query, count] : queries)
+    {
+        auto found = booru.FindPosts(query);
+        TEST_CHECK(found);
+        TEST_EQUAL(Booru::DB::INTEGER(found.Value.size()), count);
+
+        auto counted = booru.CountPosts(query);
+        TEST_CHECK_EQUAL(counted, count);
+    }
+
+    Booru::Search::PostPageRequest request;
+    request.Query    = "( query_a or query_b ) score:>0";
+    request.PageSize = 2;
+
+    auto first = booru.FindPostsPage(request);
+    TEST_CHECK(first);
+    TEST_EQUAL(first.Value.Posts.size(), 2);
+
+    request.Cursor = first.Value.NextCursor;
+    auto second    = booru.FindPostsPage(request);
+    TEST_CHECK(second);
+    TEST_EQUAL(second.Value.Posts.size(), 1);
+    TEST_EQUAL(second.Value.Posts[0].Id, posts[2].Id);
+}
+TEST_CHECK(booru.SetSearchIndexEnabled(false));
+
+// malformed queries
+TEST_CHECK_ERROR(booru.FindPosts("( query_a"));
+TEST_CHECK_ERROR(booru.FindPosts("query_a )"));
+TEST_CHECK_ERROR(booru.FindPosts("query_a or"));
+TEST_CHECK_ERROR(booru.FindPosts("score:>abc"));
+TEST_CHECK_ERROR(booru.FindPosts("md5:xyz"));
+TEST_END
+
+TEST_CASE(post_batch)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+// reuses the posts and tags of post_query
+auto a = booru.GetTag("query_a");
+auto b = booru.GetTag("query_b");
+TEST_CHECK(a);
+TEST_CHECK(b);
+
+auto posts = booru.GetPostsForTag(b.Value.Id);
+TEST_CHECK(posts);
+TEST_EQUAL(posts.Value.size(), 2);
+
+Booru::Vector<Booru::DB::INTEGER> postIds = {posts.Value[1].Id, 1234567,
+                                             posts.Value[0].Id};
+
+// request order, unknown ids skipped
+auto byId = booru.GetPosts(postIds);
+TEST_CHECK(byId);
+TEST_EQUAL(byId.Value.size(), 2);
+TEST_EQUAL(byId.Value[0].Id, posts.Value[1].Id);
+TEST_EQUAL(byId.Value[1].Id, posts.Value[0].Id);
+
+Booru::Vector<Booru::DB::MD5BLOB> sums = {posts.Value[1].MD5Sum,
+                                          posts.Value[0].MD5Sum};
+auto byMD5 = booru.GetPostsByMD5(sums);
+TEST_CHECK(byMD5);
+TEST_EQUAL(byMD5.Value.size(), 2);
+TEST_EQUAL(byMD5.Value[0].Id, posts.Value[1].Id);
+
+Booru::Vector<Booru::DB::TEXT> names = {"query_b", "query_\"missing\"",
+                                        "query_a"};
+auto byName = booru.GetTagsByNames(names);
+TEST_CHECK(byName);
+TEST_EQUAL(byName.Value.size(), 2);
+TEST_EQUAL(byName.Value[0].Id, b.Value.Id);
+TEST_EQUAL(byName.Value[1].Id, a.Value.Id);
+
+// every requested post has an entry, even without tags
+auto tagsByPost = booru.GetTagsForPosts(postIds);
+TEST_CHECK(tagsByPost);
+TEST_EQUAL(tagsByPost.Value.size(), 3);
+TEST_EQUAL(tagsByPost.Value[1234567].size(), 0);
+for (auto const& post : posts.Value)
+{
+    auto tags = booru.GetTagsForPost(post.Id);
+    TEST_CHECK(tags);
+    TEST_EQUAL(tagsByPost.Value[post.Id].size(), tags.Value.size());
+}
+
+Booru::DB::Entities::PostFile file;
+file.PostId = posts.Value[0].Id;
+file.Path   = "file://batch/image.png";
+TEST_CHECK(booru.Create(file));
+
+auto filesByPost = booru.GetFilesForPosts(postIds);
+TEST_CHECK(filesByPost);
+TEST_EQUAL(filesByPost.Value[posts.Value[0].Id].size(), 1);
+TEST_EQUAL(filesByPost.Value[posts.Value[0].Id][0].Path, file.Path);
+TEST_EQUAL(filesByPost.Value[posts.Value[1].Id].size(), 0);
+TEST_END
+
+TEST_CASE(id_set)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+auto db = booru.GetDatabase();
+TEST_CHECK(db);
+
+static constexpr auto sql = "SELECT COUNT(*) FROM IdSet( $Ids )";
+Booru::Vector<Booru::DB::INTEGER> ids = {3, 1, 4, 1, 5};
+
+auto bound = db.Value->PrepareStatement(sql)
+                 .Then(&Booru::DB::IStmt::BindIds, "Ids",
+                       Booru::Span<Booru::DB::INTEGER const>(ids))
+                 .Then(&Booru::DB::IStmt::ExecuteScalar<Booru::DB::INTEGER>,
+                       true);
+TEST_CHECK_EQUAL(bound, 5);
+
+// no ids bound, no rows
+auto unbound =
+    db.Value->PrepareStatement(sql).Then(
+        &Booru::DB::IStmt::ExecuteScalar<Booru::DB::INTEGER>, true);
+TEST_CHECK_EQUAL(unbound, 0);
+
+// searches for different tags share the statement
+TEST_CHECK(booru.FindPosts("query_a"));
+auto stats = db.Value->GetStatementCacheStats();
+TEST_CHECK(booru.FindPosts("query_b"));
+TEST_EQUAL(db.Value->GetStatementCacheStats().Misses, stats.Misses);
+TEST_END
+
+TEST_CASE(tag_implication)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+Booru::StringVector tagNames = {"impl_a", "impl_b", "impl_c",
+                                "impl_d", "impl_e", "impl_alias"};
+Booru::Vector<Booru::DB::Entities::Tag> tags(tagNames.size());
+for (size_t i = 0; i < tags.size(); i++)
+{
+    tags[i].Name      = tagNames[i];
+    tags[i].TagTypeId = 1;
+    TEST_CHECK(booru.Create(tags[i]).Update(tags[i]));
+}
+auto &a = tags[0], &b = tags[1], &c = tags[2];
+auto &d = tags[3], &e = tags[4], &alias = tags[5];
+
+alias.RedirectId = c.Id;
+TEST_CHECK(booru.Update(alias));
+
+// a -> b -> alias = c, c removes d
+auto implies = [&](auto const& _Tag, auto const& _Implied, bool _Remove)
+{
+    Booru::DB::Entities::TagImplication implication;
+    implication.TagId        = _Tag.Id;
+    implication.ImpliedTagId = _Implied.Id;
+    implication.Flags =
+        _Remove ? Booru::DB::Entities::TagImplication::FLAG_REMOVE_TAG : 0;
+    return booru.Create(implication);
+};
+TEST_CHECK(implies(a, b, false));
+TEST_CHECK(implies(b, alias, false));
+TEST_CHECK(implies(c, d, true));
+
+// cycles are rejected, also through redirections
+TEST_CHECK_ERROR(implies(c, a, false));
+TEST_CHECK_ERROR(implies(alias, b, false));
+TEST_CHECK(implies(c, a, true));
+
+Booru::DB::Entities::Post post;
+post.MD5Sum.fill(0x40);
+post.PostTypeId = 2;
+TEST_CHECK(booru.Create(post).Update(post));
+TEST_CHECK(booru.AddTagToPost(post, d));
+TEST_CHECK(booru.AddTagToPost(post, a));
+
+auto postTags = booru.GetTagsForPost(post.Id);
+TEST_CHECK(postTags);
+Booru::StringVector names;
+for (auto const& tag : postTags.Value) names.push_back(tag.Name);
+std::ranges::sort(names);
+TEST_EQUAL(Booru::Strings::Join(names, " "), "impl_a impl_b impl_c");
+
+// created in one batch, the second one closes a cycle
+Booru::Vector<Booru::DB::Entities::TagImplication> batch(2);
+batch[0].TagId        = d.Id;
+batch[0].ImpliedTagId = e.Id;
+batch[1].TagId        = e.Id;
+batch[1].ImpliedTagId = d.Id;
+auto results = booru.CreateMany(
+    Booru::Span<Booru::DB::Entities::TagImplication>(batch));
+TEST_CHECK(results);
+TEST_EQUAL(results.Value.size(), 2);
+TEST_CHECK(results.Value[0]);
+TEST_CHECK_ERROR(results.Value[1]);
+TEST_END
+
+TEST_CASE(tag_redirect)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+Booru::Vector<Booru::DB::Entities::Tag> tags(3);
+for (size_t i = 0; i < tags.size(); i++)
+{
+    tags[i].Name      = "redirect_" + std::to_string(i);
+    tags[i].TagTypeId = 1;
+    TEST_CHECK(booru.Create(tags[i]).Update(tags[i]));
+}
+
+// 0 -> 1 -> 2
+tags[1].RedirectId = tags[2].Id;
+TEST_CHECK(booru.Update(tags[1]));
+tags[0].RedirectId = tags[1].Id;
+TEST_CHECK(booru.Update(tags[0]));
+
+auto final = booru.FollowRedirections(tags[0]);
+TEST_CHECK(final);
+TEST_EQUAL(final.Value.Name, "redirect_2");
+
+// closing the cycle is rejected
+tags[2].RedirectId = tags[0].Id;
+TEST_CHECK_ERROR(booru.Update(tags[2]));
+tags[2].RedirectId = tags[2].Id;
+TEST_CHECK_ERROR(booru.Update(tags[2]));
+
+auto flattened = booru.FlattenTagRedirects();
+TEST_CHECK(flattened);
+TEST_EQUAL(flattened.Value, 1);
+
+auto tag = booru.GetTag(tags[0].Id);
+TEST_CHECK(tag);
+TEST_EQUAL(tag.Value.RedirectId.value_or(-1), tags[2].Id);
+
+auto resolved = booru.ResolveTagRedirect(tags[0].Id);
+TEST_CHECK(resolved);
+TEST_EQUAL(resolved.Value, tags[2].Id);
+TEST_END
+
+TEST_CASE(tag_edit_bulk)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+Booru::Vector<Booru::DB::Entities::Tag> tags(4);
+for (size_t i = 0; i < tags.size(); i++)
+{
+    tags[i].Name      = "bulk_" + std::to_string(i);
+    tags[i].TagTypeId = 1;
+    TEST_CHECK(booru.Create(tags[i]).Update(tags[i]));
+}
+
+// bulk_0 implies bulk_1 and removes bulk_2
+Booru::Vector<Booru::DB::Entities::TagImplication> implications(2);
+implications[0].TagId        = tags[0].Id;
+implications[0].ImpliedTagId = tags[1].Id;
+implications[1].TagId        = tags[0].Id;
+implications[1].ImpliedTagId = tags[2].Id;
+implications[1].Flags = Booru::DB::Entities::TagImplication::FLAG_REMOVE_TAG;
+for (auto& implication : implications) TEST_CHECK(booru.Create(implication));
+
+Booru::Vector<Booru::DB::INTEGER> postIds;
+for (int i = 0; i < 3; i++)
+{
+    Booru::DB::Entities::Post post;
+    post.MD5Sum.fill(0x50 + i);
+    post.PostTypeId = 2;
+    TEST_CHECK(booru.Create(post).Update(post));
+    postIds.push_back(post.Id);
+}
+TEST_CHECK(booru.ApplyTagEdits(postIds, std::vector{tags[2].Id},
+                               std::vector<Booru::DB::INTEGER>{}));
+
+auto counts = booru.ApplyTagEdits(postIds, std::vector{tags[0].Id},
+                                  std::vector{tags[3].Id});
+TEST_CHECK(counts);
+TEST_EQUAL(counts.Value.Added, 6);
+TEST_EQUAL(counts.Value.Removed, 3);
+
+auto postTags = booru.GetTagsForPosts(postIds);
+TEST_CHECK(postTags);
+for (auto postId : postIds)
+{
+    Booru::StringVector names;
+    for (auto const& tag : postTags.Value[postId]) names.push_back(tag.Name);
+    std::ranges::sort(names);
+    TEST_EQUAL(Booru::Strings::Join(names, " "), "bulk_0 bulk_1");
+}
+
+// nothing left to change
+counts = booru.ApplyTagEdits(postIds, std::vector{tags[0].Id},
+                             std::vector{tags[3].Id});
+TEST_CHECK(counts);
+TEST_EQUAL(counts.Value.Added, 0);
+TEST_EQUAL(counts.Value.Removed, 0);
+
+counts = booru.ApplyTagEdits(std::vector{postIds[0]},
+                             std::vector<Booru::DB::INTEGER>{},
+                             std::vector{tags[1].Id});
+TEST_CHECK(counts);
+TEST_EQUAL(counts.Value.Removed, 1);
+TEST_END
+
+TEST_CASE(tag_merge)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+Booru::Vector<Booru::DB::Entities::Tag> tags(3);
+for (size_t i = 0; i < tags.size(); i++)
+{
+    tags[i].Name      = "merge_" + std::to_string(i);
+    tags[i].TagTypeId = 1;
+    TEST_CHECK(booru.Create(tags[i]).Update(tags[i]));
+}
+auto &from = tags[0], &to = tags[1], &implied = tags[2];
+
+Booru::DB::Entities::TagImplication implication;
+implication.TagId        = from.Id;
+implication.ImpliedTagId = implied.Id;
+TEST_CHECK(booru.Create(implication));
+
+// five posts with the old tag, two of them also have the new one
+Booru::Vector<Booru::DB::INTEGER> postIds;
+for (int i = 0; i < 5; i++)
+{
+    Booru::DB::Entities::Post post;
+    post.MD5Sum.fill(0x60 + i);
+    post.PostTypeId = 2;
+    TEST_CHECK(booru.Create(post).Update(post));
+    postIds.push_back(post.Id);
+}
+TEST_CHECK(booru.ApplyTagEdits(postIds, std::vector{from.Id},
+                               std::vector<Booru::DB::INTEGER>{}));
+Booru::Vector<Booru::DB::INTEGER> bothIds(postIds.begin(),
+                                          postIds.begin() + 2);
+TEST_CHECK(booru.ApplyTagEdits(bothIds, std::vector{to.Id},
+                               std::vector<Booru::DB::INTEGER>{}));
+
+auto moved = booru.MergeTags(from, to, 2);
+TEST_CHECK(moved);
+TEST_EQUAL(moved.Value, 3);
+
+auto fromTag = booru.GetTag(from.Id);
+TEST_CHECK(fromTag);
+TEST_EQUAL(fromTag.Value.RedirectId.value_or(-1), to.Id);
+TEST_EQUAL(fromTag.Value.PostCount, 0);
+
+auto toTag = booru.GetTag(to.Id);
+TEST_CHECK(toTag);
+TEST_EQUAL(toTag.Value.PostCount, 5);
+TEST_EQUAL(booru.GetPostsForTag(to.Id).Value.size(), 5);
+
+auto implications = booru.GetTagImplicationsForTag(to);
+TEST_CHECK(implications);
+TEST_EQUAL(implications.Value.size(), 1);
+TEST_EQUAL(implications.Value[0].ImpliedTagId, implied.Id);
+
+// merging back would form a cycle
+TEST_CHECK_ERROR(booru.MergeTags(to, from));
+
+// with b -> c and c -> a, merging b into a would make a imply c
+Booru::Vector<Booru::DB::Entities::Tag> cycleTags(3);
+for (size_t i = 0; i < cycleTags.size(); i++)
+{
+    cycleTags[i].Name      = "merge_cycle_" + std::to_string(i);
+    cycleTags[i].TagTypeId = 1;
+    TEST_CHECK(booru.Create(cycleTags[i]).Update(cycleTags[i]));
+}
+auto &a = cycleTags[0], &b = cycleTags[1], &c = cycleTags[2];
+
+Booru::DB::Entities::TagImplication bc, ca;
+bc.TagId        = b.Id;
+bc.ImpliedTagId = c.Id;
+TEST_CHECK(booru.Create(bc));
+ca.TagId        = c.Id;
+ca.ImpliedTagId = a.Id;
+TEST_CHECK(booru.Create(ca));
+
+TEST_CHECK(booru.MergeTags(b, a, 2));
+
+auto aImplications = booru.GetTagImplicationsForTag(a);
+TEST_CHECK(aImplications);
+TEST_EQUAL(aImplications.Value.size(), 0);
+
+auto cImplications = booru.GetTagImplicationsForTag(c);
+TEST_CHECK(cImplications);
+TEST_EQUAL(cImplications.Value.size(), 1);
+TEST_EQUAL(cImplications.Value[0].ImpliedTagId, a.Id);
+TEST_END
+
+TEST_CASE(db_pool)
+Booru::DB::OpenOptions options;
+options.ReadConnections = 2;
+TEST_CHECK(booru.OpenDatabase(_Path, false, options));
+
+auto db = booru.GetDatabase();
+TEST_CHECK(db);
+
+// reads of other threads don't wait for the writer, nor see its changes
+// before they are committed
+Booru::DB::TransactionGuard guard(db.Value);
+Booru::DB::Entities::Tag tag;
+tag.Name      = "pool_tag";
+tag.TagTypeId = 1;
+TEST_CHECK(booru.Create(tag));
+TEST_CHECK(booru.GetTag("pool_tag"));
+
+Booru::ResultCode uncommitted = Booru::ResultCode::Undefined;
+std::thread([&] { uncommitted = booru.GetTag("pool_tag").Code; }).join();
+TEST_CHECK_ERROR(uncommitted);
+TEST_CHECK(guard.Commit());
+TEST_FALSE(db.Value->IsInTransaction());
+
+// writes are compiled on a read connection only the first time
+static constexpr auto writeSql =
+    "UPDATE Tags SET Description = 'pool' WHERE Name = 'pool_tag'";
+TEST_CHECK(db.Value->PrepareStatement(writeSql)
+               .Then(&Booru::DB::IStmt::StepUpdate, false));
+auto stats = db.Value->GetStatementCacheStats();
+TEST_CHECK(db.Value->PrepareStatement(writeSql)
+               .Then(&Booru::DB::IStmt::StepUpdate, false));
+TEST_EQUAL(db.Value->GetStatementCacheStats().Misses, stats.Misses);
+TEST_EQUAL(db.Value->GetStatementCacheStats().Size, stats.Size);
+
+// more threads than read connections, the rest read through the writer
+Booru::Vector<Booru::ResultCode> results(4, Booru::ResultCode::Undefined);
+Booru::Vector<std::thread> threads;
+for (size_t i = 0; i < results.size(); i++)
+{
+    threads.emplace_back(
+        [&, i]
+        {
+            for (int j = 0; j < 20; j++)
+            {
+                results[i] = booru.GetTag("pool_tag").Code;
+                if (Booru::ResultIsError(results[i])) break;
+            }
+        });
+}
+for (auto& thread : threads) thread.join();
+for (auto result : results) TEST_CHECK(result);
+
+// threads that exited return their connections for new threads to use
+auto pool = std::dynamic_pointer_cast<Booru::DB::Sqlite3::Pool>(db.Value);
+TEST_TRUE(pool != nullptr);
+for (size_t i = 0; i < 4 * options.ReadConnections; i++)
+{
+    bool hasReader = false;
+    std::thread(
+        [&]
+        {
+            hasReader = booru.GetTag("pool_tag") && pool->HasReader();
+        })
+        .join();
+    TEST_TRUE(hasReader);
+}
+
+// writes outside of a transaction go to the writer as well
+TEST_CHECK(booru.SetConfig("test.pool", "written"));
+std::thread([&] { uncommitted = booru.GetConfig("test.pool").Code; })
+    .join();
+TEST_CHECK(uncommitted);
+TEST_END
+
+TEST_CASE(db_options)
+auto pragma = [&](Booru::StringView _Name)
+{
+    return booru.GetDatabase()
+        .Then(&Booru::DB::IBackend::PrepareStatement,
+              "PRAGMA " + Booru::String(_Name))
+        .Then(&Booru::DB::IStmt::ExecuteScalar<Booru::DB::TEXT>, true);
+};
+
+TEST_CHECK(booru.OpenDatabase(_Path, false,
+                              Booru::DB::OpenOptions::BulkImport()));
+TEST_CHECK_EQUAL(pragma("journal_mode"), "memory");
+TEST_CHECK_EQUAL(pragma("synchronous"), "0");
+TEST_CHECK_EQUAL(pragma("cache_size"), "-262144");
+TEST_CHECK_EQUAL(pragma("temp_store"), "2");
+TEST_CHECK(booru.SetConfig("test.options", "bulk"));
+TEST_FALSE(booru.GetDatabase().Value->IsReadOnly());
+
+Booru::DB::OpenOptions options;
+options.BusyTimeout = 100;
+options.ReadOnly    = true;
+TEST_CHECK(booru.OpenDatabase(_Path, false, options));
+TEST_CHECK_EQUAL(booru.GetConfig("test.options"), "bulk");
+TEST_CHECK_ERROR(booru.SetConfig("test.options", "read only"));
+TEST_TRUE(booru.GetDatabase().Value->IsReadOnly());
+
+options.ReadOnly  = false;
+options.Immutable = true;
+TEST_CHECK(booru.OpenDatabase(_Path, false, options));
+TEST_CHECK_EQUAL(booru.GetConfig("test.options"), "bulk");
+TEST_CHECK_ERROR(booru.SetConfig("test.options", "immutable"));
+TEST_TRUE(booru.GetDatabase().Value->IsReadOnly());
+
+TEST_CHECK(booru.OpenDatabase(_Path, false,
+                              Booru::DB::OpenOptions::ReadHeavyServing(2)));
+TEST_CHECK_EQUAL(pragma("journal_mode"), "wal");
+TEST_CHECK(booru.SetConfig("test.options", "serving"));
+TEST_CHECK_EQUAL(booru.GetConfig("test.options"), "serving");
+TEST_FALSE(booru.GetDatabase().Value->IsReadOnly());
+
+// read connections only work in WAL mode
+options         = Booru::DB::OpenOptions::ReadHeavyServing(2);
+options.Journal = Booru::DB::JournalMode::Delete;
+TEST_CHECK_ERROR(booru.OpenDatabase(_Path, false, options));
+TEST_END
+
+TEST_CASE(write_queue)
+Booru::DB::OpenOptions options;
+options.ReadConnections = 2;
+TEST_CHECK(booru.OpenDatabase(_Path, false, options));
+booru.SetWriteBatchLimits(16, std::chrono::milliseconds(10));
+
+// every change runs in a transaction, a failing one only fails itself
+Booru::Vector<Booru::ResultCode> results(40, Booru::ResultCode::Undefined);
+Booru::Vector<std::thread> threads;
+for (size_t t = 0; t < 4; t++)
+{
+    threads.emplace_back(
+        [&, t]
+        {
+            Booru::Vector<std::future<Booru::ResultCode>> futures;
+            for (size_t i = t; i < results.size(); i += 4)
+            {
+                futures.push_back(booru.SubmitWrite(
+                    [i](Booru::Booru& _Booru)
+                    {
+                        if (i == 13) return Booru::ResultCode::InvalidArgument;
+                        auto db = _Booru.GetDatabase();
+                        if (!db || !db.Value->IsInTransaction())
+                            return Booru::ResultCode::InvalidState;
+                        return _Booru.SetConfig("queue." + std::to_string(i),
+                                                std::to_string(i));
+                    }));
+            }
+            for (size_t i = t, j = 0; i < results.size(); i += 4, j++)
+                results[i] = futures[j].get();
+        });
+}
+for (auto& thread : threads) thread.join();
+
+for (size_t i = 0; i < results.size(); i++)
+{
+    auto config = booru.GetConfig("queue." + std::to_string(i));
+    if (i == 13)
+    {
+        TEST_EQUAL(Booru::ResultToString(results[i]),
+                   Booru::ResultToString(Booru::ResultCode::InvalidArgument));
+        TEST_CHECK_ERROR(config);
+        continue;
+    }
+    TEST_CHECK(results[i]);
+    TEST_CHECK_EQUAL(config, std::to_string(i));
+}
+
+// a change that throws is rolled back, the write thread keeps running
+auto thrown = booru.SubmitWrite(
+    [](Booru::Booru& _Booru) -> Booru::ResultCode
+    {
+        TEST_CHECK(_Booru.SetConfig("queue.thrown", "1"));
+        throw std::runtime_error("change failed");
+    });
+TEST_CHECK_ERROR(thrown.get());
+TEST_CHECK_ERROR(booru.GetConfig("queue.thrown"));
+
+// changes still queued are made before the database is closed
+auto last = booru.SubmitWrite([](Booru::Booru& _Booru)
+                              { return _Booru.SetConfig("queue.last", "1"); });
+booru.CloseDatabase();
+TEST_CHECK(last.get());
+TEST_CHECK_ERROR(booru.SubmitWrite([](Booru::Booru&)
+                                   { return Booru::ResultCode::OK; })
+                     .get());
+TEST_END
+
+TEST_CASE(transaction_savepoint)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+
+auto db = booru.GetDatabase();
+TEST_CHECK(db);
+
+Booru::DB::Entities::Tag outer;
+outer.Name      = "savepoint_outer";
+outer.TagTypeId = 1;
+Booru::DB::Entities::Tag inner;
+inner.Name      = "savepoint_inner";
+inner.TagTypeId = 1;
+
+// a nested rollback only undoes its own changes
+{
+    Booru::DB::TransactionGuard guard(db.Value);
+    TEST_CHECK(booru.Create(outer));
+    uint64_t rollbacks = db.Value->GetRollbackCount();
+    {
+        Booru::DB::TransactionGuard nested(db.Value);
+        TEST_CHECK(booru.Create(inner));
+        TEST_CHECK(booru.GetTag("savepoint_inner"));
+    }
+    TEST_EQUAL(db.Value->GetRollbackCount(), rollbacks + 1);
+    TEST_CHECK_ERROR(booru.GetTag("savepoint_inner"));
+
+    // caches only go stale if they were changed in the rolled back scope
+    {
+        Booru::DB::TransactionGuard nested(db.Value);
+        TEST_CHECK(booru.GetTag("savepoint_outer"));
+    }
+    TEST_EQUAL(db.Value->GetRollbackCount(), rollbacks + 1);
+
+    // kept changes of a nested transaction belong to the outer one
+    Booru::DB::Entities::Tag kept;
+    kept.Name      = "savepoint_kept";
+    kept.TagTypeId = 1;
+    {
+        Booru::DB::TransactionGuard nested(db.Value);
+        TEST_CHECK(booru.Create(kept));
+        TEST_CHECK(nested.Commit());
+    }
+    TEST_CHECK(guard.Commit());
+}
+TEST_FALSE(db.Value->IsInTransaction());
+TEST_CHECK(booru.GetTag("savepoint_outer"));
+TEST_CHECK(booru.GetTag("savepoint_kept"));
+TEST_CHECK_ERROR(booru.GetTag("savepoint_inner"));
+
+// rolling back the outer transaction undoes committed nested ones
+{
+    Booru::DB::TransactionGuard guard(db.Value);
+    {
+        Booru::DB::TransactionGuard nested(db.Value);
+        TEST_CHECK(booru.Create(inner));
+        TEST_CHECK(nested.Commit());
+    }
+}
+TEST_CHECK_ERROR(booru.GetTag("savepoint_inner"));
+TEST_END
+
+TEST_CASE(search_intersect)
+using Booru::Search::InstructionSet;
+
+// every supported instruction set has to match the standard library
+for (auto set :
+     {InstructionSet::Scalar, InstructionSet::SSE42, InstructionSet::AVX2})
+{
+    if (set > Booru::Search::GetSupportedInstructionSet()) continue;
+    Booru::Search::SetInstructionSet(set);
+    TEST_TRUE(Booru::Search::GetInstructionSet() == set);
+    TEST_EQUAL(CheckSetOperations<uint32_t>(), 0);
+    TEST_EQUAL(CheckSetOperations<int64_t>(), 0);
+}
+Booru::Search::SetInstructionSet(Booru::Search::GetSupportedInstructionSet());
+TEST_END
+
+TEST_CASE(post_page_large)
+TEST_CHECK(booru.OpenDatabase(_Path, false));
+TEST_CHECK(booru.SetSearchIndexEnabled(true));
+
+Booru::DB::Entities::Tag tag;
+tag.Name      = "paged";
+tag.TagTypeId = 1;
+TEST_CHECK(booru.Create(tag).Update(tag));
+
+Booru::Vector<Booru::DB::Entities::Post> posts(500);
+for (size_t i = 0; i < posts.size(); i++)
+{
+    posts[i].MD5Sum.fill(0);
+    posts[i].MD5Sum[0]  = 0xa0;
+    posts[i].MD5Sum[1]  = uint8_t(i >> 8);
+    posts[i].MD5Sum[2]  = uint8_t(i);
+    posts[i].PostTypeId = 2;
+    posts[i].Score      = Booru::DB::INTEGER(i % 50);
+}
+TEST_CHECK(booru.CreateMany<Booru::DB::Entities::Post>(posts));
+
+Booru::Vector<Booru::DB::INTEGER> postIds;
+for (auto const& post : posts) postIds.push_back(post.Id);
+TEST_CHECK(booru.ApplyTagEdits(postIds, std::vector{tag.Id},
+                               std::vector<Booru::DB::INTEGER>{}));
+
+// the column term is applied to the matches of the index once, later pages
+// are cut out of the cached result
+Booru::Search::PostPageRequest request;
+request.Query      = "paged score:>10";
+request.Order      = Booru::Search::PostOrder::Score;
+request.Descending = true;
+request.PageSize   = 20;
+
+auto stats = booru.GetSearchCacheStats();
+Booru::Vector<Booru::DB::Entities::Post> paged;
+size_t pages = 0;
+do
+{
+    auto page = booru.FindPostsPage(request);
+    TEST_CHECK(page);
+    paged.insert(std::end(paged), std::begin(page.Value.Posts),
+                 std::end(page.Value.Posts));
+    request.Cursor = page.Value.NextCursor;
+    pages++;
+} while (!request.Cursor.empty());
+
+auto after = booru.GetSearchCacheStats();
+TEST_EQUAL(paged.size(), 390);
+TEST_EQUAL(pages, 20);
+TEST_EQUAL(after.Misses, stats.Misses + 1);
+TEST_EQUAL(after.Hits, stats.Hits + pages - 1);
+TEST_EQUAL(after.SortKeyLoads, stats.SortKeyLoads + 1);
+
+for (size_t i = 1; i < paged.size(); i++)
+{
+    auto const& previous = paged[i - 1];
+    auto const& post     = paged[i];
+    TEST_TRUE(post.Score < previous.Score ||
+              (post.Score == previous.Score && post.Id < previous.Id));
+}
+TEST_CHECK(booru.SetSearchIndexEnabled(false));
+TEST_END
+
+TEST_CASE(cache_concurrency)
+Booru::DB::OpenOptions options;
+options.ReadConnections = 2;
+TEST_CHECK(booru.OpenDatabase(_Path, false, options));
+TEST_CHECK(booru.SetSearchIndexEnabled(true));
+TEST_CHECK(booru.SetTagDictionaryEnabled(true));
+
+Booru::DB::Entities::Tag tag;
+tag.Name      = "concurrent";
+tag.TagTypeId = 1;
+TEST_CHECK(booru.Create(tag).Update(tag));
+
+// searches of other threads read the caches while the write thread updates
+// them from its hooks
+std::atomic<bool> writing = true;
+Booru::Vector<Booru::ResultCode> results(3, Booru::ResultCode::Undefined);
+Booru::Vector<std::thread> threads;
+for (size_t t = 0; t < results.size(); t++)
+{
+    threads.emplace_back(
+        [&, t]
+        {
+            do
+            {
+                results[t] = t == 0   ? booru.FindPosts("concurrent").Code
+                             : t == 1 ? booru.CountPosts("concurrent").Code
+                                      : booru.MatchTags("concurrent*").Code;
+            } while (writing && !Booru::ResultIsError(results[t]));
+        });
+}
+
+Booru::Vector<std::future<Booru::ResultCode>> futures;
+for (size_t i = 0; i < 40; i++)
+{
+    futures.push_back(booru.SubmitWrite(
+        [&tag, i](Booru::Booru& _Booru)
+        {
+            Booru::DB::Entities::Post post;
+            post.MD5Sum.fill(0);
+            post.MD5Sum[0]  = 0xc0;
+            post.MD5Sum[1]  = uint8_t(i);
+            post.PostTypeId = 2;
+            auto created = _Booru.Create(post);
+            if (Booru::ResultIsError(created.Code)) return created.Code;
+
+            Booru::DB::Entities::Tag other;
+            other.Name      = "concurrent_" + std::to_string(i);
+            other.TagTypeId = 1;
+            auto otherTag   = _Booru.Create(other);
+            if (Booru::ResultIsError(otherTag.Code)) return otherTag.Code;
+
+            return _Booru
+                .ApplyTagEdits(std::vector{created.Value.Id},
+                               std::vector{tag.Id, otherTag.Value.Id},
+                               std::vector<Booru::DB::INTEGER>{})
+                .Code;
+        }));
+}
+for (auto& future : futures) TEST_CHECK(future.get());
+writing = false;
+for (auto& thread : threads) thread.join();
+for (auto result : results) TEST_CHECK(result);
+
+// nothing evaluated before a change stays cached after it
+auto posts = booru.FindPosts("concurrent");
+TEST_CHECK(posts);
+TEST_EQUAL(posts.Value.size(), 40);
+TEST_CHECK_EQUAL(booru.CountPosts("concurrent"), 40);
+auto tags = booru.MatchTags("concurrent*");
+TEST_CHECK(tags);
+TEST_EQUAL(tags.Value.size(), 41);
+booru.CloseDatabase();
+TEST_END
 }
 ;
 
@@ -21,11 +21,11 @@
     }
 #define TEST_TRUE(cond)                                                        \
     {                                                                          \
-        test_equal(!!(cond), true, #cond);                                     \
+        test_equal(!!(cond), true, #cond, "true");                             \
     }
 #define TEST_FALSE(cond)                                                       \
     {                                                                          \
-        test_equal(!(cond), true, #cond);                                      \
+        test_equal(!(cond), true, #cond, "false");                             \
     }
 
 static inline void PASS() { exit(EXIT_SUCCESS); }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <booru/db/entities/post.hh>
 #include <booru/db/entities/tag.hh>
 
 static bool operator==(Booru::DB::Entities::Tag const &_A, Booru::DB::Entities::Tag const & _B) 
@@ -12,3 +13,18 @@ static bool operator==(Booru::DB::Entities::Tag const &_A, Booru::DB::Entities::
         _A.TagTypeId == _B.TagTypeId &&
         _A.RedirectId == _B.RedirectId;
 }
+
+static bool operator==(Booru::DB::Entities::Post const &_A, Booru::DB::Entities::Post const & _B) 
+{
+    return 
+        _A.Id == _B.Id &&
+        _A.MD5Sum == _B.MD5Sum &&
+        _A.Flags == _B.Flags &&
+        _A.PostTypeId == _B.PostTypeId &&
+        _A.MimeType == _B.MimeType &&
+        _A.Rating == _B.Rating &&
+        _A.Score == _B.Score &&
+        _A.Height == _B.Height &&
+        _A.Width == _B.Width &&
+        _A.AddedTime == _B.AddedTime;
+}